@@ -0,0 +1,223 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#ifndef MWR_BENCH_H
+#define MWR_BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "mwr/core/compiler.h"
+#include "mwr/core/types.h"
+#include "mwr/stl/strings.h"
+
+#ifdef MWR_LINUX
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+std::vector<std::string> args;
+
+// heap accounting: every allocation made by the benchmark is tracked so that
+// the memory footprint of a data structure can be reported per element
+std::atomic<size_t> g_heap_bytes(0);
+
+void* operator new(size_t size) {
+    void* ptr = malloc(size + 16);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    *(size_t*)ptr = size;
+    g_heap_bytes += size;
+    return (char*)ptr + 16;
+}
+
+void operator delete(void* ptr) noexcept {
+    if (ptr == nullptr)
+        return;
+    void* base = (char*)ptr - 16;
+    g_heap_bytes -= *(size_t*)base;
+    free(base);
+}
+
+void operator delete(void* ptr, size_t size) noexcept {
+    operator delete(ptr);
+}
+
+template <typename T>
+T bench_option(const std::string& name, const T& def) {
+    std::string prefix = "--" + name + "=";
+    for (const std::string& arg : args) {
+        if (mwr::starts_with(arg, prefix))
+            return mwr::from_string<T>(arg.substr(prefix.length()));
+    }
+
+    return def;
+}
+
+inline std::vector<size_t> bench_sizes(size_t lo, size_t hi) {
+    std::vector<size_t> sizes;
+    size_t max = bench_option<size_t>("max", hi);
+    for (size_t n = lo; n <= hi && n <= max; n *= 10)
+        sizes.push_back(n);
+    return sizes;
+}
+
+class perf_counter
+{
+private:
+    int m_fd;
+
+public:
+    bool is_available() const { return m_fd >= 0; }
+
+    perf_counter(mwr::u32 type, mwr::u64 config): m_fd(-1) {
+#ifdef MWR_LINUX
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        m_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+
+    ~perf_counter() {
+#ifdef MWR_LINUX
+        if (m_fd >= 0)
+            close(m_fd);
+#endif
+    }
+
+    perf_counter(const perf_counter&) = delete;
+
+    void start() {
+#ifdef MWR_LINUX
+        if (m_fd >= 0) {
+            ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    mwr::u64 stop() {
+        mwr::u64 count = 0;
+#ifdef MWR_LINUX
+        if (m_fd >= 0) {
+            ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(m_fd, &count, sizeof(count)) != sizeof(count))
+                count = 0;
+        }
+#endif
+        return count;
+    }
+
+    static perf_counter& cache_misses() {
+#ifdef MWR_LINUX
+        static perf_counter counter(PERF_TYPE_HARDWARE,
+                                    PERF_COUNT_HW_CACHE_MISSES);
+#else
+        static perf_counter counter(0, 0);
+#endif
+        return counter;
+    }
+};
+
+struct bench_result {
+    double seconds;
+    mwr::u64 cache_misses;
+};
+
+template <typename FN>
+bench_result bench_measure(FN fn) {
+    using clock = std::chrono::steady_clock;
+    perf_counter& misses = perf_counter::cache_misses();
+
+    misses.start();
+    auto t0 = clock::now();
+    fn();
+    auto t1 = clock::now();
+    mwr::u64 count = misses.stop();
+
+    std::chrono::duration<double> delta = t1 - t0;
+    return { delta.count(), count };
+}
+
+inline void bench_report(const std::string& name,
+                         const std::vector<std::string>& metrics) {
+    std::string line = mwr::mkstr("%-44s", name.c_str());
+    for (const std::string& metric : metrics)
+        line += " " + metric;
+    printf("%s\n", mwr::rtrim(line).c_str());
+    fflush(stdout);
+}
+
+inline void bench_report(const std::string& name, size_t n, size_t ops,
+                         const bench_result& res, double bytes = 0.0) {
+    std::vector<std::string> metrics;
+    metrics.push_back(mwr::mkstr("n=%-9zu", n));
+    metrics.push_back(mwr::mkstr("ns/op=%-10.1f", res.seconds * 1e9 / ops));
+    if (bytes > 0.0)
+        metrics.push_back(mwr::mkstr("bytes/elem=%-7.1f", bytes));
+    if (perf_counter::cache_misses().is_available()) {
+        double misses = (double)res.cache_misses / ops;
+        metrics.push_back(mwr::mkstr("misses/op=%.2f", misses));
+    }
+
+    bench_report(name, metrics);
+}
+
+struct benchmark {
+    const char* name;
+    void (*func)();
+};
+
+inline std::vector<benchmark>& benchmarks() {
+    static std::vector<benchmark> all;
+    return all;
+}
+
+#define MWR_BENCHMARK(name)                                              \
+    static void MWR_CAT(bench_, name)();                                 \
+    [[maybe_unused]] static bool MWR_CAT(bench_registered_, name) = [] { \
+        benchmarks().push_back({ #name, &MWR_CAT(bench_, name) });       \
+        return true;                                                     \
+    }();                                                                 \
+    static void MWR_CAT(bench_, name)()
+
+int main(int argc, char** argv) {
+    for (int i = 0; i < argc; i++)
+        args.push_back(argv[i]);
+
+    std::string filter = bench_option<std::string>("filter", "");
+    if (!perf_counter::cache_misses().is_available())
+        printf("perf counters unavailable, not reporting cache misses\n");
+
+    for (const benchmark& bench : benchmarks()) {
+        if (filter.empty() || strstr(bench.name, filter.c_str()))
+            bench.func();
+    }
+
+    return EXIT_SUCCESS;
+}
+
+#endif
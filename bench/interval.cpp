@@ -0,0 +1,153 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#include "bench.h"
+
+#include "mwr/utils/interval.h"
+
+#include <cmath>
+#include <random>
+
+using namespace mwr;
+
+struct range {
+    u64 lo;
+    u64 hi;
+};
+
+static volatile size_t g_sink;
+static const u64 PAGE_SIZE = 4 * KiB;
+
+// n contiguous, non-overlapping pages, inserted in random order
+static vector<range> dense_ranges(size_t n, std::mt19937_64& rng) {
+    vector<range> ranges(n);
+    for (size_t i = 0; i < n; i++)
+        ranges[i] = { i * PAGE_SIZE, (i + 1) * PAGE_SIZE - 1 };
+    std::shuffle(ranges.begin(), ranges.end(), rng);
+    return ranges;
+}
+
+// short breakpoint ranges, on average every address is covered ~32 times
+static vector<range> overlapping_ranges(size_t n, std::mt19937_64& rng) {
+    vector<range> ranges(n);
+    u64 space = n * 64;
+    for (size_t i = 0; i < n; i++) {
+        u64 lo = rng() % space;
+        ranges[i] = { lo, lo + rng() % PAGE_SIZE };
+    }
+    return ranges;
+}
+
+static vector<u64> uniform_queries(size_t n, u64 space, std::mt19937_64& rng) {
+    vector<u64> queries(n);
+    for (u64& addr : queries)
+        addr = rng() % space;
+    return queries;
+}
+
+// log-uniform page indices approximate a zipf distribution: a few hot pages
+// receive most of the lookups, the long tail is touched only rarely
+static vector<u64> skewed_queries(size_t n, size_t pages,
+                                  std::mt19937_64& rng) {
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    vector<u64> queries(n);
+    for (u64& addr : queries) {
+        u64 page = (u64)std::pow((double)pages, dist(rng)) - 1;
+        addr = min<u64>(page, pages - 1) * PAGE_SIZE + rng() % PAGE_SIZE;
+    }
+    return queries;
+}
+
+template <typename TREE>
+static void bench_tree(const string& name, const vector<range>& ranges,
+                       const vector<u64>& queries, u64 qlen,
+                       std::mt19937_64& rng) {
+    size_t n = ranges.size();
+    size_t q = queries.size();
+
+    TREE tree;
+    vector<typename TREE::iterator> elems;
+    elems.reserve(n);
+
+    size_t heap = g_heap_bytes;
+    bench_result res = bench_measure([&]() {
+        for (const range& r : ranges)
+            elems.push_back(tree.insert(r.lo, r.hi, r.lo));
+    });
+
+    double bytes = (double)(g_heap_bytes - heap) / n;
+    bench_report(name + "/insert", n, n, res, bytes);
+
+    res = bench_measure([&]() {
+        size_t hits = 0;
+        for (u64 addr : queries)
+            hits += tree.overlaps(addr, addr + qlen);
+        g_sink = hits;
+    });
+
+    bench_report(name + "/overlaps", n, q, res);
+
+    res = bench_measure([&]() {
+        size_t hits = 0;
+        for (u64 addr : queries)
+            hits += tree.find_overlaps(addr, addr + qlen).size();
+        g_sink = hits;
+    });
+
+    bench_report(name + "/find_overlaps", n, q, res);
+
+    std::shuffle(elems.begin(), elems.end(), rng);
+    res = bench_measure([&]() {
+        for (const auto& it : elems)
+            tree.remove(it);
+    });
+
+    bench_report(name + "/remove", n, n, res);
+}
+
+static size_t num_queries(size_t n) {
+    return bench_option<size_t>("queries", min<size_t>(n, 1000000));
+}
+
+MWR_BENCHMARK(interval_dense) {
+    for (size_t n : bench_sizes(1000, 10000000)) {
+        std::mt19937_64 rng(n);
+        auto ranges = dense_ranges(n, rng);
+        auto queries = uniform_queries(num_queries(n), n * PAGE_SIZE, rng);
+        bench_tree<interval_tree<u64>>("interval_tree/dense", ranges, queries,
+                                       0, rng);
+        bench_tree<compact_interval_tree<u64>>("compact_interval_tree/dense",
+                                               ranges, queries, 0, rng);
+    }
+}
+
+MWR_BENCHMARK(interval_overlap) {
+    for (size_t n : bench_sizes(1000, 10000000)) {
+        std::mt19937_64 rng(n);
+        auto ranges = overlapping_ranges(n, rng);
+        auto queries = uniform_queries(num_queries(n), n * 64, rng);
+        bench_tree<interval_tree<u64>>("interval_tree/overlap", ranges,
+                                       queries, 63, rng);
+        bench_tree<compact_interval_tree<u64>>("compact_interval_tree/overlap",
+                                               ranges, queries, 63, rng);
+    }
+}
+
+MWR_BENCHMARK(interval_skewed) {
+    for (size_t n : bench_sizes(1000, 10000000)) {
+        std::mt19937_64 rng(n);
+        auto ranges = dense_ranges(n, rng);
+        auto queries = skewed_queries(num_queries(n), n, rng);
+        bench_tree<interval_tree<u64>>("interval_tree/skewed", ranges,
+                                       queries, 0, rng);
+        bench_tree<compact_interval_tree<u64>>("compact_interval_tree/skewed",
+                                               ranges, queries, 0, rng);
+    }
+}
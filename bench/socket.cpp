@@ -0,0 +1,325 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#include "bench.h"
+
+#include "mwr/core/utils.h"
+#include "mwr/utils/socket.h"
+#include "mwr/utils/shm_socket.h"
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+
+using namespace mwr;
+
+// one side of a connection, as seen by the benchmark
+class endpoint
+{
+public:
+    virtual ~endpoint() = default;
+    virtual void send(const void* data, size_t size) = 0;
+    virtual void recv(void* data, size_t size) = 0;
+};
+
+// A transport connects a number of clients to a single server. To measure a
+// new kind of socket, implement it here and add it to transports() below.
+class transport
+{
+public:
+    virtual ~transport() = default;
+
+    virtual const char* name() const = 0;
+    virtual bool has_nodelay() const { return false; }
+
+    virtual void connect(size_t clients, bool nodelay) = 0;
+    virtual endpoint& client(size_t i) = 0;
+    virtual endpoint& server(size_t i) = 0;
+};
+
+class socket_endpoint : public endpoint
+{
+public:
+    mwr::socket sock;
+
+    void send(const void* data, size_t size) override {
+        sock.send(data, size);
+    }
+
+    void recv(void* data, size_t size) override { sock.recv(data, size); }
+};
+
+class server_endpoint : public endpoint
+{
+public:
+    server_socket& server;
+    int id;
+
+    server_endpoint(server_socket& s, int i): server(s), id(i) {}
+
+    void send(const void* data, size_t size) override {
+        server.send(id, data, size);
+    }
+
+    void recv(void* data, size_t size) override {
+        server.recv(id, data, size);
+    }
+};
+
+class shm_endpoint : public endpoint
+{
+public:
+    shm_socket sock;
+
+    void send(const void* data, size_t size) override {
+        sock.send(data, size);
+    }
+
+    void recv(void* data, size_t size) override { sock.recv(data, size); }
+};
+
+// waits for the server to accept a new connection and returns its id
+static int accept_next(server_socket& server, size_t known) {
+    while (server.num_clients() <= known)
+        server.poll(10);
+
+    vector<int> ids = server.clients();
+    std::sort(ids.begin(), ids.end());
+    return ids.back();
+}
+
+class stream_transport : public transport
+{
+public:
+    void connect(size_t clients, bool nodelay) override {
+        m_server.reset(new server_socket(clients));
+        m_server->set_tcp_nodelay(nodelay);
+        listen(*m_server);
+
+        for (size_t i = 0; i < clients; i++) {
+            auto* client = new socket_endpoint();
+            m_clients.emplace_back(client);
+            connect(client->sock);
+            int id = accept_next(*m_server, i);
+            m_servers.emplace_back(new server_endpoint(*m_server, id));
+        }
+    }
+
+    endpoint& client(size_t i) override { return *m_clients[i]; }
+    endpoint& server(size_t i) override { return *m_servers[i]; }
+
+protected:
+    virtual void listen(server_socket& server) = 0;
+    virtual void connect(mwr::socket& sock) = 0;
+
+    std::unique_ptr<server_socket> m_server;
+    vector<std::unique_ptr<socket_endpoint>> m_clients;
+    vector<std::unique_ptr<server_endpoint>> m_servers;
+};
+
+class tcp_transport : public stream_transport
+{
+public:
+    const char* name() const override { return "tcp"; }
+    bool has_nodelay() const override { return true; }
+
+protected:
+    void listen(server_socket& server) override {
+        server.listen(0, "127.0.0.1");
+    }
+
+    void connect(mwr::socket& sock) override {
+        sock.connect(m_server->host(), m_server->port());
+    }
+};
+
+#ifndef MWR_WINDOWS
+class unix_transport : public stream_transport
+{
+public:
+    const char* name() const override { return "unix"; }
+
+protected:
+    void listen(server_socket& server) override {
+        server.listen_unix(mkstr("@mwr_bench_%d", mwr::getpid()));
+    }
+
+    void connect(mwr::socket& sock) override {
+        sock.connect_unix(m_server->host());
+    }
+};
+#endif
+
+class shm_transport : public transport
+{
+public:
+    const char* name() const override { return "shm"; }
+
+    void connect(size_t clients, bool nodelay) override {
+        m_server.reset(new server_socket(clients, 0, "127.0.0.1"));
+        for (size_t i = 0; i < clients; i++) {
+            m_clients.emplace_back(new shm_endpoint());
+            m_servers.emplace_back(new shm_endpoint());
+            std::thread t([&]() {
+                int id = accept_next(*m_server, i);
+                m_servers[i]->sock.accept(*m_server, id);
+            });
+
+            m_clients[i]->sock.connect(m_server->host(), m_server->port());
+            t.join();
+        }
+    }
+
+    endpoint& client(size_t i) override { return *m_clients[i]; }
+    endpoint& server(size_t i) override { return *m_servers[i]; }
+
+private:
+    std::unique_ptr<server_socket> m_server;
+    vector<std::unique_ptr<shm_endpoint>> m_clients;
+    vector<std::unique_ptr<shm_endpoint>> m_servers;
+};
+
+typedef std::function<transport*()> transport_factory;
+
+static vector<transport_factory> transports() {
+    vector<transport_factory> all;
+    all.push_back([]() { return new tcp_transport(); });
+#ifndef MWR_WINDOWS
+    all.push_back([]() { return new unix_transport(); });
+#endif
+    all.push_back([]() { return new shm_transport(); });
+    return all;
+}
+
+// runs fn for every selected transport, client count and nodelay setting
+static void for_each_config(
+    const std::function<void(transport&, size_t, const string&)>& fn) {
+    string only = bench_option<string>("transport", "");
+    size_t max_clients = bench_option<size_t>("clients", 4);
+
+    for (const transport_factory& factory : transports()) {
+        std::unique_ptr<transport> probe(factory());
+        if (!only.empty() && only != probe->name())
+            continue;
+
+        for (size_t clients = 1; clients <= max_clients; clients *= 4) {
+            for (bool nodelay : { true, false }) {
+                if (!nodelay && !probe->has_nodelay())
+                    continue;
+
+                std::unique_ptr<transport> t(factory());
+                t->connect(clients, nodelay);
+                string name = mkstr("socket/%s%s", t->name(),
+                                    nodelay ? "" : "/delay");
+                fn(*t, clients, name);
+            }
+        }
+    }
+}
+
+static double percentile(const vector<double>& sorted, double p) {
+    size_t idx = (size_t)(p * (sorted.size() - 1));
+    return sorted[idx];
+}
+
+static const vector<size_t> MESSAGE_SIZES = { 16, 256, 4 * KiB, 64 * KiB };
+
+MWR_BENCHMARK(socket_latency) {
+    const size_t iters = bench_option<size_t>("iters", 10000);
+
+    for_each_config([&](transport& t, size_t clients, const string& name) {
+        for (size_t size : MESSAGE_SIZES) {
+            vector<vector<double>> samples(clients);
+            vector<std::thread> threads;
+
+            // every client pings its own echo thread on the server side
+            for (size_t i = 0; i < clients; i++) {
+                threads.emplace_back([&, i]() {
+                    vector<u8> buf(size);
+                    for (size_t k = 0; k < iters; k++) {
+                        t.server(i).recv(buf.data(), size);
+                        t.server(i).send(buf.data(), size);
+                    }
+                });
+
+                threads.emplace_back([&, i]() {
+                    using clock = std::chrono::steady_clock;
+                    vector<u8> buf(size, 0x5a);
+                    samples[i].reserve(iters);
+                    for (size_t k = 0; k < iters; k++) {
+                        auto t0 = clock::now();
+                        t.client(i).send(buf.data(), size);
+                        t.client(i).recv(buf.data(), size);
+                        std::chrono::duration<double> rtt = clock::now() - t0;
+                        samples[i].push_back(rtt.count() * 1e6);
+                    }
+                });
+            }
+
+            for (std::thread& thread : threads)
+                thread.join();
+
+            vector<double> all;
+            for (const auto& s : samples)
+                all.insert(all.end(), s.begin(), s.end());
+            std::sort(all.begin(), all.end());
+
+            bench_report(name + "/latency",
+                         { mkstr("clients=%-3zu", clients),
+                           mkstr("size=%-7zu", size),
+                           mkstr("p50us=%-8.1f", percentile(all, 0.5)),
+                           mkstr("p99us=%-8.1f", percentile(all, 0.99)),
+                           mkstr("p999us=%.1f", percentile(all, 0.999)) });
+        }
+    });
+}
+
+MWR_BENCHMARK(socket_throughput) {
+    const size_t total = bench_option<size_t>("bytes", 256 * MiB);
+
+    for_each_config([&](transport& t, size_t clients, const string& name) {
+        for (size_t size : MESSAGE_SIZES) {
+            const size_t count = max<size_t>(total / size / clients, 1);
+            vector<std::thread> threads;
+
+            bench_result res = bench_measure([&]() {
+                // the acknowledgement makes sure everything has arrived
+                for (size_t i = 0; i < clients; i++) {
+                    threads.emplace_back([&, i]() {
+                        vector<u8> buf(size);
+                        for (size_t k = 0; k < count; k++)
+                            t.server(i).recv(buf.data(), size);
+                        u8 ack = 1;
+                        t.server(i).send(&ack, 1);
+                    });
+
+                    threads.emplace_back([&, i]() {
+                        vector<u8> buf(size, 0x5a);
+                        for (size_t k = 0; k < count; k++)
+                            t.client(i).send(buf.data(), size);
+                        u8 ack = 0;
+                        t.client(i).recv(&ack, 1);
+                    });
+                }
+
+                for (std::thread& thread : threads)
+                    thread.join();
+            });
+
+            double bytes = (double)count * size * clients;
+            double msgs = (double)count * clients;
+            bench_report(name + "/throughput",
+                         { mkstr("clients=%-3zu", clients),
+                           mkstr("size=%-7zu", size),
+                           mkstr("MiB/s=%-9.1f", bytes / MiB / res.seconds),
+                           mkstr("msgs/s=%.0f", msgs / res.seconds) });
+        }
+    });
+}
@@ -0,0 +1,172 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#include "bench.h"
+
+#include "mwr/utils/watchdog.h"
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+
+#ifdef MWR_WINDOWS
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace mwr;
+using namespace std::literals;
+
+using wd_clock = watchdog::clock_t;
+
+// cpu time consumed by all threads of this process so far
+static double process_cpu_seconds() {
+#ifdef MWR_WINDOWS
+    FILETIME creation, exit, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+    auto ticks = [](const FILETIME& ft) {
+        return (double)((u64)ft.dwHighDateTime << 32 | ft.dwLowDateTime);
+    };
+    return (ticks(kernel) + ticks(user)) * 100e-9;
+#else
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+#endif
+}
+
+// To measure a new watchdog backend, add a configuration for it here.
+struct backend {
+    const char* name;
+    size_t workers;
+    watchdog_wakeup wakeup;
+};
+
+static const vector<backend> BACKENDS = {
+    { "sleep", 0, WATCHDOG_SLEEP },
+    { "timerfd", 0, WATCHDOG_TIMERFD },
+    { "spin", 0, WATCHDOG_SPIN },
+    { "timerfd/workers", 4, WATCHDOG_TIMERFD },
+};
+
+static void for_each_backend(const std::function<void(const backend&)>& fn) {
+    string only = bench_option<string>("backend", "");
+    for (const backend& b : BACKENDS) {
+        if (only.empty() || only == b.name)
+            fn(b);
+    }
+}
+
+// deterministic spread of n deltas across [0, span)
+static wd_clock::duration spread(size_t i, size_t n, wd_clock::duration span) {
+    size_t k = (i * 2654435761u) % n;
+    return span * k / n;
+}
+
+static double percentile(const vector<double>& sorted, double p) {
+    size_t idx = (size_t)(p * (sorted.size() - 1));
+    return sorted[idx];
+}
+
+MWR_BENCHMARK(watchdog_latency) {
+    const auto span = std::chrono::milliseconds(bench_option<u64>("span", 100));
+    const auto lead = std::chrono::milliseconds(bench_option<u64>("lead", 50));
+
+    for_each_backend([&](const backend& b) {
+        for (size_t n : bench_sizes(10, 10000)) {
+            watchdog wd("bench_wd", b.workers, b.wakeup);
+            vector<double> late(n);
+            std::atomic<size_t> fired(0);
+
+            // all deadlines lie past the scheduling phase, so that tasks do
+            // not fire while the watchdog is still busy taking new ones
+            double cpu = process_cpu_seconds();
+            bench_result res = bench_measure([&]() {
+                auto start = wd_clock::now() + lead;
+                for (size_t i = 0; i < n; i++) {
+                    auto deadline = start + spread(i, n, span);
+                    wd.schedule(deadline - wd_clock::now(),
+                                [&, i, deadline]() {
+                                    std::chrono::duration<double> d =
+                                        wd_clock::now() - deadline;
+                                    late[i] = d.count() * 1e6;
+                                    fired++;
+                                });
+                }
+
+                // the waiting thread sleeps, so cpu time is spent by the
+                // watchdog, apart from scheduling the tasks
+                while (fired < n)
+                    std::this_thread::sleep_for(1ms);
+            });
+            cpu = process_cpu_seconds() - cpu;
+
+            std::sort(late.begin(), late.end());
+            string name = mkstr("watchdog/%s/latency", b.name);
+            bench_report(name,
+                         { mkstr("n=%-7zu", n),
+                           mkstr("p50us=%-8.1f", percentile(late, 0.5)),
+                           mkstr("p99us=%-8.1f", percentile(late, 0.99)),
+                           mkstr("maxus=%-9.1f", late.back()),
+                           mkstr("cpu%%=%.1f", cpu / res.seconds * 100.0) });
+
+            // number of tasks that fired late by less than each bound
+            const double bounds[] = { 10.0, 100.0, 1000.0, 10000.0 };
+            vector<string> histogram;
+            for (double bound : bounds) {
+                auto it = std::lower_bound(late.begin(), late.end(), bound);
+                histogram.push_back(mkstr("<%.0fus=%-6zu", bound,
+                                          (size_t)(it - late.begin())));
+            }
+
+            histogram.push_back(mkstr("all=%zu", n));
+            bench_report(mkstr("watchdog/%s/histogram", b.name), histogram);
+        }
+    });
+}
+
+MWR_BENCHMARK(watchdog_throughput) {
+    const size_t n = bench_option<size_t>("tasks", 1000000);
+
+    for_each_backend([&](const backend& b) {
+        watchdog wd("bench_wd", b.workers, b.wakeup);
+        std::atomic<size_t> fired(0);
+        vector<watchdog::handle> handles(n);
+
+        bench_result sched = bench_measure([&]() {
+            for (size_t i = 0; i < n; i++) {
+                handles[i] = wd.schedule(spread(i, n, 10ms),
+                                         [&fired]() { fired++; });
+            }
+        });
+
+        bench_result drain = bench_measure([&]() {
+            while (fired < n)
+                std::this_thread::yield();
+        });
+
+        // cancel tasks far in the future, so that none of them expires
+        bench_result cancel = bench_measure([&]() {
+            for (size_t i = 0; i < n; i++)
+                handles[i] = wd.schedule(24h, []() {});
+            for (size_t i = 0; i < n; i++)
+                wd.cancel(handles[i]);
+        });
+
+        double total = sched.seconds + drain.seconds;
+        bench_report(mkstr("watchdog/%s/throughput", b.name),
+                     { mkstr("n=%-9zu", n),
+                       mkstr("sched/s=%-12.0f", n / sched.seconds),
+                       mkstr("fired/s=%-12.0f", n / total),
+                       mkstr("sched+cancel/s=%.0f", n / cancel.seconds) });
+    });
+}
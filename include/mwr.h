@@ -34,16 +34,22 @@
 #include "mwr/logging/logger.h"
 
 #include "mwr/utils/aio.h"
+#include "mwr/utils/concurrent_interval.h"
+#include "mwr/utils/counters.h"
 #include "mwr/utils/elf.h"
 #include "mwr/utils/fdt.h"
 #include "mwr/utils/interval.h"
+#include "mwr/utils/io_engine.h"
 #include "mwr/utils/license.h"
 #include "mwr/utils/library.h"
 #include "mwr/utils/locale.h"
 #include "mwr/utils/memory.h"
 #include "mwr/utils/modules.h"
+#include "mwr/utils/msg_channel.h"
 #include "mwr/utils/options.h"
 #include "mwr/utils/per_thread.h"
+#include "mwr/utils/range_map.h"
+#include "mwr/utils/shm_socket.h"
 #include "mwr/utils/socket.h"
 #include "mwr/utils/srec.h"
 #include "mwr/utils/ihex.h"
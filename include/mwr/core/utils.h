@@ -85,6 +85,12 @@ int fd_open(const string& path, const string& mode, int perms = 0644);
 int fd_open(const string& path, int mode, int perms = 0644);
 void fd_close(int fd);
 
+// Lets code that watches descriptors, such as aio, learn about them being
+// closed via fd_close: the hook runs right before (closed = false) and
+// right after (closed = true) a descriptor gets closed.
+typedef void (*fd_close_hook)(int fd, bool closed);
+void fd_set_close_hook(fd_close_hook hook);
+
 size_t fd_peek(int fd, time_t timeout_ms = 0);
 size_t fd_read(int fd, void* buffer, size_t buflen);
 size_t fd_write(int fd, const void* buffer, size_t buflen);
@@ -15,6 +15,7 @@
 #include <atomic>
 #include <thread>
 #include <mutex>
+#include <shared_mutex>
 #include <condition_variable>
 
 namespace mwr {
@@ -24,9 +25,12 @@ using std::atomic;
 using std::thread;
 using std::mutex;
 using std::recursive_mutex;
+using std::shared_mutex;
 using std::condition_variable;
 using std::condition_variable_any;
 using std::lock_guard;
+using std::unique_lock;
+using std::shared_lock;
 
 unsigned long long current_thread_id();
 
@@ -11,17 +11,42 @@
 #ifndef MWR_UTILS_AIO_H
 #define MWR_UTILS_AIO_H
 
+#include <stddef.h>
 #include <functional>
 
 namespace mwr {
 
 using std::function;
 
+enum aio_events : unsigned int {
+    AIO_READ = 1u << 0,
+    AIO_WRITE = 1u << 1,
+    AIO_ERROR = 1u << 2, // errors and hangups, always reported
+};
+
+enum aio_flags : unsigned int {
+    AIO_PERSISTENT = 0,
+    AIO_ONESHOT = 1u << 0, // cancel automatically after the first event
+    AIO_WORKER = 1u << 1,  // run the handler on the aio worker pool
+};
+
 typedef function<void(int)> aio_handler;
+typedef function<void(int, unsigned int)> aio_event_handler;
 
+// Handlers run on the aio thread unless AIO_WORKER is requested. Worker
+// handlers of the same descriptor never run concurrently: its events are
+// not reported again until the previous handler invocation has returned.
+// Closing a descriptor via fd_close invokes its handler one last time with
+// AIO_ERROR and drops the registration.
 void aio_notify(int fd, aio_handler handler);
+void aio_notify(int fd, unsigned int events, aio_event_handler handler,
+                unsigned int flags = AIO_PERSISTENT);
 void aio_cancel(int fd);
 
+// defaults to one worker per hardware thread, started on first use
+size_t aio_workers();
+void aio_set_workers(size_t n);
+
 } // namespace mwr
 
 #endif
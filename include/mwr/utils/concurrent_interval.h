@@ -0,0 +1,181 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#ifndef MWR_UTILS_CONCURRENT_INTERVAL_H
+#define MWR_UTILS_CONCURRENT_INTERVAL_H
+
+#include "mwr/core/compiler.h"
+#include "mwr/core/types.h"
+#include "mwr/stl/threads.h"
+#include "mwr/utils/interval.h"
+
+namespace mwr {
+
+// Read-mostly interval tree: readers query an immutable snapshot without
+// taking any locks, writers serialize on a mutex, build a modified copy of
+// the current snapshot and publish it atomically. Old snapshots are freed
+// once all readers that might still see them have left (two-phase epoch
+// flip as used by userspace RCU). Writers wait for readers, so threads
+// must drop their snapshots before modifying the tree.
+template <typename T>
+class concurrent_interval_tree
+{
+public:
+    using tree_type = interval_tree<T>;
+
+    class snapshot
+    {
+        friend class concurrent_interval_tree;
+
+    private:
+        const concurrent_interval_tree* m_owner;
+        const tree_type* m_tree;
+        size_t m_epoch;
+
+        snapshot(const concurrent_interval_tree* owner):
+            m_owner(owner), m_tree(), m_epoch(owner->read_lock()) {
+            m_tree = m_owner->m_current.load(std::memory_order_seq_cst);
+        }
+
+    public:
+        snapshot(snapshot&& other) noexcept:
+            m_owner(other.m_owner),
+            m_tree(other.m_tree),
+            m_epoch(other.m_epoch) {
+            other.m_owner = nullptr;
+            other.m_tree = nullptr;
+        }
+
+        ~snapshot() {
+            if (m_owner)
+                m_owner->read_unlock(m_epoch);
+        }
+
+        snapshot(const snapshot&) = delete;
+        snapshot& operator=(const snapshot&) = delete;
+        snapshot& operator=(snapshot&&) = delete;
+
+        const tree_type& operator*() const { return *m_tree; }
+        const tree_type* operator->() const { return m_tree; }
+    };
+
+    concurrent_interval_tree():
+        m_mtx(), m_current(new tree_type()), m_epoch(0), m_readers() {}
+
+    ~concurrent_interval_tree() { delete m_current.load(); }
+
+    concurrent_interval_tree(const concurrent_interval_tree&) = delete;
+    concurrent_interval_tree& operator=(const concurrent_interval_tree&) =
+        delete;
+
+    snapshot read() const { return snapshot(this); }
+
+    size_t size() const { return read()->size(); }
+    bool empty() const { return read()->empty(); }
+
+    bool overlaps(u64 start, u64 end) const {
+        return read()->overlaps(start, end);
+    }
+
+    template <typename FN>
+    void for_each(u64 start, u64 end, FN fn) const {
+        snapshot snap = read();
+        snap->for_each(start, end,
+                       [&fn](u64 lo, u64 hi,
+                             const typename tree_type::const_iterator& it) {
+                           fn(lo, hi, *it);
+                       });
+    }
+
+    // runs fn on a private copy of the current tree and publishes the result
+    // afterwards; concurrent readers keep seeing the previous version until
+    // the new one has been published; waits for all readers of the previous
+    // version to leave, so a thread must not call this or any other
+    // modifying function while it holds a snapshot itself, or it deadlocks
+    template <typename FN>
+    void update(FN fn) {
+        lock_guard<mutex> guard(m_mtx);
+        tree_type* next = new tree_type();
+        copy(*m_current.load(), *next);
+        fn(*next);
+        publish(next);
+    }
+
+    void insert(u64 start, u64 end, const T& data) {
+        update([&](tree_type& tree) { tree.insert(start, end, data); });
+    }
+
+    size_t remove(u64 start, u64 end) {
+        size_t count = 0;
+        update([&](tree_type& tree) {
+            for (auto it = tree.begin(); it != tree.end();) {
+                auto cur = it++;
+                if (cur.start() == start && cur.end() == end) {
+                    tree.remove(cur);
+                    count++;
+                }
+            }
+        });
+        return count;
+    }
+
+    void clear() {
+        lock_guard<mutex> guard(m_mtx);
+        publish(new tree_type());
+    }
+
+private:
+    struct alignas(64) reader_count {
+        atomic<size_t> count;
+        reader_count(): count(0) {}
+    };
+
+    mutex m_mtx;
+    atomic<tree_type*> m_current;
+    alignas(64) atomic<size_t> m_epoch;
+    mutable reader_count m_readers[2];
+
+    size_t read_lock() const {
+        size_t idx = m_epoch.load(std::memory_order_seq_cst) & 1;
+        m_readers[idx].count.fetch_add(1, std::memory_order_seq_cst);
+        return idx;
+    }
+
+    void read_unlock(size_t idx) const {
+        m_readers[idx].count.fetch_sub(1, std::memory_order_release);
+    }
+
+    void synchronize() {
+        // flip twice so that readers which sampled the epoch right before
+        // the first flip are also waited for during the second phase
+        for (int phase = 0; phase < 2; phase++) {
+            size_t idx = m_epoch.fetch_add(1, std::memory_order_seq_cst) & 1;
+            // seq_cst, so that a reader this load misses has to see the
+            // tree published before it, acquire alone does not order that
+            while (m_readers[idx].count.load(std::memory_order_seq_cst) > 0)
+                std::this_thread::yield();
+        }
+    }
+
+    void publish(tree_type* next) {
+        tree_type* prev = m_current.exchange(next, std::memory_order_seq_cst);
+        synchronize();
+        delete prev;
+    }
+
+    static void copy(const tree_type& from, tree_type& to) {
+        for (auto it = from.begin(); it != from.end(); ++it)
+            to.insert(it.start(), it.end(), *it);
+    }
+};
+
+} // namespace mwr
+
+#endif
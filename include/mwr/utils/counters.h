@@ -0,0 +1,202 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#ifndef MWR_UTILS_COUNTERS_H
+#define MWR_UTILS_COUNTERS_H
+
+#include <atomic>
+
+#include "mwr/core/types.h"
+#include "mwr/core/report.h"
+#include "mwr/core/bitops.h"
+
+#include "mwr/stl/strings.h"
+#include "mwr/stl/streams.h"
+#include "mwr/stl/containers.h"
+#include "mwr/stl/threads.h"
+
+#include "mwr/utils/per_thread.h"
+
+namespace mwr {
+
+// Per-thread shard of N statistics values. Only the owning thread updates
+// value, so relaxed loads and stores suffice instead of atomic additions.
+// Resetting records the current values as offsets instead of clearing
+// them, so that updates racing with a reset are never lost or torn.
+template <size_t N>
+struct stat_shard {
+    std::atomic<u64> value[N];
+    std::atomic<u64> offset[N];
+
+    stat_shard() {
+        for (size_t i = 0; i < N; i++)
+            value[i] = offset[i] = 0;
+    }
+
+    void add(size_t i, u64 n) {
+        u64 v = value[i].load(std::memory_order_relaxed);
+        value[i].store(v + n, std::memory_order_relaxed);
+    }
+
+    u64 get(size_t i) const {
+        return value[i].load(std::memory_order_relaxed) -
+               offset[i].load(std::memory_order_relaxed);
+    }
+
+    void reset() {
+        for (size_t i = 0; i < N; i++)
+            offset[i] = value[i].load(std::memory_order_relaxed);
+    }
+
+    // adds the values of a shard whose thread has exited
+    void fold(const stat_shard& other) {
+        for (size_t i = 0; i < N; i++)
+            value[i].fetch_add(other.get(i), std::memory_order_relaxed);
+    }
+};
+
+// Common base of all sharded statistics. Named statistics are listed in the
+// stat_registry for as long as they exist, unnamed ones are not. The most
+// derived class registers at the end of its constructor and deregisters at
+// the start of its destructor, so that the registry never calls into a
+// statistic that is only partially constructed or already being destroyed.
+class sharded_stat
+{
+private:
+    string m_name;
+
+protected:
+    void register_stat();
+    void unregister_stat();
+
+public:
+    const string& name() const { return m_name; }
+
+    sharded_stat(const string& name);
+    virtual ~sharded_stat() = default;
+
+    sharded_stat(const sharded_stat&) = delete;
+    sharded_stat& operator=(const sharded_stat&) = delete;
+
+    virtual void reset() = 0;
+
+    // prints the current value, but not the name of the statistic
+    virtual void print(ostream& os) const = 0;
+};
+
+// Event counter that can be updated from many threads without contention.
+// Reading it sums up the shards of all threads and is comparatively slow.
+// Shards of exiting threads are folded into m_retired, so counts persist.
+class sharded_counter : public sharded_stat
+{
+private:
+    stat_shard<1> m_retired;
+    per_thread_local<stat_shard<1>> m_shards;
+
+public:
+    sharded_counter(const string& name = "");
+    virtual ~sharded_counter();
+
+    void add(u64 n = 1) { m_shards->add(0, n); }
+    sharded_counter& operator+=(u64 n);
+    sharded_counter& operator++();
+
+    u64 sum() const;
+
+    virtual void reset() override;
+    virtual void print(ostream& os) const override;
+};
+
+inline sharded_counter& sharded_counter::operator+=(u64 n) {
+    add(n);
+    return *this;
+}
+
+inline sharded_counter& sharded_counter::operator++() {
+    add(1);
+    return *this;
+}
+
+// Summed up contents of a histogram. Bucket 0 counts zeroes, bucket b > 0
+// counts values from 2^(b-1) up to 2^b - 1.
+struct histogram_snapshot {
+    static constexpr size_t NUM_BUCKETS = 65;
+
+    u64 count;
+    u64 sum;
+    u64 buckets[NUM_BUCKETS];
+
+    double mean() const { return count ? (double)sum / count : 0.0; }
+
+    // upper bound of the bucket that contains the given quantile
+    u64 percentile(double p) const;
+};
+
+class sharded_histogram : public sharded_stat
+{
+private:
+    // buckets, followed by the total count and sum of all values
+    static constexpr size_t COUNT = histogram_snapshot::NUM_BUCKETS;
+    static constexpr size_t SUM = COUNT + 1;
+
+    stat_shard<SUM + 1> m_retired;
+    per_thread_local<stat_shard<SUM + 1>> m_shards;
+
+public:
+    sharded_histogram(const string& name = "");
+    virtual ~sharded_histogram();
+
+    void record(u64 val);
+
+    u64 count() const { return snapshot().count; }
+    u64 sum() const { return snapshot().sum; }
+    histogram_snapshot snapshot() const;
+
+    virtual void reset() override;
+    virtual void print(ostream& os) const override;
+};
+
+inline void sharded_histogram::record(u64 val) {
+    stat_shard<SUM + 1>& shard = *m_shards;
+    shard.add(val ? fls(val) + 1 : 0, 1);
+    shard.add(COUNT, 1);
+    shard.add(SUM, val);
+}
+
+// Lists all named statistics, e.g. to dump them at the end of a simulation.
+class stat_registry
+{
+    friend class sharded_stat;
+
+private:
+    mutable mutex m_mtx;
+    map<string, sharded_stat*> m_stats;
+
+    stat_registry() = default;
+
+    void add(sharded_stat* stat);
+    void remove(sharded_stat* stat);
+
+    static stat_registry& instance();
+
+public:
+    ~stat_registry() = default;
+
+    static size_t count();
+    static vector<sharded_stat*> all();
+    static sharded_stat* find(const string& name);
+
+    static void reset_all();
+    static void print(ostream& os);
+};
+
+} // namespace mwr
+
+#endif
@@ -15,17 +15,86 @@
 #include "mwr/core/types.h"
 #include "mwr/core/report.h"
 
+#include <new>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
 namespace mwr {
 
-template <typename T>
+// Summary policies describe an associative operation that interval_tree
+// maintains for every subtree, e.g. to count or sum up all intervals that
+// overlap a query range without visiting them individually. A policy
+// provides a value_type, an identity element, a map function that turns a
+// single interval into a value and a combine function that merges two
+// values. combine is applied in interval start order. Policies may also
+// provide an inverse function if their values form a commutative group,
+// which allows aggregate queries in O(log n).
+struct ivt_count {
+    using value_type = size_t;
+
+    static value_type identity() { return 0; }
+
+    template <typename T>
+    static value_type map(u64, u64, const T&) {
+        return 1;
+    }
+
+    static value_type combine(value_type a, value_type b) { return a + b; }
+
+    // exact, since unsigned arithmetic wraps around
+    static value_type inverse(value_type a) { return 0 - a; }
+};
+
+template <typename AGG, typename = void>
+struct ivt_has_inverse : std::false_type {};
+
+template <typename AGG>
+struct ivt_has_inverse<AGG, std::void_t<decltype(AGG::inverse(
+                                std::declval<typename AGG::value_type>()))>>
+    : std::true_type {};
+
+// Besides the summaries of the tree ordered by interval start, every node
+// is also linked into a second tree ordered by interval end. Its subtree
+// counts (and summaries, given an inverse) tell how many intervals end
+// before an address, while the first tree tells how many start after one.
+template <typename AGG, typename NODE>
+struct ivt_summary {
+    using value_type = typename AGG::value_type;
+    static constexpr bool enabled = true;
+
+    u64 minhi;
+    u64 maxlo;
+    size_t count;
+    value_type agg;
+
+    NODE* hparent;
+    NODE* hleft;
+    NODE* hright;
+    u64 hheight;
+    size_t hcount;
+    value_type hagg;
+};
+
+template <typename NODE>
+struct ivt_summary<void, NODE> {
+    using value_type = void;
+    static constexpr bool enabled = false;
+};
+
+template <typename T, typename AGG = void>
 class interval_tree
 {
 private:
+    struct ivtnode;
+    using summary = ivt_summary<AGG, ivtnode>;
+    using value_type = typename summary::value_type;
+
     static constexpr bool overlaps(u64 s0, u64 e0, u64 s1, u64 e1) {
         return s0 <= e1 && s1 <= e0;
     }
 
-    struct ivtnode {
+    struct ivtnode : summary {
         u64 lo;
         u64 hi;
         u64 min;
@@ -148,11 +217,35 @@ private:
         return node->parent->right;
     }
 
+    static void ivt_summarize(ivtnode* node) {
+        if constexpr (summary::enabled) {
+            node->minhi = node->hi;
+            node->maxlo = node->lo;
+            node->count = 1;
+            node->agg = AGG::map(node->lo, node->hi, node->data);
+
+            if (ivtnode* left = node->left) {
+                node->minhi = min(node->minhi, left->minhi);
+                node->maxlo = max(node->maxlo, left->maxlo);
+                node->count += left->count;
+                node->agg = AGG::combine(left->agg, node->agg);
+            }
+
+            if (ivtnode* right = node->right) {
+                node->minhi = min(node->minhi, right->minhi);
+                node->maxlo = max(node->maxlo, right->maxlo);
+                node->count += right->count;
+                node->agg = AGG::combine(node->agg, right->agg);
+            }
+        }
+    }
+
     static void ivt_refresh(ivtnode* node) {
         if (node != nullptr) {
             node->height = ivt_height(node);
             node->min = ivt_min(node);
             node->max = ivt_max(node);
+            ivt_summarize(node);
         }
     }
 
@@ -311,6 +404,252 @@ private:
         ivt_for_each(node->right, start, end, fn);
     }
 
+    // reduces all intervals overlapping [start, end]: subtrees that cannot
+    // overlap are skipped via min/max, subtrees whose intervals all overlap
+    // (minhi >= start, maxlo <= end) contribute their summary directly.
+    // This takes O(log n) if the intervals do not overlap each other, but
+    // degrades to O(n) if subtrees mix intervals ending before start with
+    // intervals overlapping the query, e.g. for many nested intervals.
+    template <typename V, typename SUBTREE, typename ELEMENT, typename OP>
+    static V ivt_reduce(const ivtnode* node, u64 start, u64 end, const V& id,
+                        SUBTREE subtree, ELEMENT element, OP combine) {
+        if (node == nullptr)
+            return id;
+
+        if (!overlaps(node->min, node->max, start, end))
+            return id;
+
+        if (node->minhi >= start && node->maxlo <= end)
+            return subtree(node);
+
+        V result = ivt_reduce(node->left, start, end, id, subtree, element,
+                              combine);
+        if (overlaps(node->lo, node->hi, start, end))
+            result = combine(result, element(node));
+        return combine(result, ivt_reduce(node->right, start, end, id,
+                                          subtree, element, combine));
+    }
+
+    // the tree ordered by interval end, see ivt_summary
+    static u64 hvt_height(const ivtnode* node) {
+        return node ? node->hheight : 0;
+    }
+
+    static size_t hvt_count(const ivtnode* node) {
+        return node ? node->hcount : 0;
+    }
+
+    static i64 hvt_balance(const ivtnode* node) {
+        return (i64)hvt_height(node->hleft) - (i64)hvt_height(node->hright);
+    }
+
+    static void hvt_refresh(ivtnode* node) {
+        node->hheight = 1 + max(hvt_height(node->hleft),
+                                hvt_height(node->hright));
+        node->hcount = 1 + hvt_count(node->hleft) + hvt_count(node->hright);
+
+        if constexpr (ivt_has_inverse<AGG>::value) {
+            node->hagg = AGG::map(node->lo, node->hi, node->data);
+            if (node->hleft)
+                node->hagg = AGG::combine(node->hleft->hagg, node->hagg);
+            if (node->hright)
+                node->hagg = AGG::combine(node->hagg, node->hright->hagg);
+        }
+    }
+
+    static ivtnode*& hvt_ref(ivtnode*& root, ivtnode* node) {
+        if (node->hparent == nullptr)
+            return root;
+        if (node == node->hparent->hleft)
+            return node->hparent->hleft;
+        return node->hparent->hright;
+    }
+
+    static void hvt_transplant(ivtnode*& root, ivtnode* node,
+                               ivtnode* parent) {
+        root = node;
+
+        if (node != nullptr)
+            node->hparent = parent;
+    }
+
+    static void hvt_rotate_left(ivtnode*& root) {
+        ivtnode* oldroot = root;
+        ivtnode* newroot = oldroot->hright;
+        ivtnode* subtree = newroot->hleft;
+        hvt_transplant(root, newroot, root->hparent);
+        hvt_transplant(newroot->hleft, oldroot, newroot);
+        hvt_transplant(oldroot->hright, subtree, oldroot);
+        hvt_refresh(oldroot);
+        hvt_refresh(newroot);
+    }
+
+    static void hvt_rotate_right(ivtnode*& root) {
+        ivtnode* oldroot = root;
+        ivtnode* newroot = oldroot->hleft;
+        ivtnode* subtree = newroot->hright;
+        hvt_transplant(root, newroot, root->hparent);
+        hvt_transplant(newroot->hright, oldroot, newroot);
+        hvt_transplant(oldroot->hleft, subtree, oldroot);
+        hvt_refresh(oldroot);
+        hvt_refresh(newroot);
+    }
+
+    static void hvt_rebalance(ivtnode*& node) {
+        hvt_refresh(node);
+
+        i64 balance = hvt_balance(node);
+
+        if (balance > 1) {
+            if (hvt_balance(node->hleft) < 0)
+                hvt_rotate_left(node->hleft);
+            hvt_rotate_right(node);
+        }
+
+        if (balance < -1) {
+            if (hvt_balance(node->hright) > 0)
+                hvt_rotate_right(node->hright);
+            hvt_rotate_left(node);
+        }
+    }
+
+    static void hvt_insert(ivtnode*& root, ivtnode* node, ivtnode* parent) {
+        if (root == nullptr) {
+            node->hparent = parent;
+            node->hleft = node->hright = nullptr;
+            hvt_refresh(node);
+            root = node;
+            return;
+        }
+
+        if (node->hi <= root->hi)
+            hvt_insert(root->hleft, node, root);
+        else
+            hvt_insert(root->hright, node, root);
+
+        hvt_rebalance(root);
+    }
+
+    static void hvt_remove(ivtnode*& root, ivtnode* node) {
+        ivtnode* rebalance = node->hparent;
+
+        if (node->hleft == nullptr) {
+            hvt_transplant(hvt_ref(root, node), node->hright, node->hparent);
+        } else if (node->hright == nullptr) {
+            hvt_transplant(hvt_ref(root, node), node->hleft, node->hparent);
+        } else {
+            ivtnode* prev = node->hleft;
+            while (prev->hright)
+                prev = prev->hright;
+
+            rebalance = prev;
+            if (prev != node->hleft) {
+                rebalance = prev->hparent;
+                hvt_transplant(hvt_ref(root, prev), prev->hleft,
+                               prev->hparent);
+                prev->hleft = node->hleft;
+                prev->hleft->hparent = prev;
+            }
+
+            hvt_transplant(hvt_ref(root, node), prev, node->hparent);
+            prev->hright = node->hright;
+            prev->hright->hparent = prev;
+        }
+
+        while (rebalance) {
+            ivtnode* parent = rebalance->hparent;
+            hvt_rebalance(hvt_ref(root, rebalance));
+            rebalance = parent;
+        }
+    }
+
+    // An interval overlaps [start, end] unless it starts after end or ends
+    // before start, which cannot both be true. Both are counted by walking
+    // down a single path of either tree, so queries take O(log n).
+    static size_t ivt_count_after(const ivtnode* node, u64 end) {
+        size_t n = 0;
+        while (node) {
+            if (node->lo > end) {
+                n += 1 + (node->right ? node->right->count : 0);
+                node = node->left;
+            } else {
+                node = node->right;
+            }
+        }
+
+        return n;
+    }
+
+    static size_t hvt_count_before(const ivtnode* node, u64 start) {
+        size_t n = 0;
+        while (node) {
+            if (node->hi < start) {
+                n += 1 + hvt_count(node->hleft);
+                node = node->hright;
+            } else {
+                node = node->hleft;
+            }
+        }
+
+        return n;
+    }
+
+    static value_type ivt_aggregate_after(const ivtnode* node, u64 end) {
+        value_type val = AGG::identity();
+        while (node) {
+            if (node->lo > end) {
+                val = AGG::combine(val, AGG::map(node->lo, node->hi,
+                                                 node->data));
+                if (node->right)
+                    val = AGG::combine(val, node->right->agg);
+                node = node->left;
+            } else {
+                node = node->right;
+            }
+        }
+
+        return val;
+    }
+
+    static value_type hvt_aggregate_before(const ivtnode* node, u64 start) {
+        value_type val = AGG::identity();
+        while (node) {
+            if (node->hi < start) {
+                val = AGG::combine(val, AGG::map(node->lo, node->hi,
+                                                 node->data));
+                if (node->hleft)
+                    val = AGG::combine(val, node->hleft->hagg);
+                node = node->hright;
+            } else {
+                node = node->hleft;
+            }
+        }
+
+        return val;
+    }
+
+    static void hvt_validate(ivtnode* node, ivtnode* parent, size_t& count) {
+        if (node == nullptr)
+            return;
+
+        hvt_validate(node->hleft, node, count);
+        hvt_validate(node->hright, node, count);
+
+        if (node->hparent != parent)
+            MWR_ERROR("node end parent pointer corrupted");
+        if (node->hleft && node->hleft->hi > node->hi)
+            MWR_ERROR("node end order corrupted");
+        if (node->hright && node->hright->hi < node->hi)
+            MWR_ERROR("node end order corrupted");
+        if (node->hcount != 1 + hvt_count(node->hleft) +
+                                hvt_count(node->hright))
+            MWR_ERROR("node end count corrupted");
+        if (hvt_balance(node) < -1 || hvt_balance(node) > 1)
+            MWR_ERROR("node end tree is imbalanced");
+
+        count++;
+    }
+
     static void ivt_validate(ivtnode* node, ivtnode* parent, size_t& count) {
         if (node == nullptr)
             return;
@@ -324,6 +663,13 @@ private:
             MWR_ERROR("node minimum corrupted");
         if (node->max != ivt_max(node))
             MWR_ERROR("node maximum corrupted");
+
+        if constexpr (summary::enabled) {
+            size_t n = 1 + (node->left ? node->left->count : 0) +
+                       (node->right ? node->right->count : 0);
+            if (node->count != n)
+                MWR_ERROR("node count corrupted");
+        }
         i64 balance = ivt_balance(node);
         if (balance < -1 || balance > 1)
             MWR_ERROR("node is imbalanced");
@@ -332,6 +678,7 @@ private:
     }
 
     ivtnode* m_root;
+    ivtnode* m_hroot;
     size_t m_size;
 
 public:
@@ -409,21 +756,24 @@ public:
     const_iterator begin() const { return const_iterator(ivt_first(m_root)); }
     const_iterator end() const { return const_iterator(nullptr); }
 
-    interval_tree(): m_root(), m_size() {}
+    interval_tree(): m_root(), m_hroot(), m_size() {}
     ~interval_tree() { clear(); }
 
-    interval_tree(interval_tree<T>&& other) noexcept:
-        m_root(other.m_root), m_size(other.m_size) {
+    interval_tree(interval_tree&& other) noexcept:
+        m_root(other.m_root), m_hroot(other.m_hroot), m_size(other.m_size) {
         other.m_root = nullptr;
+        other.m_hroot = nullptr;
         other.m_size = 0;
     }
 
-    interval_tree& operator=(interval_tree<T>&& other) noexcept {
+    interval_tree& operator=(interval_tree&& other) noexcept {
         if (this != &other) {
             clear();
             m_root = other.m_root;
+            m_hroot = other.m_hroot;
             m_size = other.m_size;
             other.m_root = nullptr;
+            other.m_hroot = nullptr;
             other.m_size = 0;
         }
         return *this;
@@ -437,13 +787,17 @@ public:
 
     void clear() {
         ivt_clear(m_root);
+        m_hroot = nullptr;
         m_size = 0;
     }
 
     iterator insert(u64 start, u64 end, const T& data) {
         MWR_ERROR_ON(end < start, "invalid interval %llu..%llu", start, end);
         ivtnode* node = new ivtnode(start, end, data);
+        ivt_refresh(node);
         ivt_insert(m_root, node, nullptr);
+        if constexpr (summary::enabled)
+            hvt_insert(m_hroot, node, nullptr);
         m_size++;
         return node;
     }
@@ -451,7 +805,10 @@ public:
     iterator insert(u64 start, u64 end, T&& data) {
         MWR_ERROR_ON(end < start, "invalid interval %llu..%llu", start, end);
         ivtnode* node = new ivtnode(start, end, std::move(data));
+        ivt_refresh(node);
         ivt_insert(m_root, node, nullptr);
+        if constexpr (summary::enabled)
+            hvt_insert(m_hroot, node, nullptr);
         m_size++;
         return node;
     }
@@ -462,6 +819,8 @@ public:
             return false;
 
         ivt_remove(m_root, node);
+        if constexpr (summary::enabled)
+            hvt_remove(m_hroot, node);
         delete it.m_node;
         m_size--;
         return true;
@@ -473,6 +832,8 @@ public:
             return false;
 
         ivt_remove(m_root, node);
+        if constexpr (summary::enabled)
+            hvt_remove(m_hroot, node);
         delete it.m_node;
         m_size--;
         return true;
@@ -513,10 +874,579 @@ public:
         return result;
     }
 
+    // counts all intervals overlapping [start, end] in O(log n)
+    size_t count(u64 start, u64 end) const {
+        static_assert(summary::enabled, "count requires a summary policy");
+        MWR_ERROR_ON(end < start, "invalid interval %llu..%llu", start, end);
+        return m_size - ivt_count_after(m_root, end) -
+               hvt_count_before(m_hroot, start);
+    }
+
+    // Aggregates all intervals overlapping [start, end]. Takes O(log n) if
+    // the policy provides an inverse. Otherwise, the query is output
+    // sensitive: it is O(log n) for disjoint intervals, but may visit every
+    // overlapping interval if they nest, e.g. many covering one address.
+    value_type aggregate(u64 start, u64 end) const {
+        static_assert(summary::enabled, "aggregate requires a summary policy");
+        MWR_ERROR_ON(end < start, "invalid interval %llu..%llu", start, end);
+        if constexpr (ivt_has_inverse<AGG>::value) {
+            value_type all = m_root ? m_root->agg : AGG::identity();
+            value_type out = AGG::combine(ivt_aggregate_after(m_root, end),
+                                          hvt_aggregate_before(m_hroot,
+                                                               start));
+            return AGG::combine(all, AGG::inverse(out));
+        }
+
+        return ivt_reduce<value_type>(
+            m_root, start, end, AGG::identity(),
+            [](const ivtnode* node) { return node->agg; },
+            [](const ivtnode* node) {
+                return AGG::map(node->lo, node->hi, node->data);
+            },
+            [](const value_type& a, const value_type& b) {
+                return AGG::combine(a, b);
+            });
+    }
+
+    // must be called after modifying data through an iterator if the
+    // summary policy depends on it
+    void refresh(const iterator& it) {
+        for (ivtnode* node = it.m_node; node != nullptr; node = node->parent)
+            ivt_refresh(node);
+
+        if constexpr (summary::enabled) {
+            for (ivtnode* node = it.m_node; node; node = node->hparent)
+                hvt_refresh(node);
+        }
+    }
+
     void validate() const {
         size_t count = 0;
         ivt_validate(m_root, nullptr, count);
         MWR_ERROR_ON(count != m_size, "tree size corrupted");
+
+        if constexpr (summary::enabled) {
+            count = 0;
+            hvt_validate(m_hroot, nullptr, count);
+            MWR_ERROR_ON(count != m_size, "tree size corrupted");
+        }
+    }
+};
+
+// Same interface as interval_tree, but trades some lookup and iteration speed
+// for a much smaller memory footprint: nodes live in pooled chunks and link
+// to each other using 32-bit indices, parent pointers and subtree minima are
+// not stored at all and the 8-bit node heights are kept separately from the
+// lookup data. Nodes are ordered by (start, index), so every node can be found
+// from the root in O(log n) and iterator increments do exactly that.
+template <typename T>
+class compact_interval_tree
+{
+private:
+    static constexpr bool overlaps(u64 s0, u64 e0, u64 s1, u64 e1) {
+        return s0 <= e1 && s1 <= e0;
+    }
+
+    static constexpr u32 NIL = U32_MAX;
+    static constexpr u32 CHUNK_BITS = 8;
+    static constexpr u32 CHUNK_SIZE = 1u << CHUNK_BITS;
+    static constexpr u32 CHUNK_MASK = CHUNK_SIZE - 1;
+
+    struct ivtnode {
+        u64 lo;
+        u64 hi;
+        u64 max;
+        u32 left;
+        u32 right;
+
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T& data() { return *std::launder(reinterpret_cast<T*>(storage)); }
+        const T& data() const {
+            return *std::launder(reinterpret_cast<const T*>(storage));
+        }
+    };
+
+    struct ivtchunk {
+        ivtnode nodes[CHUNK_SIZE];
+        u8 heights[CHUNK_SIZE];
+    };
+
+    vector<std::unique_ptr<ivtchunk>> m_chunks;
+    u32 m_root;
+    u32 m_free;
+    u32 m_used;
+    size_t m_size;
+
+    ivtnode& node(u32 idx) {
+        return m_chunks[idx >> CHUNK_BITS]->nodes[idx & CHUNK_MASK];
+    }
+
+    const ivtnode& node(u32 idx) const {
+        return m_chunks[idx >> CHUNK_BITS]->nodes[idx & CHUNK_MASK];
+    }
+
+    u8& height(u32 idx) {
+        return m_chunks[idx >> CHUNK_BITS]->heights[idx & CHUNK_MASK];
+    }
+
+    u8 ivt_height(u32 idx) const {
+        if (idx == NIL)
+            return 0;
+        return m_chunks[idx >> CHUNK_BITS]->heights[idx & CHUNK_MASK];
+    }
+
+    int ivt_balance(u32 idx) const {
+        if (idx == NIL)
+            return 0;
+        const ivtnode& n = node(idx);
+        return (int)ivt_height(n.left) - (int)ivt_height(n.right);
+    }
+
+    bool ivt_less(u32 a, u32 b) const {
+        const ivtnode& na = node(a);
+        const ivtnode& nb = node(b);
+        return na.lo < nb.lo || (na.lo == nb.lo && a < b);
+    }
+
+    u32 ivt_alloc() {
+        if (m_free != NIL) {
+            u32 idx = m_free;
+            m_free = node(idx).left;
+            return idx;
+        }
+
+        MWR_ERROR_ON(m_used == NIL, "interval tree capacity exceeded");
+        if ((m_used & CHUNK_MASK) == 0)
+            m_chunks.push_back(std::make_unique<ivtchunk>());
+        return m_used++;
+    }
+
+    void ivt_free(u32 idx) {
+        ivtnode& n = node(idx);
+        n.data().~T();
+        n.left = m_free;
+        m_free = idx;
+    }
+
+    void ivt_refresh(u32 idx) {
+        ivtnode& n = node(idx);
+        n.max = n.hi;
+        if (n.left != NIL && node(n.left).max > n.max)
+            n.max = node(n.left).max;
+        if (n.right != NIL && node(n.right).max > n.max)
+            n.max = node(n.right).max;
+        height(idx) = 1 + max(ivt_height(n.left), ivt_height(n.right));
+    }
+
+    void ivt_rotate_left(u32& root) {
+        u32 oldroot = root;
+        u32 newroot = node(oldroot).right;
+        node(oldroot).right = node(newroot).left;
+        node(newroot).left = oldroot;
+        ivt_refresh(oldroot);
+        ivt_refresh(newroot);
+        root = newroot;
+    }
+
+    void ivt_rotate_right(u32& root) {
+        u32 oldroot = root;
+        u32 newroot = node(oldroot).left;
+        node(oldroot).left = node(newroot).right;
+        node(newroot).right = oldroot;
+        ivt_refresh(oldroot);
+        ivt_refresh(newroot);
+        root = newroot;
+    }
+
+    void ivt_rebalance(u32& root) {
+        if (root == NIL)
+            return;
+
+        ivt_refresh(root);
+
+        int balance = ivt_balance(root);
+
+        if (balance > 1) {
+            if (ivt_balance(node(root).left) < 0)
+                ivt_rotate_left(node(root).left);
+            ivt_rotate_right(root);
+        }
+
+        if (balance < -1) {
+            if (ivt_balance(node(root).right) > 0)
+                ivt_rotate_right(node(root).right);
+            ivt_rotate_left(root);
+        }
+    }
+
+    void ivt_insert(u32& root, u32 idx) {
+        if (root == NIL) {
+            root = idx;
+            return;
+        }
+
+        if (ivt_less(idx, root))
+            ivt_insert(node(root).left, idx);
+        else
+            ivt_insert(node(root).right, idx);
+
+        ivt_rebalance(root);
+    }
+
+    u32 ivt_remove_first(u32& root) {
+        if (node(root).left == NIL) {
+            u32 first = root;
+            root = node(root).right;
+            return first;
+        }
+
+        u32 first = ivt_remove_first(node(root).left);
+        ivt_rebalance(root);
+        return first;
+    }
+
+    bool ivt_remove(u32& root, u32 idx) {
+        if (root == NIL)
+            return false;
+
+        if (root == idx) {
+            ivtnode& n = node(root);
+            if (n.left == NIL) {
+                root = n.right;
+            } else if (n.right == NIL) {
+                root = n.left;
+            } else {
+                u32 next = ivt_remove_first(n.right);
+                node(next).left = n.left;
+                node(next).right = n.right;
+                root = next;
+            }
+        } else if (ivt_less(idx, root)) {
+            if (!ivt_remove(node(root).left, idx))
+                return false;
+        } else {
+            if (!ivt_remove(node(root).right, idx))
+                return false;
+        }
+
+        ivt_rebalance(root);
+        return true;
+    }
+
+    u32 ivt_first() const {
+        u32 idx = m_root;
+        while (idx != NIL && node(idx).left != NIL)
+            idx = node(idx).left;
+        return idx;
+    }
+
+    u32 ivt_next(u32 idx) const {
+        if (idx == NIL)
+            return NIL;
+
+        u32 next = NIL;
+        for (u32 cur = m_root; cur != NIL;) {
+            if (ivt_less(idx, cur)) {
+                next = cur;
+                cur = node(cur).left;
+            } else {
+                cur = node(cur).right;
+            }
+        }
+
+        return next;
+    }
+
+    void ivt_clear(u32 idx) {
+        if (idx == NIL)
+            return;
+
+        ivt_clear(node(idx).left);
+        ivt_clear(node(idx).right);
+        node(idx).data().~T();
+    }
+
+    bool ivt_overlaps(u32 idx, u64 start, u64 end) const {
+        if (idx == NIL)
+            return false;
+
+        const ivtnode& n = node(idx);
+        if (n.max < start)
+            return false;
+
+        if (overlaps(n.lo, n.hi, start, end))
+            return true;
+
+        if (ivt_overlaps(n.left, start, end))
+            return true;
+
+        // everything to the right starts at or after n.lo
+        if (n.lo > end)
+            return false;
+
+        return ivt_overlaps(n.right, start, end);
+    }
+
+    template <typename FN>
+    void ivt_for_each(u32 idx, u64 start, u64 end, FN& fn) const {
+        if (idx == NIL)
+            return;
+
+        const ivtnode& n = node(idx);
+        if (n.max < start)
+            return;
+
+        ivt_for_each(n.left, start, end, fn);
+
+        if (n.lo > end)
+            return;
+
+        if (overlaps(n.lo, n.hi, start, end))
+            fn(n.lo, n.hi, idx);
+
+        ivt_for_each(n.right, start, end, fn);
+    }
+
+    void ivt_validate(u32 idx, size_t& count) const {
+        if (idx == NIL)
+            return;
+
+        const ivtnode& n = node(idx);
+        ivt_validate(n.left, count);
+        ivt_validate(n.right, count);
+
+        if (n.left != NIL && !ivt_less(n.left, idx))
+            MWR_ERROR("node order corrupted");
+        if (n.right != NIL && !ivt_less(idx, n.right))
+            MWR_ERROR("node order corrupted");
+
+        u64 max = n.hi;
+        if (n.left != NIL && node(n.left).max > max)
+            max = node(n.left).max;
+        if (n.right != NIL && node(n.right).max > max)
+            max = node(n.right).max;
+        if (n.max != max)
+            MWR_ERROR("node maximum corrupted");
+
+        int balance = ivt_balance(idx);
+        if (balance < -1 || balance > 1)
+            MWR_ERROR("node is imbalanced");
+
+        count++;
+    }
+
+    template <typename U>
+    u32 ivt_emplace(u64 start, u64 end, U&& data) {
+        MWR_ERROR_ON(end < start, "invalid interval %llu..%llu", start, end);
+        u32 idx = ivt_alloc();
+        ivtnode& n = node(idx);
+        new (n.storage) T(std::forward<U>(data));
+        n.lo = start;
+        n.hi = end;
+        n.max = end;
+        n.left = NIL;
+        n.right = NIL;
+        height(idx) = 1;
+        ivt_insert(m_root, idx);
+        m_size++;
+        return idx;
+    }
+
+    bool ivt_erase(u32 idx) {
+        if (idx == NIL || !ivt_remove(m_root, idx))
+            return false;
+
+        ivt_free(idx);
+        m_size--;
+        return true;
+    }
+
+public:
+    class const_iterator
+    {
+        friend class compact_interval_tree;
+
+    private:
+        const compact_interval_tree* m_tree;
+        u32 m_idx;
+
+    public:
+        const_iterator(const compact_interval_tree* tree, u32 idx):
+            m_tree(tree), m_idx(idx) {}
+
+        const_iterator& operator++() {
+            m_idx = m_tree->ivt_next(m_idx);
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            const_iterator temp = *this;
+            ++(*this);
+            return temp;
+        }
+
+        bool operator==(const const_iterator& other) const {
+            return m_idx == other.m_idx;
+        }
+
+        bool operator!=(const const_iterator& other) const {
+            return m_idx != other.m_idx;
+        }
+
+        const T& operator*() const { return data(); }
+        const T& data() const { return m_tree->node(m_idx).data(); }
+        u64 start() const { return m_tree->node(m_idx).lo; }
+        u64 end() const { return m_tree->node(m_idx).hi; }
+    };
+
+    class iterator
+    {
+        friend class compact_interval_tree;
+
+    private:
+        compact_interval_tree* m_tree;
+        u32 m_idx;
+
+    public:
+        iterator(compact_interval_tree* tree, u32 idx):
+            m_tree(tree), m_idx(idx) {}
+
+        iterator& operator++() {
+            m_idx = m_tree->ivt_next(m_idx);
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator temp = *this;
+            ++(*this);
+            return temp;
+        }
+
+        bool operator==(const iterator& other) const {
+            return m_idx == other.m_idx;
+        }
+
+        bool operator!=(const iterator& other) const {
+            return m_idx != other.m_idx;
+        }
+
+        T& operator*() const { return data(); }
+        T& data() const { return m_tree->node(m_idx).data(); }
+        u64 start() const { return m_tree->node(m_idx).lo; }
+        u64 end() const { return m_tree->node(m_idx).hi; }
+    };
+
+    iterator begin() { return iterator(this, ivt_first()); }
+    iterator end() { return iterator(this, NIL); }
+    const_iterator begin() const { return const_iterator(this, ivt_first()); }
+    const_iterator end() const { return const_iterator(this, NIL); }
+
+    compact_interval_tree():
+        m_chunks(), m_root(NIL), m_free(NIL), m_used(0), m_size(0) {}
+    ~compact_interval_tree() { clear(); }
+
+    compact_interval_tree(compact_interval_tree<T>&& other) noexcept:
+        m_chunks(std::move(other.m_chunks)),
+        m_root(other.m_root),
+        m_free(other.m_free),
+        m_used(other.m_used),
+        m_size(other.m_size) {
+        other.m_chunks.clear();
+        other.m_root = other.m_free = NIL;
+        other.m_used = 0;
+        other.m_size = 0;
+    }
+
+    compact_interval_tree& operator=(
+        compact_interval_tree<T>&& other) noexcept {
+        if (this != &other) {
+            clear();
+            m_chunks = std::move(other.m_chunks);
+            m_root = other.m_root;
+            m_free = other.m_free;
+            m_used = other.m_used;
+            m_size = other.m_size;
+            other.m_chunks.clear();
+            other.m_root = other.m_free = NIL;
+            other.m_used = 0;
+            other.m_size = 0;
+        }
+        return *this;
+    }
+
+    compact_interval_tree(const compact_interval_tree&) = delete;
+    compact_interval_tree& operator=(const compact_interval_tree&) = delete;
+
+    constexpr size_t size() const { return m_size; }
+    constexpr bool empty() const { return m_size == 0; }
+
+    void clear() {
+        ivt_clear(m_root);
+        m_chunks.clear();
+        m_root = m_free = NIL;
+        m_used = 0;
+        m_size = 0;
+    }
+
+    iterator insert(u64 start, u64 end, const T& data) {
+        return iterator(this, ivt_emplace(start, end, data));
+    }
+
+    iterator insert(u64 start, u64 end, T&& data) {
+        return iterator(this, ivt_emplace(start, end, std::move(data)));
+    }
+
+    bool remove(iterator it) { return ivt_erase(it.m_idx); }
+    bool remove(const_iterator it) { return ivt_erase(it.m_idx); }
+
+    bool overlaps(u64 start, u64 end) const {
+        MWR_ERROR_ON(end < start, "invalid interval %llu..%llu", start, end);
+        return ivt_overlaps(m_root, start, end);
+    }
+
+    void for_each(u64 start, u64 end,
+                  function<void(u64, u64, const const_iterator&)> fn) const {
+        MWR_ERROR_ON(end < start, "invalid interval %llu..%llu", start, end);
+        auto visit = [this, &fn](u64 lo, u64 hi, u32 idx) {
+            fn(lo, hi, const_iterator(this, idx));
+        };
+        ivt_for_each(m_root, start, end, visit);
+    }
+
+    void for_each(u64 start, u64 end,
+                  function<void(u64, u64, const iterator&)> fn) {
+        MWR_ERROR_ON(end < start, "invalid interval %llu..%llu", start, end);
+        auto visit = [this, &fn](u64 lo, u64 hi, u32 idx) {
+            fn(lo, hi, iterator(this, idx));
+        };
+        ivt_for_each(m_root, start, end, visit);
+    }
+
+    vector<const_iterator> find_overlaps(u64 start, u64 end) const {
+        MWR_ERROR_ON(end < start, "invalid interval %llu..%llu", start, end);
+        vector<const_iterator> result;
+        auto visit = [this, &result](u64, u64, u32 idx) {
+            result.emplace_back(this, idx);
+        };
+        ivt_for_each(m_root, start, end, visit);
+        return result;
+    }
+
+    vector<iterator> find_overlaps(u64 start, u64 end) {
+        MWR_ERROR_ON(end < start, "invalid interval %llu..%llu", start, end);
+        vector<iterator> result;
+        auto visit = [this, &result](u64, u64, u32 idx) {
+            result.emplace_back(this, idx);
+        };
+        ivt_for_each(m_root, start, end, visit);
+        return result;
+    }
+
+    void validate() const {
+        size_t count = 0;
+        ivt_validate(m_root, count);
+        MWR_ERROR_ON(count != m_size, "tree size corrupted");
     }
 };
 
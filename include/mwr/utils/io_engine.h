@@ -0,0 +1,151 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#ifndef MWR_UTILS_IO_ENGINE_H
+#define MWR_UTILS_IO_ENGINE_H
+
+#include <memory>
+#include <functional>
+
+#include "mwr/core/types.h"
+#include "mwr/core/report.h"
+#include "mwr/core/compiler.h"
+
+#include "mwr/stl/containers.h"
+
+#include "mwr/utils/socket.h"
+
+namespace mwr {
+
+using std::function;
+
+// Asynchronous I/O engine for reads, writes, accepts and timeouts. On Linux
+// operations are handed to an io_uring instance if the kernel supports it.
+// Otherwise, or if MWR_NO_IO_URING is set, operations are carried out
+// synchronously during submit() and their completions are delivered by
+// complete() just the same. An engine must only be used by one thread.
+// Destroying an engine cancels all pending operations and waits until the
+// kernel has let go of their buffers; their callbacks do not run anymore.
+class io_engine
+{
+public:
+    // number of bytes transferred, the accepted descriptor or zero for an
+    // expired timeout; failed operations report a negative errno value
+    typedef function<void(long long result)> callback;
+
+    // read from or write to the current file position
+    static constexpr u64 CURRENT_POS = ~0ull;
+
+    bool is_uring() const { return m_ring != nullptr; }
+    size_t depth() const { return m_depth; }
+
+    // operations that have been queued but whose callback did not run yet
+    size_t pending() const { return m_pending; }
+
+    size_t num_buffers() const { return m_buffers.size(); }
+    size_t num_files() const { return m_files.size(); }
+    bool is_registered(int fd) const { return stl_contains(m_files, fd); }
+
+    io_engine(size_t depth = 256);
+    io_engine(size_t depth, bool use_uring);
+    virtual ~io_engine();
+
+    io_engine(const io_engine&) = delete;
+    io_engine& operator=(const io_engine&) = delete;
+
+    // buffers must stay valid until the callback of the operation has run
+    void read(int fd, void* buf, size_t len, u64 offset, callback cb);
+    void write(int fd, const void* buf, size_t len, u64 offset, callback cb);
+    void accept(int fd, callback cb);
+    void timeout(u64 ns, callback cb);
+
+    // Registered buffers are pinned once instead of for every operation. The
+    // memory passed to read_fixed and write_fixed must lie within buffer idx.
+    // Buffers cannot be unregistered while fixed operations are pending.
+    void register_buffers(const vector<iovec>& buffers);
+    void unregister_buffers();
+
+    void read_fixed(int fd, size_t idx, void* buf, size_t len, u64 offset,
+                    callback cb);
+    void write_fixed(int fd, size_t idx, const void* buf, size_t len,
+                     u64 offset, callback cb);
+
+    // Operations on registered files skip the per-operation file table
+    // lookup; they are used automatically whenever a registered fd is passed.
+    void register_files(const vector<int>& fds);
+    void unregister_files();
+
+    // hands all queued operations to the kernel, returns their number
+    size_t submit();
+
+    // submits, then runs the callbacks of finished operations; waits until
+    // at least min operations have completed, returns the number of them
+    size_t complete(size_t min = 0);
+
+    // runs until all pending operations, including those queued by the
+    // callbacks themselves, have completed
+    void drain();
+
+private:
+    struct ring;
+
+    enum op_type {
+        OP_READ,
+        OP_WRITE,
+        OP_READ_FIXED,
+        OP_WRITE_FIXED,
+        OP_ACCEPT,
+        OP_TIMEOUT,
+    };
+
+    struct operation {
+        op_type type;
+        int fd;
+        void* buf;
+        size_t len;
+        u64 offset;
+        size_t bufidx;
+        u64 deadline;
+        callback cb;
+    };
+
+    size_t m_depth;
+    size_t m_pending;
+    std::unique_ptr<ring> m_ring;
+
+    vector<iovec> m_buffers;
+    unordered_map<int, unsigned int> m_files; // fd -> fixed file index
+
+    u64 m_next_id;
+    unordered_map<u64, operation> m_inflight;
+
+    vector<operation> m_queue;
+    vector<std::pair<operation, long long>> m_done;
+
+    void queue(operation&& op);
+
+    void uring_setup();
+    void uring_queue(u64 id, const operation& op);
+    size_t uring_submit();
+    size_t uring_reap(size_t min);
+    void uring_cancel_all();
+
+    long long execute(operation& op) const;
+    size_t fallback_reap(size_t min);
+};
+
+inline void io_engine::drain() {
+    while (m_pending > 0)
+        complete(m_pending);
+}
+
+} // namespace mwr
+
+#endif
@@ -0,0 +1,158 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#ifndef MWR_UTILS_MSG_CHANNEL_H
+#define MWR_UTILS_MSG_CHANNEL_H
+
+#include <memory>
+
+#include "mwr/core/types.h"
+#include "mwr/core/report.h"
+#include "mwr/core/compiler.h"
+
+#include "mwr/stl/containers.h"
+#include "mwr/stl/strings.h"
+#include "mwr/stl/threads.h"
+
+#include "mwr/utils/socket.h"
+
+namespace mwr {
+
+// A received message. Copies share the same underlying buffer, which is
+// returned to the pool it came from once the last reference is dropped.
+class message
+{
+public:
+    const u8* data() const { return m_buf ? m_buf->data() : nullptr; }
+    u8* data() { return m_buf ? m_buf->data() : nullptr; }
+
+    size_t size() const { return m_buf ? m_buf->size() : 0; }
+    bool empty() const { return size() == 0; }
+
+    long use_count() const { return m_buf.use_count(); }
+
+    string str() const { return string((const char*)data(), size()); }
+
+    message() = default;
+
+private:
+    friend class msg_pool;
+    std::shared_ptr<vector<u8>> m_buf;
+
+    message(std::shared_ptr<vector<u8>> buf): m_buf(std::move(buf)) {}
+};
+
+// Recycles message buffers to avoid one heap allocation per message. The
+// pool may be destroyed while messages allocated from it are still alive.
+class msg_pool
+{
+public:
+    size_t max_free() const;
+    size_t num_free() const;
+
+    msg_pool(size_t maxfree = 64);
+    ~msg_pool() = default;
+
+    msg_pool(const msg_pool&) = delete;
+    msg_pool& operator=(const msg_pool&) = delete;
+
+    message alloc(size_t size);
+
+private:
+    struct state {
+        mutable mutex mtx;
+        vector<std::unique_ptr<vector<u8>>> free;
+        size_t maxfree;
+    };
+
+    std::shared_ptr<state> m_state;
+};
+
+enum msg_framing {
+    MSG_FRAMING_U32 = 0,    // 4 byte little endian length prefix
+    MSG_FRAMING_VARINT = 1, // LEB128 encoded length prefix
+};
+
+// Message oriented channel on top of a socket or a server_socket client.
+// Small messages are batched into a single write until the batch is full,
+// flush() is called or the channel waits to receive a message itself. The
+// destructor flushes as well, but silently drops the batch on errors.
+class msg_channel
+{
+public:
+    msg_framing framing() const { return m_framing; }
+
+    size_t max_message() const;
+    void set_max_message(size_t maxmsg);
+
+    size_t batch_size() const;
+    void set_batch_size(size_t size);
+
+    msg_pool& pool() { return m_pool; }
+
+    msg_channel(socket& sock, msg_framing framing = MSG_FRAMING_U32,
+                size_t maxmsg = 16 * MiB);
+    msg_channel(server_socket& server, int client,
+                msg_framing framing = MSG_FRAMING_U32,
+                size_t maxmsg = 16 * MiB);
+    virtual ~msg_channel();
+
+    msg_channel(const msg_channel&) = delete;
+    msg_channel& operator=(const msg_channel&) = delete;
+
+    void send(const void* data, size_t size);
+    void send(const string& str) { send(str.c_str(), str.length()); }
+    void send(const message& msg) { send(msg.data(), msg.size()); }
+
+    void flush();
+
+    bool poll(size_t timeoutms = 0);
+    message recv();
+
+private:
+    socket* m_socket;
+    server_socket* m_server;
+    int m_client;
+
+    msg_framing m_framing;
+    atomic<size_t> m_maxmsg;
+
+    msg_pool m_pool;
+
+    mutable mutex m_txmtx;
+    mutable mutex m_rxmtx;
+    vector<u8> m_txbuf;
+    size_t m_batch;
+
+    size_t encode_length(u8* buf, size_t len) const;
+    size_t decode_length();
+
+    void flush_locked();
+    void write(const iovec* iov, size_t iovcnt);
+    void read(void* data, size_t size);
+    void close();
+};
+
+inline size_t msg_channel::max_message() const {
+    return m_maxmsg;
+}
+
+inline void msg_channel::set_max_message(size_t maxmsg) {
+    m_maxmsg = maxmsg;
+}
+
+inline size_t msg_channel::batch_size() const {
+    lock_guard<mutex> guard(m_txmtx);
+    return m_batch;
+}
+
+} // namespace mwr
+
+#endif
@@ -11,35 +11,83 @@
 #ifndef MWR_UTILS_PER_THREAD_H
 #define MWR_UTILS_PER_THREAD_H
 
+#include <atomic>
+#include <functional>
 #include <mutex>
+#include <new>
+#include <stdexcept>
 #include <thread>
+#include <type_traits>
 #include <unordered_map>
+#include <vector>
+
+#include "mwr/core/types.h"
+#include "mwr/core/bitops.h"
 
 namespace mwr {
 
+// Runs fn on the calling thread when it exits, after all hooks registered
+// later. Returns an id to cancel the hook with, or zero if the thread is
+// already past running its exit hooks.
+u64 per_thread_at_exit(std::function<void()> fn);
+
+// Removes an exit hook. If the hook is currently running on another thread,
+// waits for it to finish, so that it is safe to destroy what it refers to.
+void per_thread_cancel_exit(u64 id);
+
 struct per_thread_id {
     typedef std::thread::id id_t;
     id_t operator()() const { return std::this_thread::get_id(); }
 };
 
+// Per-thread values, keyed by thread id. The optional init hook runs when a
+// value is created, the exit hook right before it is destroyed, which also
+// happens for all values left when the per_thread itself is destroyed. If
+// the key is the thread id, values created by a thread for itself are
+// destroyed automatically once that thread exits.
 template <typename T, typename ID = per_thread_id>
 class per_thread
 {
 public:
     typedef typename ID::id_t id_t;
-    void set(const T& val, id_t id = ID()()) {
-        std::lock_guard<std::recursive_mutex> lock(m_mtx);
-        m_storage[id] = val;
-    }
+    typedef std::function<void(T&)> hook;
 
-    void set(T&& val, id_t id = ID()()) {
+    per_thread(hook on_init = nullptr, hook on_exit = nullptr):
+        m_mtx(),
+        m_storage(),
+        m_hooks(),
+        m_init(std::move(on_init)),
+        m_exit(std::move(on_exit)) {}
+
+    per_thread(const per_thread&) = delete;
+
+    ~per_thread() {
+        std::vector<u64> hooks;
+        {
+            std::lock_guard<std::recursive_mutex> lock(m_mtx);
+            for (const auto& it : m_hooks)
+                hooks.push_back(it.second);
+            m_hooks.clear();
+        }
+
+        for (u64 id : hooks)
+            per_thread_cancel_exit(id);
+
+        // values whose thread is still alive are released right now
         std::lock_guard<std::recursive_mutex> lock(m_mtx);
-        m_storage[id] = std::move(val);
+        while (!m_storage.empty())
+            erase(m_storage.begin()->first);
     }
 
+    void set(const T& val, id_t id = ID()()) { get(id) = val; }
+    void set(T&& val, id_t id = ID()()) { get(id) = std::move(val); }
+
     T& get(id_t id = ID()()) {
         std::lock_guard<std::recursive_mutex> lock(m_mtx);
-        return m_storage[id];
+        auto it = m_storage.find(id);
+        if (it == m_storage.end())
+            it = insert(id);
+        return it->second;
     }
 
     const T& get(id_t id = ID()()) const {
@@ -48,8 +96,19 @@ public:
     }
 
     void clear(id_t id = ID()()) {
-        std::lock_guard<std::recursive_mutex> lock(m_mtx);
-        m_storage.erase(id);
+        u64 hook_id = 0;
+        {
+            std::lock_guard<std::recursive_mutex> lock(m_mtx);
+            erase(id);
+            auto it = m_hooks.find(id);
+            if (it != m_hooks.end()) {
+                hook_id = it->second;
+                m_hooks.erase(it);
+            }
+        }
+
+        if (hook_id)
+            per_thread_cancel_exit(hook_id);
     }
 
     bool has_value(id_t id = ID()()) const {
@@ -57,6 +116,11 @@ public:
         return m_storage.find(id) != m_storage.end();
     }
 
+    size_t size() const {
+        std::lock_guard<std::recursive_mutex> lock(m_mtx);
+        return m_storage.size();
+    }
+
     void lock() const { m_mtx.lock(); }
     void unlock() const { m_mtx.unlock(); }
     explicit operator bool() const { return has_value(); }
@@ -73,6 +137,229 @@ public:
 private:
     mutable std::recursive_mutex m_mtx;
     std::unordered_map<id_t, T> m_storage;
+    std::unordered_map<id_t, u64> m_hooks;
+    hook m_init;
+    hook m_exit;
+
+    typename std::unordered_map<id_t, T>::iterator insert(id_t id) {
+        auto it = m_storage.emplace(id, T()).first;
+        if (m_init)
+            m_init(it->second);
+
+        if constexpr (std::is_same_v<ID, per_thread_id>) {
+            if (id == std::this_thread::get_id()) {
+                u64 hook_id = per_thread_at_exit([this, id]() {
+                    std::lock_guard<std::recursive_mutex> lock(m_mtx);
+                    erase(id);
+                    m_hooks.erase(id);
+                });
+
+                if (hook_id)
+                    m_hooks[id] = hook_id;
+            }
+        }
+
+        return it;
+    }
+
+    void erase(id_t id) {
+        auto it = m_storage.find(id);
+        if (it == m_storage.end())
+            return;
+        if (m_exit)
+            m_exit(it->second);
+        m_storage.erase(it);
+    }
+};
+
+// Returns a small, dense index for the calling thread, starting at zero.
+// Indices are handed out on first use and are reused once a thread exits.
+size_t per_thread_alloc_index(size_t& cache);
+
+inline size_t per_thread_index() {
+    static thread_local size_t index = ~(size_t)0;
+    if (index == ~(size_t)0)
+        return per_thread_alloc_index(index);
+    return index;
+}
+
+// Lock-free alternative to per_thread for hot paths: every thread finds its
+// own slot directly via per_thread_index, so get() costs a thread-local load
+// and an array lookup. Slots are padded to full cache lines to avoid false
+// sharing. Slots of other threads can be visited using for_each, e.g. to
+// aggregate statistics; synchronizing access to their values is up to T.
+// Values are destroyed when their thread exits, right after the exit hook
+// has run on that thread, or together with the per_thread_local, whichever
+// comes first. Hooks must not call for_each themselves.
+template <typename T>
+class per_thread_local
+{
+public:
+    typedef std::function<void(T&)> hook;
+
+    per_thread_local(hook on_init = nullptr, hook on_exit = nullptr):
+        m_mtx(),
+        m_slots_mtx(),
+        m_chunks(),
+        m_init(std::move(on_init)),
+        m_exit(std::move(on_exit)) {}
+
+    per_thread_local(const per_thread_local&) = delete;
+
+    ~per_thread_local() {
+        for (size_t c = 0; c < NUM_CHUNKS; c++) {
+            slot* chunk = m_chunks[c].load(std::memory_order_acquire);
+            for (size_t i = 0; chunk && i < chunk_size(c); i++) {
+                u64 hook_id = chunk[i].hook.exchange(0);
+                if (hook_id)
+                    per_thread_cancel_exit(hook_id);
+                destroy(chunk[i]);
+            }
+        }
+
+        for (auto& chunk : m_chunks)
+            delete[] chunk.load(std::memory_order_relaxed);
+    }
+
+    void set(const T& val) { get() = val; }
+    void set(T&& val) { get() = std::move(val); }
+
+    T& get() {
+        slot& s = lookup(per_thread_index());
+        if (!s.used.load(std::memory_order_relaxed))
+            init(s);
+        return s.value;
+    }
+
+    const T& get() const {
+        const slot* s = find(per_thread_index());
+        if (s == nullptr)
+            throw std::out_of_range("per_thread_local: no value");
+        return s->value;
+    }
+
+    void clear() {
+        slot& s = lookup(per_thread_index());
+        u64 hook_id = s.hook.exchange(0);
+        destroy(s);
+        if (hook_id)
+            per_thread_cancel_exit(hook_id);
+    }
+
+    bool has_value() const { return find(per_thread_index()) != nullptr; }
+
+    // visits the values of all threads that have one
+    template <typename FN>
+    void for_each(FN&& fn) {
+        std::lock_guard<std::recursive_mutex> lock(m_slots_mtx);
+        for (size_t c = 0; c < NUM_CHUNKS; c++) {
+            slot* chunk = m_chunks[c].load(std::memory_order_acquire);
+            for (size_t i = 0; chunk && i < chunk_size(c); i++) {
+                if (chunk[i].used.load(std::memory_order_acquire))
+                    fn(chunk[i].value);
+            }
+        }
+    }
+
+    template <typename FN>
+    void for_each(FN&& fn) const {
+        const_cast<per_thread_local*>(this)->for_each(
+            [&fn](const T& val) { fn(val); });
+    }
+
+    size_t size() const {
+        size_t n = 0;
+        for_each([&n](const T&) { n++; });
+        return n;
+    }
+
+    // keeps values from being destroyed by exiting threads, e.g. while
+    // combining the results of for_each with state kept by the exit hook
+    void lock() const { m_slots_mtx.lock(); }
+    void unlock() const { m_slots_mtx.unlock(); }
+
+    explicit operator bool() const { return has_value(); }
+    operator T() const { return get(); }
+    T& operator*() { return get(); }
+    const T& operator*() const { return get(); }
+    T* operator->() { return &get(); }
+    const T* operator->() const { return &get(); }
+    void operator=(const T& val) { set(val); }
+    void operator=(T&& val) { set(std::move(val)); }
+
+private:
+    struct alignas(64) slot {
+        T value;
+        std::atomic<bool> used;
+        std::atomic<u64> hook;
+        slot(): value(), used(false), hook(0) {}
+    };
+
+    // chunk c holds CHUNK_BASE << c slots, so existing slots never move
+    static constexpr size_t CHUNK_BASE = 16;
+    static constexpr size_t NUM_CHUNKS = 32;
+
+    static constexpr size_t chunk_size(size_t c) { return CHUNK_BASE << c; }
+
+    static void locate(size_t idx, size_t& c, size_t& offset) {
+        c = fls(idx / CHUNK_BASE + 1);
+        offset = idx - CHUNK_BASE * ((1ull << c) - 1);
+    }
+
+    std::mutex m_mtx;
+    mutable std::recursive_mutex m_slots_mtx;
+    std::atomic<slot*> m_chunks[NUM_CHUNKS];
+    hook m_init;
+    hook m_exit;
+
+    slot& lookup(size_t idx) {
+        size_t c, offset;
+        locate(idx, c, offset);
+        slot* chunk = m_chunks[c].load(std::memory_order_acquire);
+        if (chunk == nullptr) {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            chunk = m_chunks[c].load(std::memory_order_relaxed);
+            if (chunk == nullptr) {
+                chunk = new slot[chunk_size(c)];
+                m_chunks[c].store(chunk, std::memory_order_release);
+            }
+        }
+
+        return chunk[offset];
+    }
+
+    const slot* find(size_t idx) const {
+        size_t c, offset;
+        locate(idx, c, offset);
+        const slot* chunk = m_chunks[c].load(std::memory_order_acquire);
+        if (chunk == nullptr)
+            return nullptr;
+        const slot& s = chunk[offset];
+        return s.used.load(std::memory_order_acquire) ? &s : nullptr;
+    }
+
+    void init(slot& s) {
+        if (m_init)
+            m_init(s.value);
+        s.hook = per_thread_at_exit([this, &s]() {
+            s.hook = 0; // the hook is gone once it ran
+            destroy(s);
+        });
+        s.used.store(true, std::memory_order_release);
+    }
+
+    // T need not be assignable, so values are reset by constructing anew
+    void destroy(slot& s) {
+        std::lock_guard<std::recursive_mutex> lock(m_slots_mtx);
+        if (!s.used.load(std::memory_order_relaxed))
+            return;
+
+        if (m_exit)
+            m_exit(s.value);
+        s.used.store(false, std::memory_order_relaxed);
+        s.value.~T();
+        new (&s.value) T();
+    }
 };
 
 } // namespace mwr
@@ -0,0 +1,171 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#ifndef MWR_UTILS_RANGE_MAP_H
+#define MWR_UTILS_RANGE_MAP_H
+
+#include "mwr/core/compiler.h"
+#include "mwr/core/types.h"
+#include "mwr/core/report.h"
+#include "mwr/stl/containers.h"
+
+namespace mwr {
+
+// Maps non-overlapping address ranges [start, end] to values. Assigning a
+// value to a range trims or splits all ranges it overlaps and adjacent
+// ranges holding equal values are merged, so the map always contains the
+// minimal number of maximal runs.
+template <typename T>
+class range_map
+{
+private:
+    struct range {
+        u64 end;
+        T data;
+    };
+
+    using map_type = map<u64, range>;
+    map_type m_ranges;
+
+    // makes sure that no range crosses the boundary between addr - 1 and addr
+    void split(u64 addr) {
+        auto it = m_ranges.upper_bound(addr);
+        if (it == m_ranges.begin())
+            return;
+
+        --it;
+        if (it->first < addr && it->second.end >= addr) {
+            m_ranges.emplace_hint(std::next(it), addr,
+                                  range{ it->second.end, it->second.data });
+            it->second.end = addr - 1;
+        }
+    }
+
+    void carve(u64 start, u64 end) {
+        split(start);
+        if (end < U64_MAX)
+            split(end + 1);
+
+        auto lo = m_ranges.lower_bound(start);
+        auto hi = m_ranges.upper_bound(end);
+        m_ranges.erase(lo, hi);
+    }
+
+    typename map_type::iterator merge(typename map_type::iterator it) {
+        if (it != m_ranges.begin()) {
+            auto prev = std::prev(it);
+            if (prev->second.end + 1 == it->first &&
+                prev->second.data == it->second.data) {
+                prev->second.end = it->second.end;
+                m_ranges.erase(it);
+                it = prev;
+            }
+        }
+
+        auto next = std::next(it);
+        if (next != m_ranges.end() && it->second.end + 1 == next->first &&
+            it->second.data == next->second.data) {
+            it->second.end = next->second.end;
+            m_ranges.erase(next);
+        }
+
+        return it;
+    }
+
+public:
+    class const_iterator
+    {
+        friend class range_map;
+
+    private:
+        typename map_type::const_iterator m_it;
+
+    public:
+        const_iterator(typename map_type::const_iterator it): m_it(it) {}
+
+        const_iterator& operator++() {
+            ++m_it;
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            const_iterator temp = *this;
+            ++(*this);
+            return temp;
+        }
+
+        bool operator==(const const_iterator& other) const {
+            return m_it == other.m_it;
+        }
+
+        bool operator!=(const const_iterator& other) const {
+            return m_it != other.m_it;
+        }
+
+        const T& operator*() const { return data(); }
+        const T& data() const { return m_it->second.data; }
+        u64 start() const { return m_it->first; }
+        u64 end() const { return m_it->second.end; }
+    };
+
+    using iterator = const_iterator;
+
+    const_iterator begin() const { return m_ranges.cbegin(); }
+    const_iterator end() const { return m_ranges.cend(); }
+
+    range_map(): m_ranges() {}
+    range_map(range_map&&) noexcept = default;
+    range_map& operator=(range_map&&) noexcept = default;
+    range_map(const range_map&) = default;
+    range_map& operator=(const range_map&) = default;
+    ~range_map() = default;
+
+    size_t size() const { return m_ranges.size(); }
+    bool empty() const { return m_ranges.empty(); }
+    void clear() { m_ranges.clear(); }
+
+    const_iterator assign(u64 start, u64 end, const T& data) {
+        MWR_ERROR_ON(end < start, "invalid range %llu..%llu", start, end);
+        carve(start, end);
+        auto it = m_ranges.emplace(start, range{ end, data }).first;
+        return const_iterator(merge(it));
+    }
+
+    void erase(u64 start, u64 end) {
+        MWR_ERROR_ON(end < start, "invalid range %llu..%llu", start, end);
+        carve(start, end);
+    }
+
+    const_iterator find(u64 addr) const {
+        auto it = m_ranges.upper_bound(addr);
+        if (it == m_ranges.begin())
+            return m_ranges.end();
+
+        --it;
+        return it->second.end >= addr ? it : m_ranges.end();
+    }
+
+    bool contains(u64 addr) const { return find(addr) != end(); }
+
+    template <typename FN>
+    void for_each(u64 start, u64 end, FN fn) const {
+        MWR_ERROR_ON(end < start, "invalid range %llu..%llu", start, end);
+        auto it = m_ranges.upper_bound(start);
+        if (it != m_ranges.begin() && std::prev(it)->second.end >= start)
+            --it;
+
+        for (; it != m_ranges.end() && it->first <= end; ++it)
+            fn(it->first, it->second.end, it->second.data);
+    }
+};
+
+} // namespace mwr
+
+#endif
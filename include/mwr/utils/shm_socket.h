@@ -0,0 +1,113 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#ifndef MWR_UTILS_SHM_SOCKET_H
+#define MWR_UTILS_SHM_SOCKET_H
+
+#include "mwr/core/types.h"
+#include "mwr/core/report.h"
+#include "mwr/core/compiler.h"
+
+#include "mwr/stl/strings.h"
+
+#include "mwr/utils/socket.h"
+
+namespace mwr {
+
+// Stream transport between two shm_socket peers. The connection is set up
+// over TCP, where the connecting side offers a shared memory segment holding
+// one ring buffer per direction. If the accepting side can map it, which is
+// only possible on the same host, data bypasses the kernel entirely and
+// futexes serve as doorbells for sleeping peers. Otherwise, or on platforms
+// without support, all data keeps flowing through the TCP connection.
+class shm_socket
+{
+public:
+    bool is_connected() const;
+    bool is_shared() const { return m_shm != nullptr; }
+
+    size_t ring_size() const { return m_ringsize; }
+
+    size_t get_spin_count() const { return m_spin; }
+    void set_spin_count(size_t spin) { m_spin = spin; }
+
+    shm_socket(size_t ringsize = 1 * MiB);
+    virtual ~shm_socket();
+
+    shm_socket(const shm_socket&) = delete;
+    shm_socket& operator=(const shm_socket&) = delete;
+
+    void connect(const string& host, u16 port);
+    void accept(server_socket& server, int client);
+    void disconnect();
+
+    size_t peek(time_t timeoutms = 0);
+
+    void send(const void* data, size_t size);
+    void recv(void* data, size_t size);
+
+    void send(const string& str) { send(str.c_str(), str.length()); }
+    void send(const char* str) { send(str, strlen(str)); }
+
+    void send_char(int c);
+    int recv_char();
+
+    template <typename T>
+    void send(const T& data) {
+        send(&data, sizeof(data));
+    }
+
+    template <typename T>
+    void recv(T& data) {
+        recv(&data, sizeof(data));
+    }
+
+private:
+    struct header;
+    struct ring;
+
+    size_t m_ringsize;
+    size_t m_spin;
+
+    socket m_socket;
+    server_socket* m_server;
+    int m_client;
+
+    header* m_shm;
+    size_t m_shmsize;
+    ring* m_tx;
+    ring* m_rx;
+    u8* m_txdata;
+    u8* m_rxdata;
+
+    void map_shared(int fd, size_t size, bool initiator);
+    void unmap_shared();
+
+    void check_peer();
+    void wait(ring* r, bool data, time_t timeoutms);
+
+    void send_fallback(const void* data, size_t size);
+    void recv_fallback(void* data, size_t size);
+};
+
+inline void shm_socket::send_char(int c) {
+    u8 x = (u8)c;
+    send(&x, sizeof(x));
+}
+
+inline int shm_socket::recv_char() {
+    u8 x = 0;
+    recv(&x, sizeof(x));
+    return x;
+}
+
+} // namespace mwr
+
+#endif
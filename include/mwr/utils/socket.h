@@ -11,23 +11,84 @@
 #ifndef MWR_UTILS_SOCKET_H
 #define MWR_UTILS_SOCKET_H
 
+#include <memory>
+
 #include "mwr/core/types.h"
 #include "mwr/core/report.h"
 #include "mwr/core/compiler.h"
 #include "mwr/core/utils.h"
 
+#include "mwr/stl/containers.h"
 #include "mwr/stl/strings.h"
 #include "mwr/stl/streams.h"
 #include "mwr/stl/threads.h"
 
+#ifndef MWR_WINDOWS
+#include <sys/uio.h>
+#endif
+
 namespace mwr {
 
 #ifdef MWR_WINDOWS
 using socket_t = unsigned long long;
+struct iovec {
+    void* iov_base;
+    size_t iov_len;
+};
 #else
 using socket_t = int;
+using ::iovec;
 #endif
 
+inline size_t iov_length(const iovec* iov, size_t iovcnt) {
+    size_t len = 0;
+    for (size_t i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+    return len;
+}
+
+// drops the first n bytes from the vectors starting at index idx and returns
+// the index of the first vector that still holds data
+inline size_t iov_advance(vector<iovec>& iov, size_t idx, size_t n) {
+    while (idx < iov.size() && n >= iov[idx].iov_len)
+        n -= iov[idx++].iov_len;
+
+    if (idx < iov.size()) {
+        iov[idx].iov_base = (u8*)iov[idx].iov_base + n;
+        iov[idx].iov_len -= n;
+    }
+
+    return idx;
+}
+
+// Busy polling counters: spins are failed non-blocking receive attempts,
+// hits are receives that got their data while spinning and sleeps are
+// receives that had to block after the spin budget was used up.
+struct busy_poll_stats {
+    u64 spins;
+    u64 hits;
+    u64 sleeps;
+};
+
+class busy_poll_counters
+{
+public:
+    std::atomic<u64> spins;
+    std::atomic<u64> hits;
+    std::atomic<u64> sleeps;
+
+    busy_poll_counters(): spins(0), hits(0), sleeps(0) {}
+
+    void add(const busy_poll_stats& stats) {
+        spins.fetch_add(stats.spins, std::memory_order_relaxed);
+        hits.fetch_add(stats.hits, std::memory_order_relaxed);
+        sleeps.fetch_add(stats.sleeps, std::memory_order_relaxed);
+    }
+
+    busy_poll_stats get() const { return { spins, hits, sleeps }; }
+    void reset() { spins = hits = sleeps = 0; }
+};
+
 class socket
 {
 private:
@@ -37,9 +98,59 @@ private:
     string m_host;
     string m_peer;
     bool m_ipv6;
+    bool m_unix;
     u16 m_port;
-
+    u64 m_gen;
+
+    // receive ring buffer, guarded by m_rxmtx
+    mutable mutex m_rxmtx;
+    vector<u8> m_rxbuf;
+    size_t m_rxhead;
+    size_t m_rxlen;
+    u64 m_rxgen;
+
+    // coalescing transmit buffer, guarded by m_txmtx
+    mutable mutex m_txmtx;
+    vector<u8> m_txbuf;
+    size_t m_txcap;
+    u64 m_txgen;
+    std::atomic<bool> m_autoflush;
+
+    // zero disables the respective timeout
+    std::atomic<time_t> m_connect_timeout;
+    std::atomic<time_t> m_send_timeout;
+    std::atomic<time_t> m_recv_timeout;
+
+    std::atomic<size_t> m_busy_spins;
+    std::atomic<unsigned int> m_busy_poll_us;
+    busy_poll_counters m_busy;
+
+    // most recent peer and connect retry policy, guarded by m_mtx
+    string m_remote;
+    u16 m_remote_port;
+    bool m_remote_unix;
+    size_t m_retries;
+    time_t m_backoff_initial;
+    time_t m_backoff_max;
+
+    void connect_once(const string& host, u16 port);
+    void connect_unix_once(const string& path);
+    void connect_retry(const std::function<void()>& attempt);
     void disconnect_locked();
+    bool generation(u64& gen) const;
+
+    size_t peek_unbuffered(time_t timeoutms);
+    void send_unbuffered(const void* data, size_t size);
+    size_t recv_unbuffered(void* data, size_t size, bool partial);
+    void send_unbuffered(const iovec* iov, size_t iovcnt);
+    void recv_unbuffered(const iovec* iov, size_t iovcnt);
+    void send_file_unbuffered(int fd, u64 offset, size_t len);
+
+    void sync_rx_locked();
+    void sync_tx_locked();
+    void flush_locked();
+    void fill_locked();
+    size_t consume_locked(u8* data, size_t size);
 
 public:
     u16 port() const;
@@ -48,9 +159,41 @@ public:
 
     bool is_ipv4() const;
     bool is_ipv6() const;
+    bool is_unix() const;
 
     bool is_connected() const;
 
+    bool is_buffered() const;
+    void set_buffered(size_t rxsize = 64 * KiB, size_t txsize = 64 * KiB);
+    void set_unbuffered() { set_buffered(0, 0); }
+
+    bool get_autoflush() const { return m_autoflush; }
+    void set_autoflush(bool set = true) { m_autoflush = set; }
+
+    // Timeouts in milliseconds, zero waits forever. An operation that times
+    // out before any data was transferred leaves the connection intact,
+    // otherwise the socket is disconnected. Name resolution is not bounded.
+    time_t connect_timeout() const { return m_connect_timeout; }
+    time_t send_timeout() const { return m_send_timeout; }
+    time_t recv_timeout() const { return m_recv_timeout; }
+
+    void set_connect_timeout(time_t ms) { m_connect_timeout = ms; }
+    void set_send_timeout(time_t ms) { m_send_timeout = ms; }
+    void set_recv_timeout(time_t ms) { m_recv_timeout = ms; }
+
+    // Failed connects are retried up to retries times, waiting initialms
+    // before the first retry and doubling the delay up to maxms.
+    void set_retry(size_t retries, time_t initialms = 10, time_t maxms = 1000);
+
+    // Receives retry without blocking up to spins times before they go to
+    // sleep, which saves scheduler wakeups when replies arrive quickly. On
+    // Linux, kernelus also enables SO_BUSY_POLL, if permitted.
+    size_t get_busy_poll() const { return m_busy_spins; }
+    void set_busy_poll(size_t spins, unsigned int kernelus = 0);
+
+    busy_poll_stats get_busy_poll_stats() const { return m_busy.get(); }
+    void reset_busy_poll_stats() { m_busy.reset(); }
+
     socket();
     socket(const string& host, u16 port);
     socket(socket&& other) noexcept;
@@ -63,6 +206,13 @@ public:
     void connect(const string& host, u16 port);
     void disconnect();
 
+    // connects again to the most recent peer
+    void reconnect();
+
+    // connects to a unix domain socket, paths starting with '@' refer to
+    // the Linux abstract socket namespace
+    void connect_unix(const string& path);
+
     size_t peek(time_t timeoutms = 0);
 
     void send_char(int c);
@@ -71,6 +221,14 @@ public:
     void send(const void* data, size_t size);
     void recv(void* data, size_t size);
 
+    void send(const iovec* iov, size_t iovcnt);
+    void recv(const iovec* iov, size_t iovcnt);
+
+    // Sends len bytes of file fd starting at offset. On Linux the data is
+    // moved within the kernel via sendfile or splice. The file position of
+    // fd is not changed, except for pipes, where offset is ignored.
+    void send_file(int fd, u64 offset, size_t len);
+
     void send(const string& str);
     void send(const char* str);
 
@@ -78,6 +236,11 @@ public:
     void send(const T& data);
     template <typename T>
     void recv(T& data);
+
+    void flush();
+
+    string read_until(char delim);
+    string read_line();
 };
 
 inline u16 socket::port() const {
@@ -97,7 +260,7 @@ inline const char* socket::peer() const {
 
 inline bool socket::is_ipv4() const {
     lock_guard<mutex> guard(m_mtx);
-    return !m_ipv6;
+    return !m_ipv6 && !m_unix;
 }
 
 inline bool socket::is_ipv6() const {
@@ -105,6 +268,17 @@ inline bool socket::is_ipv6() const {
     return m_ipv6;
 }
 
+inline bool socket::is_unix() const {
+    lock_guard<mutex> guard(m_mtx);
+    return m_unix;
+}
+
+inline bool socket::is_buffered() const {
+    lock_guard<mutex> rxguard(m_rxmtx);
+    lock_guard<mutex> txguard(m_txmtx);
+    return !m_rxbuf.empty() || m_txcap > 0;
+}
+
 inline void socket::send_char(int c) {
     char x = (char)c;
     send(&x, sizeof(x));
@@ -150,9 +324,17 @@ public:
     bool get_ipv6_only() const;
     void set_ipv6_only(bool set = true);
 
+    // busy polling applies to all clients, see socket::set_busy_poll
+    size_t get_busy_poll() const { return m_busy_spins; }
+    void set_busy_poll(size_t spins, unsigned int kernelus = 0);
+
+    busy_poll_stats get_busy_poll_stats() const { return m_busy.get(); }
+    void reset_busy_poll_stats() { m_busy.reset(); }
+
     bool is_listening() const;
     bool is_connected() const;
     bool is_connected(int client) const;
+    bool is_unix() const;
 
     using connect_fn = std::function<bool(int, string, u16)>;
     void on_connect(connect_fn fn);
@@ -160,6 +342,16 @@ public:
     using disconnect_fn = std::function<void(int)>;
     void on_disconnect(disconnect_fn fn);
 
+    // event callbacks invoked from dispatch(), per-client callbacks take
+    // precedence over the server-wide ones
+    using event_fn = std::function<void(int)>;
+    void on_readable(event_fn fn);
+    void on_writable(event_fn fn);
+    void on_hangup(event_fn fn);
+    void on_readable(int client, event_fn fn);
+    void on_writable(int client, event_fn fn);
+    void on_hangup(int client, event_fn fn);
+
     server_socket(size_t max_clients);
     server_socket(size_t max_client, u16 port): server_socket(max_client) {
         listen(port);
@@ -172,16 +364,24 @@ public:
     ~server_socket();
 
     void listen(u16 port, const string& host = "localhost");
+    void listen_unix(const string& path);
     void unlisten();
     void disconnect(int client);
     void disconnect_all();
 
     int poll(size_t timeoutms);
+    size_t dispatch(size_t timeoutms);
 
+    size_t available(int client);
     bool peek(int client, size_t timeoutms);
     void send(int client, const void* buffer, size_t buflen);
     void recv(int client, void* buffer, size_t buflen);
 
+    void send(int client, const iovec* iov, size_t iovcnt);
+    void recv(int client, const iovec* iov, size_t iovcnt);
+
+    void send_file(int client, int fd, u64 offset, size_t len);
+
     void send(int client, const string& str);
     void send(int client, const char* str);
 
@@ -200,22 +400,103 @@ private:
     socket_t m_socket;
     string m_host;
     u16 m_port;
-
+    bool m_unix;
+
+    // per-client state is shared with all threads currently using it, so a
+    // concurrent disconnect never closes a socket from under their feet;
+    // client ids are never reused, stale ids simply fail to look up
+    struct client_state {
+        // reading pauses once this much data is buffered, so that the peer
+        // is throttled by TCP flow control, and resumes below half of it
+        static constexpr size_t RX_HIGH_WATER = 1 * MiB;
+
+        const int id;
+        const socket_t conn;
+
+        std::mutex txmtx; // serializes senders
+        std::mutex rxmtx; // guards the receive state below
+        vector<u8> rxbuf;
+        size_t rxpos;
+        size_t waiters;
+        bool throttled;
+        bool hangup;
+        int error;
+        atomic<bool> pending; // queued in m_ready or being dispatched
+
+        // written with both m_mtx and m_clients_mtx held, so either of them
+        // suffices for reading
+        event_fn on_readable;
+        event_fn on_writable;
+        event_fn on_hangup;
+
+        client_state(int client, socket_t s):
+            id(client),
+            conn(s),
+            txmtx(),
+            rxmtx(),
+            rxbuf(),
+            rxpos(0),
+            waiters(0),
+            throttled(false),
+            hangup(false),
+            error(0),
+            pending(false),
+            on_readable(),
+            on_writable(),
+            on_hangup() {}
+
+        ~client_state();
+
+        client_state(const client_state&) = delete;
+
+        size_t available() const { return rxbuf.size() - rxpos; }
+        size_t consume(u8* buffer, size_t buflen);
+    };
+
+    using client_ref = std::shared_ptr<client_state>;
+
+    int m_epoll;
     size_t m_max_clients;
     int m_next_client_id;
-    map<int, socket_t> m_clients;
+
+    // lookups only need a shared lock, so that clients do not serialize on
+    // each other; inserting and removing requires m_mtx to be held as well
+    mutable shared_mutex m_clients_mtx;
+    map<int, client_ref> m_clients;
+
+    // clients with pending data or hangups, in the order they became ready;
+    // may contain clients that are gone or no longer pending by now
+    std::mutex m_ready_mtx;
+    deque<int> m_ready;
 
     bool m_nodelay;
     bool m_ipv6_only;
 
+    std::atomic<size_t> m_busy_spins;
+    std::atomic<unsigned int> m_busy_poll_us;
+    busy_poll_counters m_busy;
+
     connect_fn m_connect;
     disconnect_fn m_disconnect;
 
-    socket_t find_socket_locked(int client) const;
-    socket_t find_socket(int client) const;
+    // guarded like the per-client event callbacks
+    event_fn m_readable;
+    event_fn m_writable;
+    event_fn m_hangup;
+
+    client_ref find_state(int client) const;
+    client_ref lookup_state(int client) const;
+    int first_pending();
 
-    int find_client(socket_t conn) const;
-    void accept_new_client();
+    bool accept_new_client();
+    void close_listener_locked();
+    void close_client(client_state& state);
+
+    void fill_locked(client_state& state);
+    void update_pending_locked(client_state& state);
+    void watch_writable_locked(int client, client_state& state);
+    size_t wait_events(size_t timeoutms, vector<int>& writable);
+    size_t dispatch_pending();
 };
 
 inline u16 server_socket::port() const {
@@ -234,15 +515,15 @@ inline size_t server_socket::max_clients() const {
 }
 
 inline size_t server_socket::num_clients() const {
-    lock_guard<mutex> guard(m_mtx);
+    shared_lock<shared_mutex> lock(m_clients_mtx);
     return m_clients.size();
 }
 
 inline vector<int> server_socket::clients() const {
-    lock_guard<mutex> guard(m_mtx);
+    shared_lock<shared_mutex> lock(m_clients_mtx);
     vector<int> result;
     result.reserve(m_clients.size());
-    for (auto [client, socket] : m_clients)
+    for (const auto& [client, state] : m_clients)
         result.push_back(client);
     return result;
 }
@@ -272,12 +553,17 @@ inline bool server_socket::is_listening() const {
     return (long long)m_socket >= 0;
 }
 
+inline bool server_socket::is_unix() const {
+    lock_guard<mutex> guard(m_mtx);
+    return m_unix;
+}
+
 inline bool server_socket::is_connected() const {
     return num_clients() > 0;
 }
 
 inline bool server_socket::is_connected(int client) const {
-    lock_guard<mutex> guard(m_mtx);
+    shared_lock<shared_mutex> lock(m_clients_mtx);
     return m_clients.find(client) != m_clients.end();
 }
 
@@ -291,6 +577,32 @@ inline void server_socket::on_disconnect(disconnect_fn fn) {
     m_disconnect = std::move(fn);
 }
 
+inline void server_socket::on_readable(event_fn fn) {
+    lock_guard<mutex> guard(m_mtx);
+    unique_lock<shared_mutex> lock(m_clients_mtx);
+    m_readable = std::move(fn);
+}
+
+inline void server_socket::on_hangup(event_fn fn) {
+    lock_guard<mutex> guard(m_mtx);
+    unique_lock<shared_mutex> lock(m_clients_mtx);
+    m_hangup = std::move(fn);
+}
+
+inline void server_socket::on_readable(int client, event_fn fn) {
+    lock_guard<mutex> guard(m_mtx);
+    client_ref state = find_state(client);
+    unique_lock<shared_mutex> lock(m_clients_mtx);
+    state->on_readable = std::move(fn);
+}
+
+inline void server_socket::on_hangup(int client, event_fn fn) {
+    lock_guard<mutex> guard(m_mtx);
+    client_ref state = find_state(client);
+    unique_lock<shared_mutex> lock(m_clients_mtx);
+    state->on_hangup = std::move(fn);
+}
+
 inline void server_socket::send(int client, const string& str) {
     send(client, str.c_str(), str.length());
 }
@@ -320,24 +632,34 @@ inline int server_socket::recv_char(int client) {
     return data;
 }
 
-inline socket_t server_socket::find_socket_locked(int client) const {
-    auto it = m_clients.find(client);
-    MWR_REPORT_ON(it == m_clients.end(), "client %d not connected", client);
-    return it->second;
+inline size_t server_socket::client_state::consume(u8* buffer,
+                                                   size_t buflen) {
+    size_t n = std::min(available(), buflen);
+    memcpy(buffer, rxbuf.data() + rxpos, n);
+    rxpos += n;
+    if (rxpos == rxbuf.size()) {
+        rxbuf.clear();
+        rxpos = 0;
+    } else if (rxpos > rxbuf.size() / 2) {
+        rxbuf.erase(rxbuf.begin(), rxbuf.begin() + rxpos);
+        rxpos = 0;
+    }
+
+    return n;
 }
 
-inline socket_t server_socket::find_socket(int client) const {
-    lock_guard<mutex> guard(m_mtx);
-    return find_socket_locked(client);
+inline server_socket::client_ref server_socket::find_state(
+    int client) const {
+    client_ref state = lookup_state(client);
+    MWR_REPORT_ON(!state, "client %d not connected", client);
+    return state;
 }
 
-inline int server_socket::find_client(socket_t conn) const {
-    lock_guard<mutex> guard(m_mtx);
-    for (const auto& [client, socket] : m_clients) {
-        if (socket == conn)
-            return client;
-    }
-    return -1;
+inline server_socket::client_ref server_socket::lookup_state(
+    int client) const {
+    shared_lock<shared_mutex> lock(m_clients_mtx);
+    auto it = m_clients.find(client);
+    return it != m_clients.end() ? it->second : nullptr;
 }
 
 } // namespace mwr
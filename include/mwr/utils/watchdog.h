@@ -16,49 +16,65 @@
 #include <condition_variable>
 #include <functional>
 #include <mutex>
-#include <queue>
 #include <thread>
 
+#include "mwr/core/types.h"
+#include "mwr/core/compiler.h"
+#include "mwr/stl/containers.h"
 #include "mwr/stl/threads.h"
 
 namespace mwr {
 
+// How the watchdog thread waits for the next deadline. Sleeping strategies
+// wake up slightly early and spin for the remaining time, whose length is
+// calibrated from the wakeup latencies observed so far.
+enum watchdog_wakeup {
+    WATCHDOG_SLEEP,   // timed condition variable wait, available everywhere
+    WATCHDOG_TIMERFD, // Linux timerfd, falls back to WATCHDOG_SLEEP elsewhere
+    WATCHDOG_SPIN,    // spin for all deadlines closer than 10ms
+};
+
+// Runs tasks on a worker thread once their timeout has expired. Pending tasks
+// are kept in a hierarchical timing wheel with microsecond resolution, so
+// scheduling and cancelling a task takes constant time regardless of how
+// many other tasks are pending. With a worker pool, expired tasks are
+// handed to the workers instead and may run concurrently and out of order.
 class watchdog
 {
 public:
     using clock_t = std::chrono::high_resolution_clock;
 
-    void schedule(clock_t::duration delta, std::function<void()> task) {
-        std::lock_guard<std::mutex> lock(m_mtx);
-        auto timeout = clock_t::now() + delta;
-        m_tasks.push({ timeout, std::move(task) });
-        m_cv.notify_one();
-    }
+    watchdog_wakeup wakeup() const { return m_wakeup; }
+    size_t num_workers() const { return m_workers.size(); }
 
-    void cancel_all() {
-        std::lock_guard<std::mutex> lock(m_mtx);
-        m_tasks = std::priority_queue<task, std::vector<task>,
-                                      std::greater<>>();
-        m_cv.notify_one();
-    }
+    // time spent spinning ahead of a deadline after waking up from sleep
+    std::chrono::nanoseconds spin_tail() const;
 
-    void schedule(size_t timeout_ns, std::function<void()> task) {
-        schedule(std::chrono::nanoseconds(timeout_ns), std::move(task));
-    }
+    // identifies a scheduled task, stays unique even after the task is gone
+    typedef u64 handle;
+    static constexpr handle INVALID_HANDLE = 0;
 
-    watchdog(watchdog const&) = delete;
-    watchdog(const string& name):
-        m_tasks(), m_worker(), m_mtx(), m_cv(), m_terminate(false) {
-        m_worker = std::thread(&watchdog::work, this, name);
+    handle schedule(clock_t::duration delta, std::function<void()> task);
+    handle schedule(size_t timeout_ns, std::function<void()> task) {
+        return schedule(std::chrono::nanoseconds(timeout_ns), std::move(task));
     }
 
-    ~watchdog() {
-        m_mtx.lock();
-        m_terminate = true;
-        m_cv.notify_one();
-        m_mtx.unlock();
-        m_worker.join();
-    }
+    // runs task every period until it gets cancelled
+    handle schedule_periodic(clock_t::duration period,
+                             std::function<void()> task);
+
+    // returns false if the task already ran or was cancelled before; tasks
+    // that are currently executing will finish, but not run again
+    bool cancel(handle h);
+    void cancel_all();
+
+    bool is_pending(handle h) const;
+    size_t num_pending() const;
+
+    watchdog(watchdog const&) = delete;
+    watchdog(const string& name, size_t workers = 0,
+             watchdog_wakeup wakeup = WATCHDOG_TIMERFD);
+    ~watchdog();
 
     static watchdog& instance() {
         static watchdog singleton("watchdog");
@@ -66,66 +82,82 @@ public:
     }
 
 private:
-    struct task {
-        clock_t::time_point timeout;
+    static constexpr size_t WHEEL_BITS = 6;
+    static constexpr size_t WHEEL_SLOTS = 1ull << WHEEL_BITS;
+    static constexpr size_t WHEEL_LEVELS = 6;
+    static constexpr u64 WHEEL_MASK = WHEEL_SLOTS - 1;
+    static constexpr u32 NONE = ~0u;
+
+    struct timer {
+        u64 expires; // in ticks since m_start
+        u64 period;  // in ticks, zero for one-shot tasks
+        u32 generation;
+        u32 slot;
+        u32 prev;
+        u32 next;
+        bool running;
+        std::function<void()> func;
+    };
+
+    struct expired {
+        handle id;
+        bool periodic;
         std::function<void()> func;
-        bool operator>(const task& o) const { return timeout > o.timeout; }
     };
 
-    std::priority_queue<task, std::vector<task>, std::greater<>> m_tasks;
+    clock_t::time_point m_start;
+    u64 m_now; // next tick to be processed
+
+    vector<timer> m_timers;
+    vector<u32> m_free;
+    size_t m_pending;
+
+    u32 m_head[WHEEL_LEVELS * WHEEL_SLOTS];
+    u32 m_tail[WHEEL_LEVELS * WHEEL_SLOTS];
+    u64 m_occupied[WHEEL_LEVELS];
+
     std::thread m_worker;
-    std::mutex m_mtx;
+    mutable std::mutex m_mtx;
     std::condition_variable m_cv;
     std::atomic<bool> m_terminate;
 
-    void work(const string& name) {
-        mwr::set_thread_name(name);
-        std::unique_lock<std::mutex> lock(m_mtx);
-        while (true) {
-            if (m_terminate)
-                break;
-            if (m_tasks.empty()) {
-                m_cv.wait(lock);
-            } else {
-                auto next_timeout = m_tasks.top().timeout;
-                auto delta = next_timeout - clock_t::now();
-                const std::chrono::milliseconds threshold(10);
-
-                // the condition variable takes quite some time to wakeup on
-                // timeout (measured between 1 and 2ms), so we just spin for
-                // shorter deltas
-                if (delta <= threshold) {
-                    lock.unlock();
-                    while (clock_t::now() < next_timeout)
-                        ; // spin
-                    lock.lock();
-                } else {
-                    m_cv.wait_until(lock, next_timeout, [this] {
-                        return m_terminate ||
-                               (!m_tasks.empty() &&
-                                (m_tasks.top().timeout < clock_t::now()));
-                    });
-                }
-
-                while (!m_tasks.empty() &&
-                       (m_tasks.top().timeout <= clock_t::now())) {
-                    auto task = m_tasks.top().func;
-                    m_tasks.pop();
-                    lock.unlock();
-                    task();
-                    lock.lock();
-                }
-            }
-        }
-
-        while (!m_tasks.empty() && (m_tasks.top().timeout <= clock_t::now())) {
-            auto task = m_tasks.top().func;
-            m_tasks.pop();
-            lock.unlock();
-            task();
-            lock.lock();
-        }
-    }
+    watchdog_wakeup m_wakeup;
+    u64 m_sleeping;              // deadline the worker waits for, or zero
+    std::atomic<bool> m_earlier; // an earlier task came in while waiting
+    std::atomic<u64> m_slack;    // average wakeup latency in nanoseconds
+    int m_timerfd;
+    int m_eventfd;
+
+    std::mutex m_jobmtx;
+    std::condition_variable m_jobcv;
+    deque<expired> m_jobs;
+    vector<std::thread> m_workers;
+    bool m_stopping;
+
+    u64 current_tick() const;
+    u64 to_ticks(clock_t::time_point t) const;
+    clock_t::time_point to_time(u64 tick) const;
+
+    timer* lookup(handle h);
+    const timer* lookup(handle h) const;
+    handle alloc(u64 expires, u64 period, std::function<void()>&& task);
+    void release(u32 idx);
+
+    void link(u32 idx);
+    void unlink(u32 idx);
+    void cascade(size_t level);
+
+    bool next_expiry(u64& tick) const;
+    void advance(u64 target, vector<expired>& batch);
+    void rearm(expired& task);
+    void run(vector<expired>& batch, std::unique_lock<std::mutex>& lock);
+
+    void notify(u64 expires);
+    void sleep_until(u64 tick, std::unique_lock<std::mutex>& lock);
+    bool wait(u64 tick, std::unique_lock<std::mutex>& lock);
+
+    void work(const string& name);
+    void worker_thread(const string& name);
 };
 
 } // namespace mwr
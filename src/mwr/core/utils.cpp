@@ -16,6 +16,7 @@
 #include <signal.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <atomic>
 #include <chrono>
 #include <filesystem>
 
@@ -338,16 +339,29 @@ struct msvc_invalid_parameter_guard {
 };
 #endif
 
+static std::atomic<fd_close_hook> g_close_hook(nullptr);
+
+void fd_set_close_hook(fd_close_hook hook) {
+    g_close_hook = hook;
+}
+
 void fd_close(int fd) {
     if (fd < 0)
         return;
 
+    fd_close_hook hook = g_close_hook;
+    if (hook)
+        hook(fd, false);
+
 #ifdef MWR_MSVC
     msvc_invalid_parameter_guard guard;
     _close(fd);
 #else
     close(fd);
 #endif
+
+    if (hook)
+        hook(fd, true);
 }
 
 size_t fd_peek(int fd, time_t timeoutms) {
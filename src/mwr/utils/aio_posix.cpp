@@ -15,91 +15,560 @@
 #include "mwr/stl/containers.h"
 #include "mwr/utils/aio.h"
 
+#include <fcntl.h>
 #include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef MWR_LINUX
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
 
 namespace mwr {
 
+static bool same_file(const struct stat& a, const struct stat& b) {
+    return a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+}
+
+#ifdef MWR_LINUX
+static u32 epoll_mask(unsigned int events, unsigned int flags) {
+    u32 mask = 0;
+    if (events & AIO_READ)
+        mask |= EPOLLIN | EPOLLPRI;
+    if (events & AIO_WRITE)
+        mask |= EPOLLOUT;
+
+    // one-shot and worker registrations are disarmed by the kernel as soon
+    // as they fire, so that no further events arrive while being handled
+    if (flags & (AIO_ONESHOT | AIO_WORKER))
+        mask |= EPOLLONESHOT;
+
+    return mask;
+}
+
+static unsigned int aio_mask(u32 revents) {
+    unsigned int events = 0;
+    if (revents & (EPOLLIN | EPOLLPRI))
+        events |= AIO_READ;
+    if (revents & EPOLLOUT)
+        events |= AIO_WRITE;
+    if (revents & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+        events |= AIO_ERROR;
+    return events;
+}
+
+// epoll silently forgets descriptors once they are closed
+static bool is_closed(u32) {
+    return false;
+}
+#else
+static short poll_mask(unsigned int events) {
+    short mask = 0;
+    if (events & AIO_READ)
+        mask |= POLLIN | POLLPRI;
+    if (events & AIO_WRITE)
+        mask |= POLLOUT;
+    return mask;
+}
+
+static unsigned int aio_mask(u32 revents) {
+    unsigned int events = 0;
+    if (revents & (POLLIN | POLLPRI))
+        events |= AIO_READ;
+    if (revents & POLLOUT)
+        events |= AIO_WRITE;
+    if (revents & (POLLERR | POLLHUP | POLLNVAL))
+        events |= AIO_ERROR;
+    return events;
+}
+
+static bool is_closed(u32 revents) {
+    return revents & POLLNVAL;
+}
+#endif
+
+// Descriptors are watched as they are, so that closing them has the usual
+// effect on their peers. Where poll() is used, closed descriptors report
+// POLLNVAL: their handler is invoked one last time and the registration is
+// dropped. epoll forgets closed descriptors silently instead, so fd_close
+// reports them; descriptors closed otherwise are only dropped once their
+// number gets registered again. Descriptors epoll refuses to watch, such as
+// regular files, are always ready, just like poll() reports them.
 class aio
 {
 private:
+    struct aio_entry {
+        u32 serial;
+        struct stat st;
+        unsigned int events;
+        unsigned int flags;
+        bool busy;
+        bool unwatched;
+        aio_event_handler handler;
+    };
+
+    struct aio_job {
+        int fd;
+        u32 serial;
+        unsigned int events;
+        bool rearm;
+        aio_event_handler handler;
+    };
+
+    // last invocation of a handler whose descriptor is being closed, which
+    // is done once fd_close has actually closed it
+    struct aio_closed {
+        aio_job job;
+        bool worker;
+        bool done;
+    };
+
     mutable mutex m_mtx;
-    unordered_map<int, aio_handler> m_handlers;
+    unordered_map<int, aio_entry> m_handlers;
+    vector<aio_closed> m_closed;
+    u32 m_serial;
+
+    int m_poll;
+    int m_wakeup[2];
+#ifdef MWR_LINUX
+    set<int> m_unwatched;
+#else
     atomic<u64> m_gen;
+    u64 m_curgen;
+    vector<struct pollfd> m_polls;
+    vector<u64> m_keys;
+#endif
 
     atomic<bool> m_running;
     thread m_thread;
 
-    static const int TIMEOUT_MS = 10;
+    mutex m_poolmtx;
+    mutex m_jobmtx;
+    condition_variable m_jobcv;
+    deque<aio_job> m_jobs;
+    vector<thread> m_workers;
+    size_t m_nworkers;
+    atomic<bool> m_started;
+    bool m_stopping;
+
+    // event keys combine descriptor and serial, so that events from a stale
+    // registration of a reused descriptor number are never misattributed
+    static const u64 WAKEUP_KEY = ~0ull;
+
+    static u64 make_key(int fd, u32 serial) {
+        return (u64)serial << 32 | (u32)fd;
+    }
+
+    void wakeup() {
+        u64 one = 1;
+#ifdef MWR_LINUX
+        ssize_t r = write(m_wakeup[1], &one, sizeof(one));
+#else
+        ssize_t r = write(m_wakeup[1], &one, 1);
+#endif
+        (void)r;
+    }
+
+    void drain() {
+        u64 buf[8];
+        while (read(m_wakeup[0], buf, sizeof(buf)) > 0) {
+            // eventfd resets on read, pipes need to be emptied
+        }
+    }
+
+    // returns false with errno set if the descriptor cannot be watched
+    bool arm_locked(int fd, aio_entry& entry, bool add) {
+#ifdef MWR_LINUX
+        if (!entry.unwatched) {
+            epoll_event ev{};
+            ev.events = epoll_mask(entry.events, entry.flags);
+            ev.data.u64 = make_key(fd, entry.serial);
+            int op = add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+            if (epoll_ctl(m_poll, op, fd, &ev) == 0)
+                return true;
+            if (!add || errno != EPERM)
+                return false;
+
+            entry.unwatched = true;
+            m_unwatched.insert(fd);
+        }
+
+        // always ready, the aio thread picks it up on its next round
+        wakeup();
+        return true;
+#else
+        m_gen++;
+        wakeup();
+        return true;
+#endif
+    }
+
+    void remove_locked(unordered_map<int, aio_entry>::iterator it) {
+#ifdef MWR_LINUX
+        // fails if the descriptor has been closed already, which is fine
+        if (it->second.unwatched)
+            m_unwatched.erase(it->first);
+        else
+            epoll_ctl(m_poll, EPOLL_CTL_DEL, it->first, nullptr);
+#else
+        m_gen++;
+        wakeup();
+#endif
+        m_handlers.erase(it);
+    }
+
+#ifdef MWR_LINUX
+    void wait_events(vector<pair<u64, u32>>& events) {
+        {
+            lock_guard<mutex> guard(m_mtx);
+            for (int fd : m_unwatched) {
+                const aio_entry& entry = m_handlers.at(fd);
+                if (!entry.busy) {
+                    u32 mask = epoll_mask(entry.events, 0);
+                    events.emplace_back(make_key(fd, entry.serial), mask);
+                }
+            }
+        }
+
+        // only look for other events if nothing is ready already
+        epoll_event epevents[64];
+        int timeout = events.empty() ? -1 : 0;
+        int ret = epoll_wait(m_poll, epevents, 64, timeout);
+        if (ret < 0 && errno == EINTR)
+            return;
+
+        MWR_ERROR_ON(ret < 0, "aio error: %s", strerror(errno));
+        for (int i = 0; i < ret; i++) {
+            u64 key = epevents[i].data.u64;
+            u32 revents = epevents[i].events;
+            if (key == WAKEUP_KEY)
+                drain();
+            else
+                events.emplace_back(key, revents);
+        }
+    }
+#else
+    void wait_events(vector<pair<u64, u32>>& events) {
+        if (m_curgen != m_gen) {
+            lock_guard<mutex> guard(m_mtx);
+            m_polls.assign(1, { m_wakeup[0], POLLIN, 0 });
+            m_keys.assign(1, WAKEUP_KEY);
+            for (const auto& [fd, entry] : m_handlers) {
+                if (entry.busy)
+                    continue;
+                short mask = poll_mask(entry.events);
+                m_polls.push_back({ fd, mask, 0 });
+                m_keys.push_back(make_key(fd, entry.serial));
+            }
+
+            m_curgen = m_gen;
+        }
+
+        int ret = ::poll(m_polls.data(), m_polls.size(), -1);
+        if (ret < 0 && errno == EINTR)
+            return;
+
+        MWR_ERROR_ON(ret < 0, "aio error: %s", strerror(errno));
+        for (size_t i = 0; i < m_polls.size(); i++) {
+            if (!m_polls[i].revents)
+                continue;
+            if (m_keys[i] == WAKEUP_KEY)
+                drain();
+            else
+                events.emplace_back(m_keys[i], m_polls[i].revents);
+        }
+    }
+#endif
+
+    void run(aio_job& job) {
+        job.handler(job.fd, job.events);
+        if (!job.rearm)
+            return;
+
+        lock_guard<mutex> guard(m_mtx);
+        auto it = m_handlers.find(job.fd);
+        if (it == m_handlers.end() || it->second.serial != job.serial)
+            return; // cancelled while the handler was running
+
+        // the descriptor was closed while the handler was running
+        it->second.busy = false;
+        if (!arm_locked(job.fd, it->second, false))
+            m_handlers.erase(it);
+    }
 
     void aio_thread() {
         set_thread_name("aio_thread");
-        vector<struct pollfd> polls;
-        u64 curgen = 0;
-        int ret = 0;
+        vector<pair<u64, u32>> events;
 
         while (m_running) {
-            if (curgen != m_gen) {
-                polls.clear();
+            events.clear();
+            wait_events(events);
+            if (!m_running)
+                break;
 
+            vector<aio_job> scheduled;
+            vector<aio_job> offloaded;
+            {
                 lock_guard<mutex> guard(m_mtx);
-                for (const auto& it : m_handlers)
-                    polls.push_back({ it.first, POLLIN | POLLPRI, 0 });
+                for (const auto& [key, revents] : events) {
+                    int fd = (int)(u32)key;
+                    auto it = m_handlers.find(fd);
+                    if (it == m_handlers.end() ||
+                        it->second.serial != (u32)(key >> 32) ||
+                        it->second.busy) {
+                        continue; // fd has been removed
+                    }
+
+                    aio_entry& entry = it->second;
+                    bool worker = entry.flags & AIO_WORKER;
+                    aio_job job{ fd, entry.serial, aio_mask(revents), false,
+                                 entry.handler };
+
+                    if (is_closed(revents) || (entry.flags & AIO_ONESHOT)) {
+                        remove_locked(it);
+                    } else if (worker) {
+                        entry.busy = true;
+                        job.rearm = true;
+#ifndef MWR_LINUX
+                        m_gen++;
+#endif
+                    }
+
+                    if (worker)
+                        offloaded.push_back(std::move(job));
+                    else
+                        scheduled.push_back(std::move(job));
+                }
+
+                for (auto it = m_closed.begin(); it != m_closed.end();) {
+                    if (!it->done) {
+                        it++;
+                        continue;
+                    }
 
-                curgen = m_gen;
+                    if (it->worker)
+                        offloaded.push_back(std::move(it->job));
+                    else
+                        scheduled.push_back(std::move(it->job));
+                    it = m_closed.erase(it);
+                }
             }
 
-            if (polls.empty()) {
-                auto timeout = std::chrono::milliseconds(TIMEOUT_MS);
-                std::this_thread::sleep_for(timeout);
-                continue;
+            // without a running pool, worker handlers are run inline
+            if (!offloaded.empty()) {
+                lock_guard<mutex> guard(m_jobmtx);
+                for (aio_job& job : offloaded) {
+                    if (m_workers.empty() || m_stopping)
+                        scheduled.push_back(std::move(job));
+                    else
+                        m_jobs.push_back(std::move(job));
+                }
+
+                m_jobcv.notify_all();
             }
 
-            do {
-                ret = poll(polls.data(), polls.size(), TIMEOUT_MS);
-            } while (ret < 0 && errno == EINTR);
-            MWR_ERROR_ON(ret < 0, "aio error: %s", strerror(errno));
-            vector<pair<int, aio_handler>> scheduled;
+            for (aio_job& job : scheduled)
+                run(job);
+        }
+    }
 
-            if (ret > 0 && m_running) {
-                lock_guard<mutex> guard(m_mtx);
-                for (const auto& pfd : polls) {
-                    if (m_handlers.count(pfd.fd) == 0)
-                        continue; // fd has been removed
+    void worker_thread() {
+        set_thread_name("aio_worker");
+        while (true) {
+            aio_job job;
+            {
+                std::unique_lock<mutex> lock(m_jobmtx);
+                m_jobcv.wait(lock,
+                             [&] { return m_stopping || !m_jobs.empty(); });
+                if (m_jobs.empty())
+                    return; // only stop once all pending jobs are done
 
-                    if (pfd.revents)
-                        scheduled.emplace_back(pfd.fd, m_handlers[pfd.fd]);
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
 
-                    if (pfd.revents & POLLNVAL)
-                        m_handlers.erase(pfd.fd);
-                }
+            run(job);
+        }
+    }
+
+    void stop_workers() {
+        {
+            lock_guard<mutex> guard(m_jobmtx);
+            m_stopping = true;
+        }
+
+        m_jobcv.notify_all();
+        for (thread& worker : m_workers)
+            worker.join();
+
+        lock_guard<mutex> guard(m_jobmtx);
+        m_workers.clear();
+        m_stopping = false;
+    }
+
+    void start_workers(size_t n) {
+        lock_guard<mutex> guard(m_jobmtx);
+        for (size_t i = 0; i < n; i++)
+            m_workers.emplace_back(&aio::worker_thread, this);
+    }
+
+    // called by fd_close, the registration is dropped while the descriptor
+    // is still open and its handler runs one last time once it is closed
+    void closing(int fd, bool closed) {
+        lock_guard<mutex> guard(m_mtx);
+        if (closed) {
+            bool found = false;
+            for (aio_closed& entry : m_closed) {
+                if (entry.job.fd == fd && !entry.done)
+                    entry.done = found = true;
             }
 
-            for (const auto& handler : scheduled)
-                handler.second(handler.first);
+            if (found)
+                wakeup();
+            return;
         }
+
+        auto it = m_handlers.find(fd);
+        if (it == m_handlers.end())
+            return;
+
+        const aio_entry& entry = it->second;
+        aio_job job{ fd, entry.serial, AIO_ERROR, false, entry.handler };
+        bool worker = entry.flags & AIO_WORKER;
+        m_closed.push_back({ std::move(job), worker, false });
+        remove_locked(it);
+    }
+
+    static void close_hook(int fd, bool closed) {
+        instance().closing(fd, closed);
     }
 
 public:
-    aio(): m_mtx(), m_handlers(), m_gen(), m_running(true), m_thread() {
+    aio():
+        m_mtx(),
+        m_handlers(),
+        m_closed(),
+        m_serial(0),
+        m_poll(-1),
+        m_wakeup{ -1, -1 },
+#ifdef MWR_LINUX
+        m_unwatched(),
+#else
+        m_gen(1),
+        m_curgen(0),
+        m_polls(),
+        m_keys(),
+#endif
+        m_running(true),
+        m_thread(),
+        m_poolmtx(),
+        m_jobmtx(),
+        m_jobcv(),
+        m_jobs(),
+        m_workers(),
+        m_nworkers(max<size_t>(thread::hardware_concurrency(), 1)),
+        m_started(false),
+        m_stopping(false) {
+#ifdef MWR_LINUX
+        m_poll = epoll_create1(EPOLL_CLOEXEC);
+        MWR_ERROR_ON(m_poll < 0, "aio error: %s", strerror(errno));
+        m_wakeup[0] = m_wakeup[1] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        MWR_ERROR_ON(m_wakeup[0] < 0, "aio error: %s", strerror(errno));
+
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u64 = WAKEUP_KEY;
+        if (epoll_ctl(m_poll, EPOLL_CTL_ADD, m_wakeup[0], &ev) < 0)
+            MWR_ERROR("aio error: %s", strerror(errno));
+#else
+        if (pipe(m_wakeup) < 0)
+            MWR_ERROR("aio error: %s", strerror(errno));
+        for (int fd : m_wakeup) {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        }
+#endif
+
         m_thread = thread(&aio::aio_thread, this);
+        fd_set_close_hook(&aio::close_hook);
     }
 
     virtual ~aio() {
+        fd_set_close_hook(nullptr);
         m_running = false;
+        wakeup();
         if (m_thread.joinable())
             m_thread.join();
+
+        stop_workers();
+
+        close(m_wakeup[0]);
+        if (m_wakeup[1] != m_wakeup[0])
+            close(m_wakeup[1]);
+        if (m_poll >= 0)
+            close(m_poll);
     }
 
-    void notify(int fd, aio_handler handler) {
+    void notify(int fd, unsigned int events, aio_event_handler handler,
+                unsigned int flags) {
+        struct stat st;
+        if (fstat(fd, &st) < 0)
+            MWR_ERROR("invalid file descriptor: %d", fd);
+
+        if ((flags & AIO_WORKER) && !m_started) {
+            lock_guard<mutex> guard(m_poolmtx);
+            if (!m_started)
+                start_workers(m_nworkers);
+            m_started = true;
+        }
+
         lock_guard<mutex> guard(m_mtx);
-        m_handlers[fd] = std::move(handler);
-        m_gen++;
+        auto it = m_handlers.find(fd);
+        if (it != m_handlers.end()) {
+            // an entry for another file means the descriptor number was
+            // closed and reused without cancelling it first
+            aio_entry& entry = it->second;
+            if (same_file(entry.st, st)) {
+                entry.events = events;
+                entry.flags = flags;
+                entry.handler = std::move(handler);
+                if (entry.busy || arm_locked(fd, entry, false))
+                    return;
+                if (errno != ENOENT)
+                    MWR_ERROR("aio error: %s", strerror(errno));
+            }
+
+            remove_locked(it);
+        }
+
+        aio_entry& entry = m_handlers[fd];
+        entry = { ++m_serial, st, events, flags, false, false,
+                  std::move(handler) };
+        if (!arm_locked(fd, entry, true))
+            MWR_ERROR("aio error: %s", strerror(errno));
     }
 
     void cancel(int fd) {
         lock_guard<mutex> guard(m_mtx);
-        m_handlers.erase(fd);
-        m_gen++;
+        auto it = m_handlers.find(fd);
+        if (it != m_handlers.end())
+            remove_locked(it);
+    }
+
+    size_t workers() {
+        lock_guard<mutex> guard(m_poolmtx);
+        return m_nworkers;
+    }
+
+    void set_workers(size_t n) {
+        lock_guard<mutex> guard(m_poolmtx);
+        if (m_started)
+            stop_workers();
+
+        m_nworkers = n;
+        if (m_started)
+            start_workers(n);
     }
 
     static aio& instance() {
@@ -109,11 +578,28 @@ public:
 };
 
 void aio_notify(int fd, aio_handler handler) {
-    aio::instance().notify(fd, std::move(handler));
+    auto fn = [handler = std::move(handler)](int fd, unsigned int) {
+        handler(fd);
+    };
+
+    aio::instance().notify(fd, AIO_READ, std::move(fn), AIO_PERSISTENT);
+}
+
+void aio_notify(int fd, unsigned int events, aio_event_handler handler,
+                unsigned int flags) {
+    aio::instance().notify(fd, events, std::move(handler), flags);
 }
 
 void aio_cancel(int fd) {
     aio::instance().cancel(fd);
 }
 
+size_t aio_workers() {
+    return aio::instance().workers();
+}
+
+void aio_set_workers(size_t n) {
+    aio::instance().set_workers(n);
+}
+
 } // namespace mwr
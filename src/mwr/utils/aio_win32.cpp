@@ -39,7 +39,8 @@ class aio
 private:
     struct aio_info {
         int fd;
-        aio_handler handler;
+        unsigned int flags;
+        aio_event_handler handler;
     };
 
     mutable mutex m_mtx;
@@ -89,8 +90,13 @@ private:
                         continue; // fd has been removed
 
                     auto& triggered = m_handlers[handle];
-                    if (fd_peek(triggered.fd))
+                    if (fd_peek(triggered.fd)) {
                         scheduled.push_back(triggered);
+                        if (triggered.flags & AIO_ONESHOT) {
+                            m_handlers.erase(handle);
+                            m_gen++;
+                        }
+                    }
                 }
 
                 if (ret == WAIT_FAILED) {
@@ -121,7 +127,7 @@ private:
 #endif
 
                 for (const auto& handler : scheduled)
-                    handler.handler(handler.fd);
+                    handler.handler(handler.fd, AIO_READ);
             }
         }
     }
@@ -138,12 +144,19 @@ public:
             m_thread.join();
     }
 
-    void notify(int fd, aio_handler handler) {
+    // handles only signal readability here, worker handlers are run on the
+    // aio thread just like all others
+    void notify(int fd, unsigned int events, aio_event_handler handler,
+                unsigned int flags) {
+        if (events & AIO_WRITE)
+            MWR_ERROR("aio write notifications not supported: %d", fd);
+
         lock_guard<mutex> guard(m_mtx);
         HANDLE handle = (HANDLE)_get_osfhandle(fd);
         if (handle == INVALID_HANDLE_VALUE)
             MWR_ERROR("invalid file descriptor: %d", fd);
         m_handlers[handle].fd = fd;
+        m_handlers[handle].flags = flags;
         m_handlers[handle].handler = std::move(handler);
         m_gen++;
     }
@@ -163,12 +176,31 @@ public:
     }
 };
 
+static atomic<size_t> g_workers(1);
+
 void aio_notify(int fd, aio_handler handler) {
-    aio::instance().notify(fd, std::move(handler));
+    auto fn = [handler = std::move(handler)](int fd, unsigned int) {
+        handler(fd);
+    };
+
+    aio::instance().notify(fd, AIO_READ, std::move(fn), AIO_PERSISTENT);
+}
+
+void aio_notify(int fd, unsigned int events, aio_event_handler handler,
+                unsigned int flags) {
+    aio::instance().notify(fd, events, std::move(handler), flags);
 }
 
 void aio_cancel(int fd) {
     aio::instance().cancel(fd);
 }
 
+size_t aio_workers() {
+    return g_workers;
+}
+
+void aio_set_workers(size_t n) {
+    g_workers = n;
+}
+
 } // namespace mwr
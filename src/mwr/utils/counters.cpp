@@ -0,0 +1,174 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#include "mwr/utils/counters.h"
+
+namespace mwr {
+
+sharded_stat::sharded_stat(const string& name): m_name(name) {
+    // nothing to do
+}
+
+void sharded_stat::register_stat() {
+    if (!m_name.empty())
+        stat_registry::instance().add(this);
+}
+
+void sharded_stat::unregister_stat() {
+    if (!m_name.empty())
+        stat_registry::instance().remove(this);
+}
+
+sharded_counter::sharded_counter(const string& name):
+    sharded_stat(name),
+    m_retired(),
+    m_shards(nullptr, [this](stat_shard<1>& s) { m_retired.fold(s); }) {
+    register_stat();
+}
+
+sharded_counter::~sharded_counter() {
+    unregister_stat();
+}
+
+u64 sharded_counter::sum() const {
+    lock_guard<const per_thread_local<stat_shard<1>>> guard(m_shards);
+    u64 total = m_retired.get(0);
+    m_shards.for_each([&](const stat_shard<1>& s) { total += s.get(0); });
+    return total;
+}
+
+void sharded_counter::reset() {
+    lock_guard<per_thread_local<stat_shard<1>>> guard(m_shards);
+    m_retired.reset();
+    m_shards.for_each([](stat_shard<1>& s) { s.reset(); });
+}
+
+void sharded_counter::print(ostream& os) const {
+    os << sum();
+}
+
+u64 histogram_snapshot::percentile(double p) const {
+    if (count == 0)
+        return 0;
+
+    u64 rank = (u64)(p * (count - 1));
+    u64 seen = 0;
+    for (size_t b = 0; b < NUM_BUCKETS; b++) {
+        seen += buckets[b];
+        if (seen > rank)
+            return bitmask(b);
+    }
+
+    return bitmask(NUM_BUCKETS - 1);
+}
+
+sharded_histogram::sharded_histogram(const string& name):
+    sharded_stat(name),
+    m_retired(),
+    m_shards(nullptr, [this](stat_shard<SUM + 1>& s) { m_retired.fold(s); }) {
+    register_stat();
+}
+
+sharded_histogram::~sharded_histogram() {
+    unregister_stat();
+}
+
+histogram_snapshot sharded_histogram::snapshot() const {
+    histogram_snapshot snap{};
+    auto add = [&](const stat_shard<SUM + 1>& s) {
+        for (size_t b = 0; b < histogram_snapshot::NUM_BUCKETS; b++)
+            snap.buckets[b] += s.get(b);
+        snap.count += s.get(COUNT);
+        snap.sum += s.get(SUM);
+    };
+
+    lock_guard<const per_thread_local<stat_shard<SUM + 1>>> guard(m_shards);
+    add(m_retired);
+    m_shards.for_each(add);
+    return snap;
+}
+
+void sharded_histogram::reset() {
+    lock_guard<per_thread_local<stat_shard<SUM + 1>>> guard(m_shards);
+    m_retired.reset();
+    m_shards.for_each([](stat_shard<SUM + 1>& s) { s.reset(); });
+}
+
+void sharded_histogram::print(ostream& os) const {
+    histogram_snapshot snap = snapshot();
+    os << "count=" << snap.count << " sum=" << snap.sum
+       << mkstr(" mean=%.1f", snap.mean()) << " p50<=" << snap.percentile(0.5)
+       << " p99<=" << snap.percentile(0.99);
+}
+
+void stat_registry::add(sharded_stat* stat) {
+    lock_guard<mutex> guard(m_mtx);
+    MWR_REPORT_ON(stl_contains(m_stats, stat->name()),
+                  "statistic %s already registered", stat->name().c_str());
+    m_stats[stat->name()] = stat;
+}
+
+void stat_registry::remove(sharded_stat* stat) {
+    lock_guard<mutex> guard(m_mtx);
+    auto it = m_stats.find(stat->name());
+    if (it != m_stats.end() && it->second == stat)
+        m_stats.erase(it);
+}
+
+stat_registry& stat_registry::instance() {
+    static stat_registry singleton;
+    return singleton;
+}
+
+size_t stat_registry::count() {
+    stat_registry& reg = instance();
+    lock_guard<mutex> guard(reg.m_mtx);
+    return reg.m_stats.size();
+}
+
+vector<sharded_stat*> stat_registry::all() {
+    stat_registry& reg = instance();
+    lock_guard<mutex> guard(reg.m_mtx);
+    vector<sharded_stat*> stats;
+    for (const auto& it : reg.m_stats)
+        stats.push_back(it.second);
+    return stats;
+}
+
+sharded_stat* stat_registry::find(const string& name) {
+    stat_registry& reg = instance();
+    lock_guard<mutex> guard(reg.m_mtx);
+    auto it = reg.m_stats.find(name);
+    return it != reg.m_stats.end() ? it->second : nullptr;
+}
+
+void stat_registry::reset_all() {
+    stat_registry& reg = instance();
+    lock_guard<mutex> guard(reg.m_mtx);
+    for (const auto& it : reg.m_stats)
+        it.second->reset();
+}
+
+void stat_registry::print(ostream& os) {
+    stat_registry& reg = instance();
+    lock_guard<mutex> guard(reg.m_mtx);
+
+    size_t w = 0;
+    for (const auto& it : reg.m_stats)
+        w = max(w, it.first.length());
+
+    for (const auto& it : reg.m_stats) {
+        os << pad(it.first, w + 1);
+        it.second->print(os);
+        os << std::endl;
+    }
+}
+
+} // namespace mwr
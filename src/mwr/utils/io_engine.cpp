@@ -0,0 +1,661 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#include "mwr/utils/io_engine.h"
+#include "mwr/core/utils.h"
+
+#include <deque>
+#include <initializer_list>
+#include <vector>
+#include <thread>
+#include <errno.h>
+
+#ifndef MWR_WINDOWS
+#include <unistd.h>
+#include <sys/socket.h>
+#endif
+
+#if defined(MWR_LINUX) && __has_include(<linux/io_uring.h>)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define MWR_IO_URING
+#endif
+#endif
+
+namespace mwr {
+
+static bool g_no_io_uring = []() {
+    return getenv_or_default("MWR_NO_IO_URING", false);
+}();
+
+#ifdef MWR_IO_URING
+
+static int io_uring_setup(unsigned int entries, io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit,
+                          unsigned int min_complete, unsigned int flags) {
+    int ret;
+    do {
+        ret = (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                           flags, nullptr, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+static int io_uring_register(int fd, unsigned int opcode, const void* arg,
+                             unsigned int nr) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr);
+}
+
+template <typename T>
+static T* ring_ptr(void* base, u32 offset) {
+    return reinterpret_cast<T*>((u8*)base + offset);
+}
+
+struct io_engine::ring {
+    int fd;
+
+    void* sq_ptr;
+    size_t sq_size;
+    void* cq_ptr;
+    size_t cq_size;
+    io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    u32* sq_head;
+    u32* sq_tail;
+    u32* sq_array;
+    u32 sq_mask;
+    u32 sq_entries;
+
+    u32* cq_head;
+    u32* cq_tail;
+    io_uring_cqe* cqes;
+    u32 cq_mask;
+
+    u32 tail;      // sqes filled in by us
+    u32 submitted; // sqes handed to the kernel
+
+    // timespecs are only read by the kernel when the sqe is submitted
+    std::deque<__kernel_timespec> timespecs;
+
+    ring(): fd(-1), sq_ptr(MAP_FAILED), sq_size(), cq_ptr(MAP_FAILED),
+        cq_size(), sqes((io_uring_sqe*)MAP_FAILED), sqes_size(), sq_head(),
+        sq_tail(), sq_array(), sq_mask(), sq_entries(), cq_head(), cq_tail(),
+        cqes(), cq_mask(), tail(), submitted(), timespecs() {}
+
+    ~ring() {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqes_size);
+        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+            munmap(cq_ptr, cq_size);
+        if (sq_ptr != MAP_FAILED)
+            munmap(sq_ptr, sq_size);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool setup(unsigned int entries) {
+        io_uring_params p{};
+        fd = io_uring_setup(entries, &p);
+        if (fd < 0)
+            return false;
+
+        sq_size = p.sq_off.array + p.sq_entries * sizeof(u32);
+        cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single)
+            sq_size = cq_size = max(sq_size, cq_size);
+
+        const int prot = PROT_READ | PROT_WRITE;
+        const int flags = MAP_SHARED | MAP_POPULATE;
+        sq_ptr = mmap(nullptr, sq_size, prot, flags, fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED)
+            return false;
+
+        cq_ptr = single ? sq_ptr
+                        : mmap(nullptr, cq_size, prot, flags, fd,
+                               IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED)
+            return false;
+
+        sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)mmap(nullptr, sqes_size, prot, flags, fd,
+                                   IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+            return false;
+
+        sq_head = ring_ptr<u32>(sq_ptr, p.sq_off.head);
+        sq_tail = ring_ptr<u32>(sq_ptr, p.sq_off.tail);
+        sq_array = ring_ptr<u32>(sq_ptr, p.sq_off.array);
+        sq_mask = *ring_ptr<u32>(sq_ptr, p.sq_off.ring_mask);
+        sq_entries = *ring_ptr<u32>(sq_ptr, p.sq_off.ring_entries);
+
+        cq_head = ring_ptr<u32>(cq_ptr, p.cq_off.head);
+        cq_tail = ring_ptr<u32>(cq_ptr, p.cq_off.tail);
+        cqes = ring_ptr<io_uring_cqe>(cq_ptr, p.cq_off.cqes);
+        cq_mask = *ring_ptr<u32>(cq_ptr, p.cq_off.ring_mask);
+
+        tail = submitted = *sq_tail;
+        return true;
+    }
+
+    // older kernels accept the ring, but reject opcodes they do not know
+    // only once they are submitted, so ask upfront what the ring can do
+    bool supports(std::initializer_list<u8> opcodes) const {
+        const size_t nops = 256;
+        std::vector<u8> buf(sizeof(io_uring_probe) +
+                            nops * sizeof(io_uring_probe_op));
+        io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(buf.data());
+        if (io_uring_register(fd, IORING_REGISTER_PROBE, probe, nops) < 0)
+            return false;
+
+        for (u8 op : opcodes) {
+            if (op > probe->last_op || op >= probe->ops_len)
+                return false;
+            if (!(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+                return false;
+        }
+
+        return true;
+    }
+
+    io_uring_sqe* next_sqe() {
+        u32 head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head >= sq_entries)
+            return nullptr;
+
+        u32 idx = tail++ & sq_mask;
+        sq_array[idx] = idx;
+        io_uring_sqe* sqe = sqes + idx;
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    size_t submit() {
+        u32 n = tail - submitted;
+        if (n == 0)
+            return 0;
+
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+        int ret = io_uring_enter(fd, n, 0, 0);
+        if (ret < 0)
+            MWR_REPORT("io_uring_enter failed: %s", strerror(errno));
+
+        submitted += ret;
+        if (submitted == tail)
+            timespecs.clear();
+        return ret;
+    }
+
+    void wait() {
+        if (io_uring_enter(fd, 0, 1, IORING_ENTER_GETEVENTS) < 0)
+            MWR_REPORT("io_uring_enter failed: %s", strerror(errno));
+    }
+};
+
+#else
+
+struct io_engine::ring {
+    // io_uring is not available on this host
+};
+
+#endif
+
+io_engine::io_engine(size_t depth): io_engine(depth, !g_no_io_uring) {
+    // nothing to do
+}
+
+io_engine::io_engine(size_t depth, bool use_uring):
+    m_depth(depth),
+    m_pending(0),
+    m_ring(),
+    m_buffers(),
+    m_files(),
+    m_next_id(0),
+    m_inflight(),
+    m_queue(),
+    m_done() {
+    MWR_ERROR_ON(depth == 0, "io_engine depth cannot be zero");
+    if (use_uring)
+        uring_setup();
+}
+
+io_engine::~io_engine() {
+    // closing the ring alone would cancel operations asynchronously, so the
+    // kernel could still write into buffers after we are gone
+    if (m_ring && !m_inflight.empty()) {
+        try {
+            uring_cancel_all();
+        } catch (...) {
+            // nothing left to do, the ring is closed anyway
+        }
+    }
+}
+
+void io_engine::queue(operation&& op) {
+    m_pending++;
+    if (!m_ring) {
+        m_queue.push_back(std::move(op));
+        return;
+    }
+
+    u64 id = m_next_id++;
+    auto it = m_inflight.emplace(id, std::move(op)).first;
+    uring_queue(id, it->second);
+}
+
+void io_engine::read(int fd, void* buf, size_t len, u64 offset,
+                     callback cb) {
+    queue({ OP_READ, fd, buf, len, offset, 0, 0, std::move(cb) });
+}
+
+void io_engine::write(int fd, const void* buf, size_t len, u64 offset,
+                      callback cb) {
+    queue({ OP_WRITE, fd, (void*)buf, len, offset, 0, 0, std::move(cb) });
+}
+
+void io_engine::accept(int fd, callback cb) {
+    queue({ OP_ACCEPT, fd, nullptr, 0, 0, 0, 0, std::move(cb) });
+}
+
+void io_engine::timeout(u64 ns, callback cb) {
+    queue({ OP_TIMEOUT, -1, nullptr, 0, ns, 0, 0, std::move(cb) });
+}
+
+static bool is_within(const iovec& iov, const void* buf, size_t len) {
+    const u8* base = (const u8*)iov.iov_base;
+    const u8* ptr = (const u8*)buf;
+    return ptr >= base && len <= iov.iov_len &&
+           (size_t)(ptr - base) <= iov.iov_len - len;
+}
+
+void io_engine::read_fixed(int fd, size_t idx, void* buf, size_t len,
+                           u64 offset, callback cb) {
+    MWR_REPORT_ON(idx >= m_buffers.size(), "invalid buffer index %zu", idx);
+    MWR_REPORT_ON(!is_within(m_buffers[idx], buf, len),
+                  "memory outside of registered buffer %zu", idx);
+    queue({ OP_READ_FIXED, fd, buf, len, offset, idx, 0, std::move(cb) });
+}
+
+void io_engine::write_fixed(int fd, size_t idx, const void* buf, size_t len,
+                            u64 offset, callback cb) {
+    MWR_REPORT_ON(idx >= m_buffers.size(), "invalid buffer index %zu", idx);
+    MWR_REPORT_ON(!is_within(m_buffers[idx], buf, len),
+                  "memory outside of registered buffer %zu", idx);
+    queue({ OP_WRITE_FIXED, fd, (void*)buf, len, offset, idx, 0,
+            std::move(cb) });
+}
+
+void io_engine::register_buffers(const vector<iovec>& buffers) {
+    MWR_REPORT_ON(!m_buffers.empty(), "buffers already registered");
+    MWR_REPORT_ON(buffers.empty(), "no buffers to register");
+#ifdef MWR_IO_URING
+    if (m_ring && io_uring_register(m_ring->fd, IORING_REGISTER_BUFFERS,
+                                    buffers.data(), buffers.size()) < 0) {
+        MWR_REPORT("failed to register io buffers: %s", strerror(errno));
+    }
+#endif
+    m_buffers = buffers;
+}
+
+void io_engine::unregister_buffers() {
+    if (m_buffers.empty())
+        return;
+
+    auto is_fixed = [](const operation& op) {
+        return op.type == OP_READ_FIXED || op.type == OP_WRITE_FIXED;
+    };
+
+    bool busy = false;
+    for (const auto& [id, op] : m_inflight)
+        busy |= is_fixed(op);
+    for (const operation& op : m_queue)
+        busy |= is_fixed(op);
+    MWR_REPORT_ON(busy, "cannot unregister io buffers still in use");
+#ifdef MWR_IO_URING
+    if (m_ring && io_uring_register(m_ring->fd, IORING_UNREGISTER_BUFFERS,
+                                    nullptr, 0) < 0) {
+        MWR_REPORT("failed to unregister io buffers: %s", strerror(errno));
+    }
+#endif
+    m_buffers.clear();
+}
+
+void io_engine::register_files(const vector<int>& fds) {
+    MWR_REPORT_ON(!m_files.empty(), "files already registered");
+    MWR_REPORT_ON(fds.empty(), "no files to register");
+#ifdef MWR_IO_URING
+    if (m_ring && io_uring_register(m_ring->fd, IORING_REGISTER_FILES,
+                                    fds.data(), fds.size()) < 0) {
+        MWR_REPORT("failed to register io files: %s", strerror(errno));
+    }
+#endif
+    for (size_t i = 0; i < fds.size(); i++)
+        m_files.emplace(fds[i], (unsigned int)i);
+}
+
+void io_engine::unregister_files() {
+    if (m_files.empty())
+        return;
+#ifdef MWR_IO_URING
+    if (m_ring && io_uring_register(m_ring->fd, IORING_UNREGISTER_FILES,
+                                    nullptr, 0) < 0) {
+        MWR_REPORT("failed to unregister io files: %s", strerror(errno));
+    }
+#endif
+    m_files.clear();
+}
+
+size_t io_engine::submit() {
+    if (m_ring)
+        return uring_submit();
+
+    size_t n = m_queue.size();
+    vector<operation> ops;
+    ops.swap(m_queue);
+    for (operation& op : ops) {
+        if (op.type == OP_TIMEOUT) {
+            op.deadline = timestamp_ns() + op.offset;
+            m_inflight.emplace(m_next_id++, std::move(op));
+        } else {
+            long long res = execute(op);
+            m_done.emplace_back(std::move(op), res);
+        }
+    }
+
+    return n;
+}
+
+size_t io_engine::complete(size_t min) {
+    min = std::min(min, m_pending);
+
+    size_t n = 0;
+    do {
+        submit();
+        size_t left = min > n ? min - n : 0;
+        n += m_ring ? uring_reap(left) : fallback_reap(left);
+    } while (n < min);
+
+    return n;
+}
+
+#ifdef MWR_IO_URING
+
+void io_engine::uring_setup() {
+    std::unique_ptr<ring> r(new ring());
+    if (!r->setup(m_depth))
+        return;
+
+    // stay synchronous unless everything uring_queue and uring_cancel_all
+    // may submit is available
+    if (!r->supports({ IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READ_FIXED,
+                       IORING_OP_WRITE_FIXED, IORING_OP_ACCEPT,
+                       IORING_OP_TIMEOUT, IORING_OP_TIMEOUT_REMOVE,
+                       IORING_OP_ASYNC_CANCEL })) {
+        return;
+    }
+
+    // the kernel may round up to the next power of two
+    m_depth = r->sq_entries;
+    m_ring = std::move(r);
+}
+
+void io_engine::uring_queue(u64 id, const operation& op) {
+    io_uring_sqe* sqe = m_ring->next_sqe();
+    if (!sqe) {
+        m_ring->submit();
+        sqe = m_ring->next_sqe();
+        MWR_ERROR_ON(!sqe, "io_uring submission queue full");
+    }
+
+    sqe->fd = op.fd;
+    sqe->user_data = id;
+
+    auto it = m_files.find(op.fd);
+    if (it != m_files.end() && op.type != OP_TIMEOUT) {
+        sqe->fd = (int)it->second;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+
+    switch (op.type) {
+    case OP_READ:
+    case OP_WRITE:
+    case OP_READ_FIXED:
+    case OP_WRITE_FIXED: {
+        static const u8 opcodes[] = {
+            IORING_OP_READ,
+            IORING_OP_WRITE,
+            IORING_OP_READ_FIXED,
+            IORING_OP_WRITE_FIXED,
+        };
+
+        sqe->opcode = opcodes[op.type];
+        sqe->addr = (u64)(uintptr_t)op.buf;
+        sqe->len = (u32)min<size_t>(op.len, U32_MAX);
+        sqe->off = op.offset;
+        sqe->buf_index = (u16)op.bufidx;
+        break;
+    }
+
+    case OP_ACCEPT:
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        break;
+
+    case OP_TIMEOUT: {
+        __kernel_timespec ts;
+        ts.tv_sec = op.offset / 1000000000ull;
+        ts.tv_nsec = op.offset % 1000000000ull;
+        m_ring->timespecs.push_back(ts);
+
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = (u64)(uintptr_t)&m_ring->timespecs.back();
+        sqe->len = 1;
+        break;
+    }
+
+    default:
+        MWR_ERROR("unknown io operation %d", (int)op.type);
+    }
+}
+
+size_t io_engine::uring_submit() {
+    return m_ring->submit();
+}
+
+size_t io_engine::uring_reap(size_t min) {
+    vector<std::pair<u64, long long>> results;
+
+    while (true) {
+        u32 head = *m_ring->cq_head;
+        u32 tail = __atomic_load_n(m_ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const io_uring_cqe& cqe = m_ring->cqes[head & m_ring->cq_mask];
+            results.emplace_back(cqe.user_data, cqe.res);
+        }
+
+        __atomic_store_n(m_ring->cq_head, head, __ATOMIC_RELEASE);
+        if (!results.empty() || min == 0)
+            break;
+
+        m_ring->wait();
+    }
+
+    // callbacks may queue further operations, so they run last
+    for (auto& res : results) {
+        auto it = m_inflight.find(res.first);
+        MWR_ERROR_ON(it == m_inflight.end(), "unknown io completion");
+        operation op = std::move(it->second);
+        m_inflight.erase(it);
+        m_pending--;
+
+        long long ret = res.second;
+        if (op.type == OP_TIMEOUT && ret == -ETIME)
+            ret = 0;
+        if (op.cb)
+            op.cb(ret);
+    }
+
+    return results.size();
+}
+
+// cancels all operations still in flight and waits until they are done,
+// without running their callbacks
+void io_engine::uring_cancel_all() {
+    const u64 cancel_id = ~0ull;
+
+    for (const auto& [id, op] : m_inflight) {
+        io_uring_sqe* sqe = m_ring->next_sqe();
+        if (!sqe) {
+            m_ring->submit();
+            sqe = m_ring->next_sqe();
+            MWR_ERROR_ON(!sqe, "io_uring submission queue full");
+        }
+
+        sqe->opcode = op.type == OP_TIMEOUT ? IORING_OP_TIMEOUT_REMOVE
+                                            : IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = id;
+        sqe->user_data = cancel_id;
+    }
+
+    m_ring->submit();
+
+    // operations that cannot be cancelled anymore run to completion
+    while (!m_inflight.empty()) {
+        u32 head = *m_ring->cq_head;
+        u32 tail = __atomic_load_n(m_ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const io_uring_cqe& cqe = m_ring->cqes[head & m_ring->cq_mask];
+            if (cqe.user_data != cancel_id && m_inflight.erase(cqe.user_data))
+                m_pending--;
+        }
+
+        __atomic_store_n(m_ring->cq_head, head, __ATOMIC_RELEASE);
+        if (!m_inflight.empty())
+            m_ring->wait();
+    }
+}
+
+#else
+
+void io_engine::uring_setup() {
+    // io_uring is not available on this host
+}
+
+void io_engine::uring_queue(u64 id, const operation& op) {
+    MWR_ERROR("io_uring not supported");
+}
+
+size_t io_engine::uring_submit() {
+    MWR_ERROR("io_uring not supported");
+}
+
+size_t io_engine::uring_reap(size_t min) {
+    MWR_ERROR("io_uring not supported");
+}
+
+void io_engine::uring_cancel_all() {
+    MWR_ERROR("io_uring not supported");
+}
+
+#endif
+
+long long io_engine::execute(operation& op) const {
+#ifdef MWR_WINDOWS
+    switch (op.type) {
+    case OP_READ:
+    case OP_READ_FIXED:
+        if (op.offset != CURRENT_POS)
+            fd_seek(op.fd, op.offset);
+        return fd_read(op.fd, op.buf, op.len);
+
+    case OP_WRITE:
+    case OP_WRITE_FIXED:
+        if (op.offset != CURRENT_POS)
+            fd_seek(op.fd, op.offset);
+        return fd_write(op.fd, op.buf, op.len);
+
+    default:
+        return -ENOSYS;
+    }
+#else
+    ssize_t ret;
+    do {
+        switch (op.type) {
+        case OP_READ:
+        case OP_READ_FIXED:
+            ret = op.offset == CURRENT_POS
+                      ? ::read(op.fd, op.buf, op.len)
+                      : ::pread(op.fd, op.buf, op.len, (off_t)op.offset);
+            break;
+
+        case OP_WRITE:
+        case OP_WRITE_FIXED:
+            ret = op.offset == CURRENT_POS
+                      ? ::write(op.fd, op.buf, op.len)
+                      : ::pwrite(op.fd, op.buf, op.len, (off_t)op.offset);
+            break;
+
+        case OP_ACCEPT:
+#ifdef MWR_LINUX
+            ret = ::accept4(op.fd, nullptr, nullptr, SOCK_CLOEXEC);
+#else
+            ret = ::accept(op.fd, nullptr, nullptr);
+#endif
+            break;
+
+        default:
+            return -ENOSYS;
+        }
+    } while (ret < 0 && errno == EINTR);
+
+    return ret < 0 ? -errno : ret;
+#endif
+}
+
+size_t io_engine::fallback_reap(size_t min) {
+    while (true) {
+        u64 now = timestamp_ns();
+        u64 next = ~0ull;
+        for (auto it = m_inflight.begin(); it != m_inflight.end();) {
+            if (it->second.deadline <= now) {
+                m_done.emplace_back(std::move(it->second), 0);
+                it = m_inflight.erase(it);
+            } else {
+                next = std::min(next, it->second.deadline);
+                it++;
+            }
+        }
+
+        if (m_done.size() >= min || m_inflight.empty())
+            break;
+
+        std::this_thread::sleep_for(std::chrono::nanoseconds(next - now));
+    }
+
+    vector<std::pair<operation, long long>> done;
+    done.swap(m_done);
+    for (auto& res : done) {
+        m_pending--;
+        if (res.first.cb)
+            res.first.cb(res.second);
+    }
+
+    return done.size();
+}
+
+} // namespace mwr
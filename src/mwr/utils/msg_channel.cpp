@@ -0,0 +1,250 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#include "mwr/utils/msg_channel.h"
+#include "mwr/core/bitops.h"
+
+namespace mwr {
+
+// buffers above this size are not worth keeping around for reuse
+static const size_t MSG_POOL_MAX_CAPACITY = 1 * MiB;
+
+size_t msg_pool::max_free() const {
+    lock_guard<mutex> guard(m_state->mtx);
+    return m_state->maxfree;
+}
+
+size_t msg_pool::num_free() const {
+    lock_guard<mutex> guard(m_state->mtx);
+    return m_state->free.size();
+}
+
+msg_pool::msg_pool(size_t maxfree): m_state(new state) {
+    m_state->maxfree = maxfree;
+}
+
+message msg_pool::alloc(size_t size) {
+    std::unique_ptr<vector<u8>> buf;
+
+    {
+        lock_guard<mutex> guard(m_state->mtx);
+        if (!m_state->free.empty()) {
+            buf = std::move(m_state->free.back());
+            m_state->free.pop_back();
+        }
+    }
+
+    if (!buf)
+        buf.reset(new vector<u8>());
+    buf->resize(size);
+
+    // the deleter keeps the pool state alive until the last buffer is gone
+    std::shared_ptr<state> pool = m_state;
+    auto recycle = [pool](vector<u8>* ptr) {
+        std::unique_ptr<vector<u8>> owned(ptr);
+        if (owned->capacity() > MSG_POOL_MAX_CAPACITY)
+            return;
+
+        lock_guard<mutex> guard(pool->mtx);
+        if (pool->free.size() < pool->maxfree)
+            pool->free.push_back(std::move(owned));
+    };
+
+    return message(std::shared_ptr<vector<u8>>(buf.release(), recycle));
+}
+
+void msg_channel::set_batch_size(size_t size) {
+    lock_guard<mutex> guard(m_txmtx);
+    if (m_txbuf.size() > size)
+        flush_locked();
+    m_batch = size;
+    m_txbuf.reserve(size);
+}
+
+msg_channel::msg_channel(socket& sock, msg_framing framing, size_t maxmsg):
+    m_socket(&sock),
+    m_server(nullptr),
+    m_client(-1),
+    m_framing(framing),
+    m_maxmsg(maxmsg),
+    m_pool(),
+    m_txmtx(),
+    m_rxmtx(),
+    m_txbuf(),
+    m_batch(16 * KiB) {
+    m_txbuf.reserve(m_batch);
+}
+
+msg_channel::msg_channel(server_socket& server, int client,
+                         msg_framing framing, size_t maxmsg):
+    m_socket(nullptr),
+    m_server(&server),
+    m_client(client),
+    m_framing(framing),
+    m_maxmsg(maxmsg),
+    m_pool(),
+    m_txmtx(),
+    m_rxmtx(),
+    m_txbuf(),
+    m_batch(16 * KiB) {
+    m_txbuf.reserve(m_batch);
+}
+
+msg_channel::~msg_channel() {
+    lock_guard<mutex> guard(m_txmtx);
+    try {
+        flush_locked();
+    } catch (...) {
+        // peer is gone, nobody is left to receive the batch
+    }
+}
+
+size_t msg_channel::encode_length(u8* buf, size_t len) const {
+    if (m_framing == MSG_FRAMING_U32) {
+        u32 val = cpu_to_le32((u32)len);
+        memcpy(buf, &val, sizeof(val));
+        return sizeof(val);
+    }
+
+    size_t n = 0;
+    do {
+        u8 byte = len & 0x7f;
+        len >>= 7;
+        buf[n++] = byte | (len ? 0x80 : 0);
+    } while (len);
+
+    return n;
+}
+
+size_t msg_channel::decode_length() {
+    if (m_framing == MSG_FRAMING_U32) {
+        u32 val = 0;
+        read(&val, sizeof(val));
+        return le32_to_cpu(val);
+    }
+
+    u64 len = 0;
+    for (unsigned int shift = 0; shift < 64; shift += 7) {
+        u8 byte = 0;
+        read(&byte, sizeof(byte));
+        len |= (u64)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return len;
+    }
+
+    close();
+    MWR_REPORT("error receiving message: malformed length");
+}
+
+void msg_channel::flush_locked() {
+    if (m_txbuf.empty())
+        return;
+
+    iovec iov = { m_txbuf.data(), m_txbuf.size() };
+    try {
+        write(&iov, 1);
+        m_txbuf.clear();
+    } catch (...) {
+        m_txbuf.clear();
+        throw;
+    }
+}
+
+void msg_channel::write(const iovec* iov, size_t iovcnt) {
+    if (m_server)
+        m_server->send(m_client, iov, iovcnt);
+    else
+        m_socket->send(iov, iovcnt);
+}
+
+void msg_channel::read(void* data, size_t size) {
+    if (m_server)
+        m_server->recv(m_client, data, size);
+    else
+        m_socket->recv(data, size);
+}
+
+// after a framing error the stream cannot be resynchronized anymore
+void msg_channel::close() {
+    if (m_server)
+        m_server->disconnect(m_client);
+    else
+        m_socket->disconnect();
+}
+
+void msg_channel::send(const void* data, size_t size) {
+    MWR_REPORT_ON(size > m_maxmsg, "message too big: %zu bytes", size);
+    MWR_REPORT_ON(m_framing == MSG_FRAMING_U32 && size > 0xffffffffull,
+                  "message too big for 32 bit length: %zu bytes", size);
+
+    u8 prefix[10];
+    size_t len = encode_length(prefix, size);
+
+    lock_guard<mutex> guard(m_txmtx);
+    if (m_txbuf.size() + len + size > m_batch) {
+        // messages that do not fit into a batch on their own go out
+        // immediately, together with everything that is still pending
+        if (len + size > m_batch) {
+            iovec iov[3];
+            size_t n = 0;
+            if (!m_txbuf.empty())
+                iov[n++] = { m_txbuf.data(), m_txbuf.size() };
+            iov[n++] = { prefix, len };
+            if (size > 0)
+                iov[n++] = { (void*)data, size };
+
+            try {
+                write(iov, n);
+                m_txbuf.clear();
+            } catch (...) {
+                m_txbuf.clear();
+                throw;
+            }
+
+            return;
+        }
+
+        flush_locked();
+    }
+
+    m_txbuf.insert(m_txbuf.end(), prefix, prefix + len);
+    m_txbuf.insert(m_txbuf.end(), (const u8*)data, (const u8*)data + size);
+}
+
+void msg_channel::flush() {
+    lock_guard<mutex> guard(m_txmtx);
+    flush_locked();
+}
+
+bool msg_channel::poll(size_t timeoutms) {
+    flush();
+    if (m_server)
+        return m_server->peek(m_client, timeoutms);
+    return m_socket->peek((time_t)timeoutms) > 0;
+}
+
+message msg_channel::recv() {
+    // the peer might be waiting for pending messages before it replies
+    flush();
+
+    lock_guard<mutex> guard(m_rxmtx);
+    size_t size = decode_length();
+    if (size > m_maxmsg) {
+        close();
+        MWR_REPORT("error receiving message: %zu bytes exceeds limit", size);
+    }
+
+    message msg = m_pool.alloc(size);
+    if (size > 0)
+        read(msg.data(), size);
+    return msg;
+}
+
+} // namespace mwr
@@ -0,0 +1,150 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#include "mwr/utils/per_thread.h"
+
+#include <algorithm>
+#include <condition_variable>
+
+namespace mwr {
+
+struct thread_state;
+
+struct exit_hook {
+    std::function<void()> fn;
+    thread_state* owner;
+    std::thread::id runner;
+    bool running;
+};
+
+struct thread_globals {
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::unordered_map<u64, exit_hook> hooks;
+    u64 next_hook = 1;
+    size_t next_index = 0;
+    std::vector<size_t> free_indices; // min-heap, keeps indices dense
+};
+
+// never destroyed, so that exit hooks can still be cancelled by objects
+// that get destroyed during or after static destruction
+static thread_globals& globals() {
+    static thread_globals* g = new thread_globals;
+    return *g;
+}
+
+// set once a thread has run its exit hooks, after that, no new hooks can be
+// registered and thread indices handed out are no longer recycled
+static thread_local bool t_exited = false;
+
+struct thread_state {
+    std::vector<u64> hooks; // in order of registration
+    size_t* cache = nullptr;
+    size_t index = 0;
+
+    ~thread_state();
+};
+
+thread_state::~thread_state() {
+    thread_globals& g = globals();
+    std::unique_lock<std::mutex> lock(g.mtx);
+
+    // hooks may register new ones while they run, so pop one at a time
+    while (!hooks.empty()) {
+        u64 id = hooks.back();
+        hooks.pop_back();
+
+        exit_hook& hook = g.hooks.at(id);
+        hook.running = true;
+        hook.runner = std::this_thread::get_id();
+        std::function<void()> fn = std::move(hook.fn);
+
+        lock.unlock();
+        fn();
+        lock.lock();
+
+        g.hooks.erase(id);
+        g.cv.notify_all();
+    }
+
+    t_exited = true;
+
+    if (cache) {
+        g.free_indices.push_back(index);
+        std::push_heap(g.free_indices.begin(), g.free_indices.end(),
+                       std::greater<size_t>());
+        *cache = ~(size_t)0;
+    }
+}
+
+static thread_state& this_thread_state() {
+    static thread_local thread_state state;
+    return state;
+}
+
+u64 per_thread_at_exit(std::function<void()> fn) {
+    if (t_exited)
+        return 0;
+
+    thread_state& state = this_thread_state();
+    thread_globals& g = globals();
+    std::lock_guard<std::mutex> lock(g.mtx);
+
+    u64 id = g.next_hook++;
+    g.hooks[id] = { std::move(fn), &state, std::thread::id(), false };
+    state.hooks.push_back(id);
+    return id;
+}
+
+void per_thread_cancel_exit(u64 id) {
+    thread_globals& g = globals();
+    std::unique_lock<std::mutex> lock(g.mtx);
+
+    auto it = g.hooks.find(id);
+    if (it == g.hooks.end())
+        return;
+
+    if (it->second.running) {
+        if (it->second.runner == std::this_thread::get_id())
+            return;
+        g.cv.wait(lock, [&]() { return g.hooks.count(id) == 0; });
+        return;
+    }
+
+    std::vector<u64>& hooks = it->second.owner->hooks;
+    hooks.erase(std::find(hooks.begin(), hooks.end(), id));
+    g.hooks.erase(it);
+}
+
+size_t per_thread_alloc_index(size_t& cache) {
+    thread_globals& g = globals();
+
+    if (t_exited) {
+        std::lock_guard<std::mutex> lock(g.mtx);
+        return cache = g.next_index++;
+    }
+
+    thread_state& state = this_thread_state();
+    std::lock_guard<std::mutex> lock(g.mtx);
+
+    if (g.free_indices.empty()) {
+        state.index = g.next_index++;
+    } else {
+        std::pop_heap(g.free_indices.begin(), g.free_indices.end(),
+                      std::greater<size_t>());
+        state.index = g.free_indices.back();
+        g.free_indices.pop_back();
+    }
+
+    state.cache = &cache;
+    return cache = state.index;
+}
+
+} // namespace mwr
@@ -0,0 +1,435 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#include "mwr/utils/shm_socket.h"
+#include "mwr/core/bitops.h"
+#include "mwr/core/utils.h"
+
+#include <atomic>
+#include <climits>
+#include <new>
+#include <random>
+
+#ifdef MWR_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+namespace mwr {
+
+static const u32 SHM_MAGIC = 0x4d575253; // 'MWRS'
+static const u32 SHM_VERSION = 1;
+
+static_assert(std::atomic<u32>::is_always_lock_free, "atomics need locks");
+static_assert(std::atomic<u64>::is_always_lock_free, "atomics need locks");
+
+struct shm_offer {
+    u32 magic;
+    u32 version;
+    u64 nonce;
+    u64 ringsize;
+    char name[64];
+};
+
+struct shm_answer {
+    u32 magic;
+    u32 accept;
+};
+
+// single producer, single consumer; head and tail only ever increase and
+// are reduced modulo the (power of two) ring size when accessing data
+struct shm_socket::ring {
+    alignas(64) std::atomic<u64> head;
+    alignas(64) std::atomic<u64> tail;
+    alignas(64) std::atomic<u32> data_seq;
+    std::atomic<u32> data_waiters;
+    alignas(64) std::atomic<u32> space_seq;
+    std::atomic<u32> space_waiters;
+};
+
+// ring data follows the header, which is a multiple of the cache line size
+struct shm_socket::header {
+    u64 magic;
+    u64 nonce;
+    u64 ringsize;
+    std::atomic<u32> closed;
+    ring rings[2];
+};
+
+static void futex_wait(std::atomic<u32>& word, u32 val, time_t timeoutms) {
+#ifdef MWR_LINUX
+    timespec ts{};
+    ts.tv_sec = timeoutms / 1000;
+    ts.tv_nsec = (timeoutms % 1000) * 1000000;
+    syscall(SYS_futex, (u32*)&word, FUTEX_WAIT, val, &ts, nullptr, 0);
+#endif
+}
+
+static void futex_wake(std::atomic<u32>& word) {
+#ifdef MWR_LINUX
+    syscall(SYS_futex, (u32*)&word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+}
+
+static void ring_doorbell(std::atomic<u32>& seq, std::atomic<u32>& waiters) {
+    seq.fetch_add(1);
+    if (waiters.load() > 0)
+        futex_wake(seq);
+}
+
+shm_socket::shm_socket(size_t ringsize):
+    m_ringsize(ringsize ? max<size_t>(ringsize, 4 * KiB) : 0),
+    m_spin(2000),
+    m_socket(),
+    m_server(nullptr),
+    m_client(-1),
+    m_shm(nullptr),
+    m_shmsize(0),
+    m_tx(nullptr),
+    m_rx(nullptr),
+    m_txdata(nullptr),
+    m_rxdata(nullptr) {
+    if (m_ringsize && !is_pow2(m_ringsize))
+        m_ringsize = 1ull << (fls(m_ringsize) + 1);
+}
+
+shm_socket::~shm_socket() {
+    disconnect();
+}
+
+bool shm_socket::is_connected() const {
+    if (m_shm && m_shm->closed.load())
+        return false;
+    if (m_server)
+        return m_server->is_connected(m_client);
+    return m_socket.is_connected();
+}
+
+void shm_socket::map_shared(int fd, size_t size, bool initiator) {
+#ifdef MWR_LINUX
+    int prot = PROT_READ | PROT_WRITE;
+    void* base = mmap(nullptr, size, prot, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+        return;
+
+    if (initiator) {
+        header* hdr = new (base) header();
+        hdr->magic = SHM_MAGIC;
+        hdr->ringsize = m_ringsize;
+    }
+
+    m_shm = (header*)base;
+    m_shmsize = size;
+
+    u8* data = (u8*)base + sizeof(header);
+    m_tx = &m_shm->rings[initiator ? 0 : 1];
+    m_rx = &m_shm->rings[initiator ? 1 : 0];
+    m_txdata = data + (initiator ? 0 : m_ringsize);
+    m_rxdata = data + (initiator ? m_ringsize : 0);
+#endif
+}
+
+void shm_socket::unmap_shared() {
+#ifdef MWR_LINUX
+    if (m_shm)
+        munmap(m_shm, m_shmsize);
+#endif
+    m_shm = nullptr;
+    m_shmsize = 0;
+    m_tx = m_rx = nullptr;
+    m_txdata = m_rxdata = nullptr;
+}
+
+void shm_socket::connect(const string& host, u16 port) {
+    disconnect();
+    m_socket.connect(host, port);
+
+    shm_offer offer{};
+    offer.magic = SHM_MAGIC;
+    offer.version = SHM_VERSION;
+
+    string name;
+#ifdef MWR_LINUX
+    if (m_ringsize > 0) {
+        std::random_device rd;
+        offer.nonce = (u64)rd() << 32 | rd();
+        offer.ringsize = m_ringsize;
+        name = mkstr("/mwr-%d-%016llx", getpid(),
+                     (unsigned long long)offer.nonce);
+
+        size_t size = sizeof(header) + 2 * m_ringsize;
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd >= 0) {
+            if (ftruncate(fd, size) == 0)
+                map_shared(fd, size, true);
+            close(fd);
+        }
+
+        if (m_shm) {
+            m_shm->nonce = offer.nonce;
+            strncpy(offer.name, name.c_str(), sizeof(offer.name) - 1);
+        } else if (fd >= 0) {
+            shm_unlink(name.c_str());
+            name.clear();
+        }
+    }
+#endif
+
+    shm_answer answer{};
+    try {
+        m_socket.send(offer);
+        m_socket.recv(answer);
+    } catch (...) {
+#ifdef MWR_LINUX
+        if (!name.empty())
+            shm_unlink(name.c_str());
+#endif
+        unmap_shared();
+        throw;
+    }
+
+    // the peer has the segment mapped by now, the name is no longer needed
+#ifdef MWR_LINUX
+    if (!name.empty())
+        shm_unlink(name.c_str());
+#endif
+
+    if (answer.magic != SHM_MAGIC) {
+        disconnect();
+        MWR_REPORT("shm handshake with %s:%hu failed", host.c_str(), port);
+    }
+
+    if (!answer.accept)
+        unmap_shared();
+}
+
+void shm_socket::accept(server_socket& server, int client) {
+    disconnect();
+
+    shm_offer offer{};
+    server.recv(client, &offer, sizeof(offer));
+    if (offer.magic != SHM_MAGIC || offer.version != SHM_VERSION) {
+        server.disconnect(client);
+        MWR_REPORT("shm handshake with client %d failed", client);
+    }
+
+    m_server = &server;
+    m_client = client;
+
+    shm_answer answer{};
+    answer.magic = SHM_MAGIC;
+
+#ifdef MWR_LINUX
+    offer.name[sizeof(offer.name) - 1] = '\0';
+    if (offer.name[0] && is_pow2(offer.ringsize)) {
+        size_t size = sizeof(header) + 2 * offer.ringsize;
+        int fd = shm_open(offer.name, O_RDWR, 0);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size == size) {
+            size_t ringsize = m_ringsize;
+            m_ringsize = offer.ringsize;
+            map_shared(fd, size, false);
+            if (m_shm && (m_shm->magic != SHM_MAGIC ||
+                          m_shm->nonce != offer.nonce ||
+                          m_shm->ringsize != offer.ringsize)) {
+                unmap_shared();
+            }
+
+            if (!m_shm)
+                m_ringsize = ringsize;
+        }
+
+        if (fd >= 0)
+            close(fd);
+    }
+#endif
+
+    answer.accept = m_shm != nullptr;
+    try {
+        server.send(client, answer);
+    } catch (...) {
+        unmap_shared();
+        m_server = nullptr;
+        m_client = -1;
+        throw;
+    }
+}
+
+void shm_socket::disconnect() {
+    if (m_shm) {
+        m_shm->closed = 1;
+        for (ring& r : m_shm->rings) {
+            ring_doorbell(r.data_seq, r.data_waiters);
+            ring_doorbell(r.space_seq, r.space_waiters);
+        }
+
+        unmap_shared();
+    }
+
+    if (m_server) {
+        m_server->disconnect(m_client);
+        m_server = nullptr;
+        m_client = -1;
+    }
+
+    m_socket.disconnect();
+}
+
+// the control connection stays idle while data flows through shared memory,
+// so reading from it only ever fails once the peer has gone away
+void shm_socket::check_peer() {
+    if (m_shm->closed.load()) {
+        disconnect();
+        MWR_REPORT("error receiving data: disconnected");
+    }
+
+    try {
+        if (m_server) {
+            if (m_server->peek(m_client, 0))
+                m_server->recv_char(m_client);
+        } else if (m_socket.peek(0) > 0) {
+            m_socket.recv_char();
+        }
+    } catch (...) {
+        disconnect();
+        throw;
+    }
+}
+
+void shm_socket::wait(ring* r, bool data, time_t timeoutms) {
+    auto ready = [&]() -> bool {
+        u64 head = r->head.load(std::memory_order_acquire);
+        u64 tail = r->tail.load(std::memory_order_acquire);
+        return data ? head != tail : head - tail < m_ringsize;
+    };
+
+    for (size_t i = 0; i < m_spin; i++) {
+        if (ready())
+            return;
+        cpu_yield();
+    }
+
+    std::atomic<u32>& seq = data ? r->data_seq : r->space_seq;
+    std::atomic<u32>& waiters = data ? r->data_waiters : r->space_waiters;
+
+    u32 val = seq.load();
+    waiters.fetch_add(1);
+    if (!ready() && !m_shm->closed.load())
+        futex_wait(seq, val, timeoutms);
+    waiters.fetch_sub(1);
+
+    if (!ready())
+        check_peer();
+}
+
+size_t shm_socket::peek(time_t timeoutms) {
+    if (!m_shm) {
+        if (!m_server)
+            return m_socket.peek(timeoutms);
+        if (!m_server->peek(m_client, timeoutms))
+            return 0;
+        return m_server->available(m_client);
+    }
+
+    u64 avail = m_rx->head.load(std::memory_order_acquire) -
+                m_rx->tail.load(std::memory_order_relaxed);
+    if (avail == 0 && timeoutms > 0) {
+        wait(m_rx, true, timeoutms);
+        avail = m_rx->head.load(std::memory_order_acquire) -
+                m_rx->tail.load(std::memory_order_relaxed);
+    }
+
+    return avail;
+}
+
+void shm_socket::send_fallback(const void* data, size_t size) {
+    if (m_server)
+        m_server->send(m_client, data, size);
+    else
+        m_socket.send(data, size);
+}
+
+void shm_socket::recv_fallback(void* data, size_t size) {
+    if (m_server)
+        m_server->recv(m_client, data, size);
+    else
+        m_socket.recv(data, size);
+}
+
+void shm_socket::send(const void* data, size_t size) {
+    if (!m_shm) {
+        send_fallback(data, size);
+        return;
+    }
+
+    const u8* ptr = (const u8*)data;
+    size_t n = 0;
+
+    while (n < size) {
+        if (m_shm->closed.load()) {
+            disconnect();
+            MWR_REPORT("error sending data: disconnected");
+        }
+
+        u64 head = m_tx->head.load(std::memory_order_relaxed);
+        u64 tail = m_tx->tail.load(std::memory_order_acquire);
+        size_t space = m_ringsize - (size_t)(head - tail);
+        if (space == 0) {
+            wait(m_tx, false, 100);
+            continue;
+        }
+
+        size_t len = min(space, size - n);
+        size_t off = head & (m_ringsize - 1);
+        size_t first = min(len, m_ringsize - off);
+        memcpy(m_txdata + off, ptr + n, first);
+        memcpy(m_txdata, ptr + n + first, len - first);
+
+        m_tx->head.store(head + len, std::memory_order_release);
+        ring_doorbell(m_tx->data_seq, m_tx->data_waiters);
+        n += len;
+    }
+}
+
+void shm_socket::recv(void* data, size_t size) {
+    if (!m_shm) {
+        recv_fallback(data, size);
+        return;
+    }
+
+    u8* ptr = (u8*)data;
+    size_t n = 0;
+
+    while (n < size) {
+        u64 tail = m_rx->tail.load(std::memory_order_relaxed);
+        u64 head = m_rx->head.load(std::memory_order_acquire);
+        size_t avail = (size_t)(head - tail);
+        if (avail == 0) {
+            wait(m_rx, true, 100);
+            continue;
+        }
+
+        size_t len = min(avail, size - n);
+        size_t off = tail & (m_ringsize - 1);
+        size_t first = min(len, m_ringsize - off);
+        memcpy(ptr + n, m_rxdata + off, first);
+        memcpy(ptr + n + first, m_rxdata, len - first);
+
+        m_rx->tail.store(tail + len, std::memory_order_release);
+        ring_doorbell(m_rx->space_seq, m_rx->space_waiters);
+        n += len;
+    }
+}
+
+} // namespace mwr
@@ -0,0 +1,492 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#include "mwr/utils/socket.h"
+
+#include <thread>
+
+namespace mwr {
+
+// m_gen is bumped on every disconnect, buffer contents tagged with an older
+// generation belong to a previous connection and must be discarded
+bool socket::generation(u64& gen) const {
+    lock_guard<mutex> guard(m_mtx);
+    gen = m_gen;
+    return m_conn != (socket_t)-1;
+}
+
+void socket::sync_rx_locked() {
+    u64 gen;
+    bool connected = generation(gen);
+    if (gen != m_rxgen) {
+        m_rxhead = m_rxlen = 0;
+        m_rxgen = gen;
+    }
+
+    MWR_REPORT_ON(!connected, "error receiving data: not connected");
+}
+
+void socket::sync_tx_locked() {
+    u64 gen;
+    bool connected = generation(gen);
+    if (gen != m_txgen) {
+        m_txbuf.clear();
+        m_txgen = gen;
+    }
+
+    MWR_REPORT_ON(!connected, "error sending data: not connected");
+}
+
+void socket::flush_locked() {
+    if (m_txbuf.empty())
+        return;
+
+    try {
+        send_unbuffered(m_txbuf.data(), m_txbuf.size());
+        m_txbuf.clear();
+    } catch (...) {
+        // pending data survives timeouts that did not send anything
+        if (!is_connected())
+            m_txbuf.clear();
+        throw;
+    }
+}
+
+// receives at most one chunk of data into the contiguous free space at the
+// end of the ring, which is everything the kernel holds in the common case
+void socket::fill_locked() {
+    size_t cap = m_rxbuf.size();
+    if (m_rxlen == 0)
+        m_rxhead = 0;
+
+    size_t tail = (m_rxhead + m_rxlen) % cap;
+    size_t space = tail < m_rxhead ? m_rxhead - tail : cap - tail;
+    if (m_rxlen == cap)
+        space = 0;
+
+    MWR_ERROR_ON(space == 0, "receive buffer full");
+    m_rxlen += recv_unbuffered(m_rxbuf.data() + tail, space, true);
+}
+
+size_t socket::consume_locked(u8* data, size_t size) {
+    size_t n = min(size, m_rxlen);
+    size_t cap = m_rxbuf.size();
+    size_t first = min(n, cap - m_rxhead);
+
+    memcpy(data, m_rxbuf.data() + m_rxhead, first);
+    memcpy(data + first, m_rxbuf.data(), n - first);
+
+    m_rxhead = m_rxlen == n ? 0 : (m_rxhead + n) % cap;
+    m_rxlen -= n;
+    return n;
+}
+
+void socket::set_buffered(size_t rxsize, size_t txsize) {
+    lock_guard<mutex> rxguard(m_rxmtx);
+    lock_guard<mutex> txguard(m_txmtx);
+
+    // data buffered for an earlier connection must not reach a new peer
+    if (txsize < m_txbuf.size()) {
+        u64 gen;
+        if (generation(gen) && gen == m_txgen)
+            flush_locked();
+        else
+            m_txbuf.clear();
+    }
+
+    m_txcap = txsize;
+    m_txbuf.reserve(txsize);
+
+    // keep pending data around, even if the new buffer is smaller
+    size_t pending = m_rxlen;
+    vector<u8> rxbuf(max(rxsize, pending));
+    consume_locked(rxbuf.data(), pending);
+
+    m_rxbuf.swap(rxbuf);
+    m_rxhead = 0;
+    m_rxlen = pending;
+}
+
+size_t socket::peek(time_t timeoutms) {
+    {
+        lock_guard<mutex> guard(m_rxmtx);
+        u64 gen;
+        if (generation(gen) && gen == m_rxgen && m_rxlen > 0)
+            return m_rxlen;
+    }
+
+    if (m_autoflush)
+        flush();
+
+    return peek_unbuffered(timeoutms);
+}
+
+void socket::set_retry(size_t retries, time_t initialms, time_t maxms) {
+    lock_guard<mutex> guard(m_mtx);
+    m_retries = retries;
+    m_backoff_initial = initialms;
+    m_backoff_max = max(initialms, maxms);
+}
+
+// retries failed connects according to the policy set via set_retry
+void socket::connect_retry(const std::function<void()>& attempt) {
+    m_mtx.lock();
+    size_t retries = m_retries;
+    time_t delay = m_backoff_initial;
+    time_t maxdelay = m_backoff_max;
+    m_mtx.unlock();
+
+    for (size_t i = 0;; i++) {
+        try {
+            attempt();
+            return;
+        } catch (report&) {
+            if (i >= retries)
+                throw;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+        delay = min(delay * 2, maxdelay);
+    }
+}
+
+void socket::connect(const string& host, u16 port) {
+    m_mtx.lock();
+    m_remote = host;
+    m_remote_port = port;
+    m_remote_unix = false;
+    m_mtx.unlock();
+
+    connect_retry([&]() { connect_once(host, port); });
+}
+
+void socket::connect_unix(const string& path) {
+    m_mtx.lock();
+    m_remote = path;
+    m_remote_port = 0;
+    m_remote_unix = true;
+    m_mtx.unlock();
+
+    connect_retry([&]() { connect_unix_once(path); });
+}
+
+void socket::reconnect() {
+    m_mtx.lock();
+    string remote = m_remote;
+    u16 port = m_remote_port;
+    bool is_unix = m_remote_unix;
+    m_mtx.unlock();
+
+    MWR_REPORT_ON(remote.empty(), "cannot reconnect: never connected");
+    if (is_unix)
+        connect_unix(remote);
+    else
+        connect(remote, port);
+}
+
+void socket::send(const void* data, size_t size) {
+    lock_guard<mutex> guard(m_txmtx);
+    sync_tx_locked();
+
+    if (m_txbuf.size() + size > m_txcap)
+        flush_locked();
+
+    if (size >= m_txcap)
+        send_unbuffered(data, size);
+    else
+        m_txbuf.insert(m_txbuf.end(), (const u8*)data, (const u8*)data + size);
+}
+
+void socket::send_file(int fd, u64 offset, size_t len) {
+    lock_guard<mutex> guard(m_txmtx);
+    sync_tx_locked();
+    flush_locked();
+    send_file_unbuffered(fd, offset, len);
+}
+
+void socket::recv(void* data, size_t size) {
+    lock_guard<mutex> guard(m_rxmtx);
+    sync_rx_locked();
+
+    u8* ptr = (u8*)data;
+    size_t n = consume_locked(ptr, size);
+
+    try {
+        if (n < size && m_autoflush)
+            flush();
+
+        // large reads bypass the ring buffer to avoid copying data twice
+        while (n < size) {
+            if (size - n >= m_rxbuf.size()) {
+                n += recv_unbuffered(ptr + n, size - n, false);
+            } else {
+                fill_locked();
+                n += consume_locked(ptr + n, size - n);
+            }
+        }
+    } catch (...) {
+        // data consumed before a timeout or a failed flush is lost, so is
+        // the stream
+        if (n > 0)
+            disconnect();
+        throw;
+    }
+}
+
+// small messages are coalesced into the transmit buffer, everything else
+// goes out together with pending buffered data in one vectored send
+void socket::send(const iovec* iov, size_t iovcnt) {
+    lock_guard<mutex> guard(m_txmtx);
+    sync_tx_locked();
+
+    size_t size = iov_length(iov, iovcnt);
+    if (m_txbuf.size() + size <= m_txcap && size < m_txcap) {
+        for (size_t i = 0; i < iovcnt; i++) {
+            const u8* base = (const u8*)iov[i].iov_base;
+            m_txbuf.insert(m_txbuf.end(), base, base + iov[i].iov_len);
+        }
+
+        return;
+    }
+
+    vector<iovec> vec;
+    vec.reserve(iovcnt + 1);
+    if (!m_txbuf.empty())
+        vec.push_back({ m_txbuf.data(), m_txbuf.size() });
+    vec.insert(vec.end(), iov, iov + iovcnt);
+
+    try {
+        send_unbuffered(vec.data(), vec.size());
+        m_txbuf.clear();
+    } catch (...) {
+        if (!is_connected())
+            m_txbuf.clear();
+        throw;
+    }
+}
+
+void socket::recv(const iovec* iov, size_t iovcnt) {
+    lock_guard<mutex> guard(m_rxmtx);
+    sync_rx_locked();
+
+    vector<iovec> vec(iov, iov + iovcnt);
+    size_t idx = iov_advance(vec, 0, 0);
+    size_t total = 0;
+    while (idx < vec.size() && m_rxlen > 0) {
+        size_t n = consume_locked((u8*)vec[idx].iov_base, vec[idx].iov_len);
+        idx = iov_advance(vec, idx, n);
+        total += n;
+    }
+
+    if (idx == vec.size())
+        return;
+
+    try {
+        if (m_autoflush)
+            flush();
+
+        size_t remaining = iov_length(vec.data() + idx, vec.size() - idx);
+        if (remaining >= m_rxbuf.size()) {
+            recv_unbuffered(vec.data() + idx, vec.size() - idx);
+            return;
+        }
+
+        while (idx < vec.size()) {
+            fill_locked();
+            while (idx < vec.size() && m_rxlen > 0) {
+                u8* base = (u8*)vec[idx].iov_base;
+                size_t n = consume_locked(base, vec[idx].iov_len);
+                idx = iov_advance(vec, idx, n);
+                total += n;
+            }
+        }
+    } catch (...) {
+        if (total > 0)
+            disconnect();
+        throw;
+    }
+}
+
+void socket::flush() {
+    lock_guard<mutex> guard(m_txmtx);
+    u64 gen;
+    if (generation(gen) && gen == m_txgen)
+        flush_locked();
+    else
+        m_txbuf.clear();
+}
+
+string socket::read_until(char delim) {
+    lock_guard<mutex> guard(m_rxmtx);
+    sync_rx_locked();
+
+    if (m_rxlen == 0 && m_autoflush)
+        flush();
+
+    string str;
+    while (true) {
+        try {
+            if (m_rxlen == 0 && m_rxbuf.empty()) {
+                char c = 0;
+                recv_unbuffered(&c, 1, false);
+                str += c;
+                if (c == delim)
+                    return str;
+                continue;
+            }
+
+            if (m_rxlen == 0)
+                fill_locked();
+        } catch (...) {
+            if (!str.empty())
+                disconnect();
+            throw;
+        }
+
+        size_t cap = m_rxbuf.size();
+        size_t first = min(m_rxlen, cap - m_rxhead);
+        const u8* head = m_rxbuf.data() + m_rxhead;
+        const void* p = memchr(head, delim, first);
+        size_t n = p ? (const u8*)p - head + 1 : 0;
+        if (!p && first < m_rxlen) {
+            p = memchr(m_rxbuf.data(), delim, m_rxlen - first);
+            n = p ? first + ((const u8*)p - m_rxbuf.data()) + 1 : 0;
+        }
+
+        size_t len = str.length();
+        str.resize(len + (p ? n : m_rxlen));
+        consume_locked((u8*)str.data() + len, str.length() - len);
+        if (p)
+            return str;
+    }
+}
+
+string socket::read_line() {
+    string line = read_until('\n');
+    line.pop_back();
+    if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+    return line;
+}
+
+int server_socket::first_pending() {
+    while (true) {
+        int client;
+        {
+            lock_guard<std::mutex> guard(m_ready_mtx);
+            if (m_ready.empty())
+                return -1;
+            client = m_ready.front();
+        }
+
+        // not looked up under m_ready_mtx, which nests inside m_clients_mtx
+        client_ref state = lookup_state(client);
+        if (state && state->pending)
+            return client;
+
+        lock_guard<std::mutex> guard(m_ready_mtx);
+        if (!m_ready.empty() && m_ready.front() == client)
+            m_ready.pop_front();
+    }
+}
+
+void server_socket::on_writable(event_fn fn) {
+    lock_guard<mutex> guard(m_mtx);
+    unique_lock<shared_mutex> lock(m_clients_mtx);
+    m_writable = std::move(fn);
+    for (const auto& [client, state] : m_clients)
+        watch_writable_locked(client, *state);
+}
+
+void server_socket::on_writable(int client, event_fn fn) {
+    lock_guard<mutex> guard(m_mtx);
+    client_ref state = find_state(client);
+    unique_lock<shared_mutex> lock(m_clients_mtx);
+    state->on_writable = std::move(fn);
+    watch_writable_locked(client, *state);
+}
+
+// queues the client once it becomes ready, clients that stay ready are not
+// queued again until they have been dispatched
+void server_socket::update_pending_locked(client_state& state) {
+    bool pending = state.available() > 0 || state.hangup;
+    if (!pending) {
+        state.pending = false;
+    } else if (!state.pending.exchange(true)) {
+        lock_guard<std::mutex> guard(m_ready_mtx);
+        m_ready.push_back(state.id);
+    }
+}
+
+size_t server_socket::dispatch_pending() {
+    deque<int> ready;
+    {
+        lock_guard<std::mutex> guard(m_ready_mtx);
+        ready.swap(m_ready);
+    }
+
+    vector<pair<client_ref, event_fn>> readable;
+    vector<pair<int, event_fn>> hangup;
+    vector<client_ref> unhandled;
+
+    for (int client : ready) {
+        shared_lock<shared_mutex> lock(m_clients_mtx);
+        auto it = m_clients.find(client);
+        if (it == m_clients.end())
+            continue;
+
+        // clearing pending claims the client, so duplicate entries are
+        // skipped and the client gets queued again once it becomes ready
+        client_state& state = *it->second;
+        lock_guard<std::mutex> rxguard(state.rxmtx);
+        if (!state.pending.exchange(false))
+            continue;
+
+        if (state.available() > 0) {
+            event_fn fn = state.on_readable ? state.on_readable : m_readable;
+            if (fn)
+                readable.emplace_back(it->second, std::move(fn));
+            else
+                unhandled.push_back(it->second);
+        } else if (state.hangup) {
+            hangup.emplace_back(client,
+                                state.on_hangup ? state.on_hangup : m_hangup);
+        }
+    }
+
+    // clients without a handler stay queued for poll()
+    for (const client_ref& state : unhandled) {
+        lock_guard<std::mutex> guard(state->rxmtx);
+        update_pending_locked(*state);
+    }
+
+    for (auto& [state, fn] : readable) {
+        fn(state->id);
+        lock_guard<std::mutex> guard(state->rxmtx);
+        update_pending_locked(*state);
+    }
+
+    for (auto& [client, fn] : hangup) {
+        if (fn)
+            fn(client);
+        disconnect(client);
+    }
+
+    return readable.size() + hangup.size();
+}
+
+void server_socket::recv(int client, const iovec* iov, size_t iovcnt) {
+    // on POSIX, data is drained into the client buffer anyway, so this does
+    // not need more syscalls than receiving into one contiguous buffer
+    for (size_t i = 0; i < iovcnt; i++)
+        recv(client, iov[i].iov_base, iov[i].iov_len);
+}
+
+} // namespace mwr
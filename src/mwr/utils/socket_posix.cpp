@@ -9,9 +9,14 @@
  ******************************************************************************/
 
 #include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
 #include <poll.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netdb.h>
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
@@ -19,6 +24,11 @@
 
 #include "mwr/utils/socket.h"
 
+#ifdef MWR_LINUX
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#endif
+
 namespace mwr {
 
 static bool g_no_ipv4 = []() {
@@ -83,11 +93,15 @@ struct socket_addr {
         sockaddr base;
         sockaddr_in ipv4;
         sockaddr_in6 ipv6;
+        sockaddr_un local;
     };
 
-    socket_addr() { memset(&ipv6, 0, sizeof(ipv6)); }
+    size_t pathlen;
+
+    socket_addr(): pathlen(0) { memset(&local, 0, sizeof(local)); }
     socket_addr(const sockaddr* addr);
     socket_addr(int family, u16 port, const string& host);
+    socket_addr(const string& path);
     void verify() const;
 
     bool is_ipv4() const {
@@ -150,9 +164,30 @@ socket_addr::socket_addr(int family, u16 port, const string& host):
     }
 }
 
+socket_addr::socket_addr(const string& path): socket_addr() {
+    bool abstract = starts_with(path, "@");
+#ifndef MWR_LINUX
+    MWR_REPORT_ON(abstract, "abstract socket names need Linux: %s",
+                  path.c_str());
+#endif
+    MWR_REPORT_ON(path.empty(), "unix socket path must not be empty");
+    MWR_REPORT_ON(path.length() >= sizeof(local.sun_path),
+                  "unix socket path too long: %s", path.c_str());
+
+    local.sun_family = AF_UNIX;
+    memcpy(local.sun_path, path.c_str(), path.length());
+
+    // abstract names start with a null byte and are not null terminated
+    if (abstract)
+        local.sun_path[0] = '\0';
+    pathlen = abstract ? path.length() : path.length() + 1;
+}
+
 void socket_addr::verify() const {
-    if (base.sa_family != AF_INET && base.sa_family != AF_INET6)
+    if (base.sa_family != AF_INET && base.sa_family != AF_INET6 &&
+        base.sa_family != AF_UNIX) {
         MWR_ERROR("accept: unknown protocol family %d", base.sa_family);
+    }
 }
 
 size_t socket_addr::size() const {
@@ -161,6 +196,8 @@ size_t socket_addr::size() const {
         return sizeof(ipv4);
     case AF_INET6:
         return sizeof(ipv6);
+    case AF_UNIX:
+        return offsetof(sockaddr_un, sun_path) + pathlen;
     default:
         MWR_ERROR("accept: unknown protocol family %d", (int)base.sa_family);
     }
@@ -180,6 +217,15 @@ string socket_addr::host() const {
         return str;
     }
 
+    case AF_UNIX: {
+        const char* path = local.sun_path;
+        if (path[0] != '\0')
+            return string(path, strnlen(path, sizeof(local.sun_path)));
+        if (pathlen > 0)
+            return "@" + string(path + 1, pathlen - 1);
+        return "";
+    }
+
     default:
         return "unknown";
     }
@@ -197,6 +243,8 @@ u16 socket_addr::port() const {
 }
 
 string socket_addr::peer() const {
+    if (base.sa_family == AF_UNIX)
+        return host();
     return mkstr("%s:%hu", host().c_str(), port());
 }
 
@@ -212,6 +260,258 @@ static void close_socket(int& socket) {
     }
 }
 
+static void set_nonblocking(int socket) {
+    int flags = fcntl(socket, F_GETFL, 0);
+    if (flags < 0 || fcntl(socket, F_SETFL, flags | O_NONBLOCK) < 0)
+        MWR_REPORT("failed to set non-blocking mode: %s", strerror(errno));
+}
+
+static bool would_block(int err) {
+    return err == EAGAIN || err == EWOULDBLOCK || err == EINTR;
+}
+
+static void wait_socket(int socket, short events) {
+    pollfd pfd{};
+    pfd.fd = socket;
+    pfd.events = events;
+    if (::poll(&pfd, 1, -1) < 0 && errno != EINTR)
+        MWR_REPORT("failed to poll socket: %s", strerror(errno));
+}
+
+// kernel busy polling needs CAP_NET_ADMIN beyond the system default, so
+// failing to enable it is not an error
+static void set_kernel_busy_poll(int socket, unsigned int us) {
+#ifdef SO_BUSY_POLL
+    int val = (int)us;
+    setsockopt(socket, SOL_SOCKET, SO_BUSY_POLL, &val, sizeof(val));
+#endif
+}
+
+// Retries a non-blocking receive up to spins times. Fails with EAGAIN if no
+// data arrived within the budget, in which case the caller should block.
+template <typename FN>
+static ssize_t busy_poll(size_t spins, busy_poll_counters& counters, FN fn) {
+    busy_poll_stats stats{};
+    ssize_t r = fn(MSG_DONTWAIT);
+    while (r < 0 && would_block(errno) && stats.spins < spins) {
+        stats.spins++;
+        cpu_yield();
+        r = fn(MSG_DONTWAIT);
+    }
+
+    if (r < 0 && would_block(errno)) {
+        stats.sleeps++;
+        errno = EAGAIN;
+    } else if (stats.spins > 0) {
+        stats.hits++;
+    }
+
+    counters.add(stats);
+    return r;
+}
+
+// returns the absolute deadline for a timeout, zero if there is none
+static u64 deadline_from(time_t timeoutms) {
+    return timeoutms > 0 ? timestamp_ms() + timeoutms : 0;
+}
+
+// waits for events on a socket, returns false once the deadline has passed
+static bool wait_deadline(int socket, short events, u64 deadline) {
+    while (true) {
+        u64 now = timestamp_ms();
+        if (now >= deadline)
+            return false;
+
+        pollfd pfd{};
+        pfd.fd = socket;
+        pfd.events = events;
+        int r = ::poll(&pfd, 1, (int)min<u64>(deadline - now, INT_MAX));
+        if (r > 0)
+            return true;
+        if (r < 0 && errno != EINTR)
+            MWR_REPORT("failed to poll socket: %s", strerror(errno));
+    }
+}
+
+// connects without blocking past the deadline, if there is one
+static bool connect_deadline(int socket, const sockaddr* addr,
+                             socklen_t addrlen, u64 deadline) {
+    if (!deadline)
+        return ::connect(socket, addr, addrlen) == 0;
+
+    int flags = fcntl(socket, F_GETFL, 0);
+    if (flags < 0 || fcntl(socket, F_SETFL, flags | O_NONBLOCK) < 0)
+        return false;
+
+    int r = ::connect(socket, addr, addrlen);
+    if (r < 0 && errno == EINPROGRESS) {
+        int err = ETIMEDOUT;
+        socklen_t len = sizeof(err);
+        if (wait_deadline(socket, POLLOUT, deadline))
+            getsockopt(socket, SOL_SOCKET, SO_ERROR, &err, &len);
+        errno = err;
+        r = err ? -1 : 0;
+    }
+
+    int err = errno;
+    fcntl(socket, F_SETFL, flags);
+    errno = err;
+    return r == 0;
+}
+
+// Bounds blocking sends on a socket, sendfile and splice included, to the
+// time left until the deadline, or lifts the bound if there is no deadline.
+// Returns false once the deadline has passed.
+static bool send_deadline(int socket, u64 deadline) {
+    u64 left = 0;
+    if (deadline) {
+        u64 now = timestamp_ms();
+        if (now >= deadline)
+            return false;
+        left = deadline - now;
+    }
+
+    timeval tv{};
+    tv.tv_sec = left / 1000;
+    tv.tv_usec = (left % 1000) * 1000;
+    setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    return true;
+}
+
+// waits until a socket is writable, returns false once the deadline passed
+static bool wait_writable(int socket, u64 deadline) {
+    if (deadline)
+        return wait_deadline(socket, POLLOUT, deadline);
+    wait_socket(socket, POLLOUT);
+    return true;
+}
+
+// Transfers up to len bytes of fd starting at offset to a connected socket.
+// Returns the number of bytes sent, zero at the end of the file or -1 with
+// errno set. The file position of fd is left untouched where possible.
+static ssize_t send_file_chunk(int conn, int fd, u64 offset, size_t len,
+                               u64 deadline) {
+    ssize_t r;
+#ifdef MWR_LINUX
+    // data stays within the kernel: sendfile serves regular files and
+    // block devices, splice everything that is a pipe
+    const size_t chunk = min<size_t>(len, 1 * GiB);
+    off_t off = (off_t)offset;
+    r = ::sendfile(conn, fd, &off, chunk);
+    if (r >= 0 || (errno != EINVAL && errno != ENOSYS && errno != ESPIPE))
+        return r;
+
+    r = ::splice(fd, nullptr, conn, nullptr, chunk, SPLICE_F_MOVE);
+    if (r >= 0 || errno != EINVAL)
+        return r;
+#endif
+
+    u8 buf[64 * KiB];
+    const size_t size = min(len, sizeof(buf));
+    r = ::pread(fd, buf, size, (off_t)offset);
+    if (r < 0 && errno == ESPIPE)
+        r = ::read(fd, buf, size);
+    if (r <= 0)
+        return r;
+
+    for (ssize_t n = 0; n < r;) {
+        ssize_t s = ::send(conn, buf + n, r - n, MSG_NOSIGNAL);
+        if (s < 0 && would_block(errno)) {
+            if (wait_writable(conn, deadline))
+                continue;
+            errno = ETIMEDOUT;
+            return n > 0 ? n : -1;
+        }
+
+        if (s < 0)
+            return -1;
+
+        n += s;
+    }
+
+    return r;
+}
+
+// Returns the number of bytes sent, err is zero if the file ended early.
+// Gives up with ETIMEDOUT once the deadline has passed, if there is one.
+static size_t send_file_all(int conn, int fd, u64 offset, size_t len,
+                            int& err, u64 deadline = 0) {
+    size_t n = 0;
+    err = 0;
+
+    while (n < len) {
+        if (deadline && !send_deadline(conn, deadline)) {
+            err = ETIMEDOUT;
+            break;
+        }
+
+        ssize_t r = send_file_chunk(conn, fd, offset + n, len - n, deadline);
+        if (r < 0 && would_block(errno)) {
+            if (wait_writable(conn, deadline))
+                continue;
+            r = -1;
+            errno = ETIMEDOUT;
+        }
+
+        if (r <= 0) {
+            err = r < 0 ? errno : 0;
+            break;
+        }
+
+        n += r;
+    }
+
+    if (deadline)
+        send_deadline(conn, 0);
+
+    return n;
+}
+
+static void check_file(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        MWR_REPORT("error sending file: %s", strerror(errno));
+}
+
+// id used to identify the listening socket in the epoll event data
+static const u64 LISTEN_ID = ~0ull;
+
+#ifdef MWR_LINUX
+static epoll_event socket_event(u64 id, bool writable) {
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    if (writable)
+        ev.events |= EPOLLOUT;
+    ev.data.u64 = id;
+    return ev;
+}
+#endif
+
+// writability is only watched on request, otherwise every ACK that frees up
+// send buffer space would wake up the event loop
+static void watch_socket(int epfd, int socket, u64 id, bool writable = false) {
+#ifdef MWR_LINUX
+    epoll_event ev = socket_event(id, writable);
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, socket, &ev) < 0)
+        MWR_REPORT("failed to watch socket: %s", strerror(errno));
+#endif
+}
+
+// fails silently if the socket was unwatched by a concurrent disconnect
+static void rewatch_socket(int epfd, int socket, u64 id, bool writable) {
+#ifdef MWR_LINUX
+    epoll_event ev = socket_event(id, writable);
+    epoll_ctl(epfd, EPOLL_CTL_MOD, socket, &ev);
+#endif
+}
+
+static void unwatch_socket(int epfd, int socket) {
+#ifdef MWR_LINUX
+    if (socket >= 0)
+        epoll_ctl(epfd, EPOLL_CTL_DEL, socket, nullptr);
+#endif
+}
+
 static void create_socket(int family, int n, int& socket, u16& port,
                           string& host) {
     socket = ::socket(family, SOCK_STREAM, 0);
@@ -257,6 +557,7 @@ void socket::disconnect_locked() {
     m_peer.clear();
     m_host.clear();
     m_port = 0;
+    m_gen++;
 }
 
 bool socket::is_connected() const {
@@ -265,7 +566,36 @@ bool socket::is_connected() const {
 }
 
 socket::socket():
-    m_mtx(), m_conn(-1), m_host(), m_peer(), m_ipv6(), m_port(0) {
+    m_mtx(),
+    m_conn(-1),
+    m_host(),
+    m_peer(),
+    m_ipv6(),
+    m_unix(),
+    m_port(0),
+    m_gen(0),
+    m_rxmtx(),
+    m_rxbuf(),
+    m_rxhead(0),
+    m_rxlen(0),
+    m_rxgen(0),
+    m_txmtx(),
+    m_txbuf(),
+    m_txcap(0),
+    m_txgen(0),
+    m_autoflush(true),
+    m_connect_timeout(0),
+    m_send_timeout(0),
+    m_recv_timeout(0),
+    m_busy_spins(0),
+    m_busy_poll_us(0),
+    m_busy(),
+    m_remote(),
+    m_remote_port(0),
+    m_remote_unix(false),
+    m_retries(0),
+    m_backoff_initial(10),
+    m_backoff_max(1000) {
 }
 
 socket::socket(const string& host, u16 port): socket() {
@@ -277,17 +607,67 @@ socket::socket(socket&& other) noexcept:
     m_conn(other.m_conn),
     m_host(std::move(other.m_host)),
     m_peer(std::move(other.m_peer)),
-    m_ipv6(other.m_ipv6) {
+    m_ipv6(other.m_ipv6),
+    m_unix(other.m_unix),
+    m_port(other.m_port),
+    m_gen(other.m_gen),
+    m_rxmtx(),
+    m_rxbuf(std::move(other.m_rxbuf)),
+    m_rxhead(other.m_rxhead),
+    m_rxlen(other.m_rxlen),
+    m_rxgen(other.m_rxgen),
+    m_txmtx(),
+    m_txbuf(std::move(other.m_txbuf)),
+    m_txcap(other.m_txcap),
+    m_txgen(other.m_txgen),
+    m_autoflush(other.m_autoflush.load()),
+    m_connect_timeout(other.m_connect_timeout.load()),
+    m_send_timeout(other.m_send_timeout.load()),
+    m_recv_timeout(other.m_recv_timeout.load()),
+    m_busy_spins(other.m_busy_spins.load()),
+    m_busy_poll_us(other.m_busy_poll_us.load()),
+    m_busy(),
+    m_remote(std::move(other.m_remote)),
+    m_remote_port(other.m_remote_port),
+    m_remote_unix(other.m_remote_unix),
+    m_retries(other.m_retries),
+    m_backoff_initial(other.m_backoff_initial),
+    m_backoff_max(other.m_backoff_max) {
     other.m_conn = -1;
+    other.m_rxlen = 0;
+    other.m_txcap = 0;
 }
 
 socket& socket::operator=(socket&& other) noexcept {
     m_host = std::move(other.m_host);
     m_peer = std::move(other.m_peer);
     m_ipv6 = other.m_ipv6;
+    m_unix = other.m_unix;
     m_port = other.m_port;
     m_conn = other.m_conn;
+    m_gen = other.m_gen;
+    m_rxbuf = std::move(other.m_rxbuf);
+    m_rxhead = other.m_rxhead;
+    m_rxlen = other.m_rxlen;
+    m_rxgen = other.m_rxgen;
+    m_txbuf = std::move(other.m_txbuf);
+    m_txcap = other.m_txcap;
+    m_txgen = other.m_txgen;
+    m_autoflush = other.m_autoflush.load();
+    m_connect_timeout = other.m_connect_timeout.load();
+    m_send_timeout = other.m_send_timeout.load();
+    m_recv_timeout = other.m_recv_timeout.load();
+    m_busy_spins = other.m_busy_spins.load();
+    m_busy_poll_us = other.m_busy_poll_us.load();
+    m_remote = std::move(other.m_remote);
+    m_remote_port = other.m_remote_port;
+    m_remote_unix = other.m_remote_unix;
+    m_retries = other.m_retries;
+    m_backoff_initial = other.m_backoff_initial;
+    m_backoff_max = other.m_backoff_max;
     other.m_conn = -1;
+    other.m_rxlen = 0;
+    other.m_txcap = 0;
     return *this;
 }
 
@@ -296,7 +676,9 @@ socket::~socket() {
     close_socket(m_conn);
 }
 
-void socket::connect(const string& host, u16 port) {
+void socket::connect_once(const string& host, u16 port) {
+    u64 deadline = deadline_from(m_connect_timeout);
+
     lock_guard<mutex> guard(m_mtx);
     if (m_conn >= 0)
         disconnect_locked();
@@ -321,13 +703,17 @@ void socket::connect(const string& host, u16 port) {
             MWR_REPORT("failed to create socket: %s", strerror(errno));
         }
 
-        if (::connect(m_conn, ai->ai_addr, ai->ai_addrlen) < 0) {
-            close_socket(m_conn);
+        socklen_t len = ai->ai_addrlen;
+        if (!connect_deadline(m_conn, ai->ai_addr, len, deadline)) {
+            err = errno;
+            close(m_conn);
+            m_conn = -1;
             continue;
         }
 
         socket_addr addr(ai->ai_addr);
         m_ipv6 = addr.is_ipv6();
+        m_unix = false;
         m_peer = addr.peer();
         m_host = host;
         m_port = port;
@@ -335,8 +721,18 @@ void socket::connect(const string& host, u16 port) {
     }
 
     freeaddrinfo(info);
-    MWR_REPORT_ON(m_peer.empty(), "connect failed: %s", strerror(errno));
+    MWR_REPORT_ON(m_peer.empty(), "connect failed: %s", strerror(err));
     SET_SOCKOPT(m_conn, IPPROTO_TCP, TCP_NODELAY, 1);
+    if (m_busy_poll_us)
+        set_kernel_busy_poll(m_conn, m_busy_poll_us);
+}
+
+void socket::set_busy_poll(size_t spins, unsigned int kernelus) {
+    lock_guard<mutex> guard(m_mtx);
+    m_busy_spins = spins;
+    m_busy_poll_us = kernelus;
+    if (m_conn >= 0 && !m_unix)
+        set_kernel_busy_poll(m_conn, kernelus);
 }
 
 void socket::disconnect() {
@@ -344,7 +740,33 @@ void socket::disconnect() {
     disconnect_locked();
 }
 
-size_t socket::peek(time_t timeoutms) {
+void socket::connect_unix_once(const string& path) {
+    u64 deadline = deadline_from(m_connect_timeout);
+
+    lock_guard<mutex> guard(m_mtx);
+    if (m_conn >= 0)
+        disconnect_locked();
+
+    socket_addr addr(path);
+    socket_t conn = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (conn < 0)
+        MWR_REPORT("failed to create socket: %s", strerror(errno));
+
+    if (!connect_deadline(conn, &addr.base, addr.size(), deadline)) {
+        int err = errno;
+        close(conn);
+        MWR_REPORT("connect to %s failed: %s", path.c_str(), strerror(err));
+    }
+
+    m_conn = conn;
+    m_ipv6 = false;
+    m_unix = true;
+    m_peer = path;
+    m_host = path;
+    m_port = 0;
+}
+
+size_t socket::peek_unbuffered(time_t timeoutms) {
     m_mtx.lock();
     socket_t conn = m_conn;
     m_mtx.unlock();
@@ -356,12 +778,8 @@ size_t socket::peek(time_t timeoutms) {
     if (count == 0)
         return 0;
 
-    m_mtx.lock();
-    conn = m_conn;
-    m_mtx.unlock();
-
     char buf[32];
-    int err = ::recv(conn, buf, sizeof(buf), MSG_PEEK | MSG_DONTWAIT);
+    ssize_t err = ::recv(conn, buf, sizeof(buf), MSG_PEEK | MSG_DONTWAIT);
     if (err <= 0)
         disconnect();
 
@@ -371,7 +789,7 @@ size_t socket::peek(time_t timeoutms) {
     return err;
 }
 
-void socket::send(const void* data, size_t size) {
+void socket::send_unbuffered(const void* data, size_t size) {
     m_mtx.lock();
     socket_t conn = m_conn;
     m_mtx.unlock();
@@ -380,14 +798,24 @@ void socket::send(const void* data, size_t size) {
     const u8* ptr = (const u8*)data;
     size_t n = 0;
 
+    u64 deadline = deadline_from(m_send_timeout);
+    int flags = MSG_NOSIGNAL | (deadline ? MSG_DONTWAIT : 0);
+
     while (n < size) {
-        m_mtx.lock();
-        conn = m_conn;
-        m_mtx.unlock();
+        ssize_t r = ::send(conn, ptr + n, size - n, flags);
+        if (r < 0 && errno == EINTR)
+            continue;
+
+        if (r < 0 && deadline && would_block(errno)) {
+            if (wait_deadline(conn, POLLOUT, deadline))
+                continue;
+            if (n > 0)
+                disconnect();
+            MWR_REPORT("error sending data: timed out");
+        }
 
-        int r = ::send(conn, ptr + n, size - n, MSG_NOSIGNAL);
         if (r <= 0)
-            disconnect_locked();
+            disconnect();
 
         MWR_REPORT_ON(r == 0, "error sending data: disconnected");
         MWR_REPORT_ON(r < 0, "error sending data: %s", strerror(errno));
@@ -396,62 +824,216 @@ void socket::send(const void* data, size_t size) {
     }
 }
 
-void socket::recv(void* data, size_t size) {
+void socket::send_file_unbuffered(int fd, u64 offset, size_t len) {
     m_mtx.lock();
     socket_t conn = m_conn;
     m_mtx.unlock();
-    MWR_REPORT_ON(conn < 0, "error sending data: not connected");
+    MWR_REPORT_ON(conn < 0, "error sending file: not connected");
+    check_file(fd);
+
+    int err = 0;
+    u64 deadline = deadline_from(m_send_timeout);
+    size_t n = send_file_all(conn, fd, offset, len, err, deadline);
+    if (n == len)
+        return;
+
+    // the stream is only intact if nothing has been sent yet
+    if (n > 0)
+        disconnect();
+
+    MWR_REPORT_ON(err == 0, "error sending file: unexpected end of file");
+    MWR_REPORT("error sending file: %s", strerror(err));
+}
+
+size_t socket::recv_unbuffered(void* data, size_t size, bool partial) {
+    m_mtx.lock();
+    socket_t conn = m_conn;
+    m_mtx.unlock();
+    MWR_REPORT_ON(conn < 0, "error receiving data: not connected");
 
     u8* ptr = (u8*)data;
     size_t n = 0;
 
+    u64 deadline = deadline_from(m_recv_timeout);
+    int flags = deadline ? MSG_DONTWAIT : 0;
+    size_t spins = m_busy_spins;
+
     while (n < size) {
-        m_mtx.lock();
-        conn = m_conn;
-        m_mtx.unlock();
+        ssize_t r = -1;
+        if (spins > 0) {
+            r = busy_poll(spins, m_busy, [&](int f) {
+                return ::recv(conn, ptr + n, size - n, flags | f);
+            });
+        }
+
+        if (spins == 0 || (r < 0 && errno == EAGAIN && !deadline))
+            r = ::recv(conn, ptr + n, size - n, flags);
+        if (r < 0 && errno == EINTR)
+            continue;
+
+        if (r < 0 && deadline && would_block(errno)) {
+            if (wait_deadline(conn, POLLIN, deadline))
+                continue;
+            if (n > 0)
+                disconnect();
+            MWR_REPORT("error receiving data: timed out");
+        }
+
+        if (r <= 0)
+            disconnect();
+
+        MWR_REPORT_ON(r == 0, "error receiving data: disconnected");
+        MWR_REPORT_ON(r < 0, "error receiving data: %s", strerror(errno));
+
+        n += r;
+        if (partial)
+            break;
+    }
+
+    return n;
+}
+
+void socket::send_unbuffered(const iovec* iov, size_t iovcnt) {
+    m_mtx.lock();
+    socket_t conn = m_conn;
+    m_mtx.unlock();
+    MWR_REPORT_ON(conn < 0, "error sending data: not connected");
+
+    vector<iovec> vec(iov, iov + iovcnt);
+    size_t idx = iov_advance(vec, 0, 0);
+    size_t n = 0;
+
+    u64 deadline = deadline_from(m_send_timeout);
+    int flags = MSG_NOSIGNAL | (deadline ? MSG_DONTWAIT : 0);
+
+    while (idx < vec.size()) {
+        msghdr msg{};
+        msg.msg_iov = vec.data() + idx;
+        msg.msg_iovlen = min<size_t>(vec.size() - idx, IOV_MAX);
+
+        ssize_t r = ::sendmsg(conn, &msg, flags);
+        if (r < 0 && errno == EINTR)
+            continue;
+
+        if (r < 0 && deadline && would_block(errno)) {
+            if (wait_deadline(conn, POLLOUT, deadline))
+                continue;
+            if (n > 0)
+                disconnect();
+            MWR_REPORT("error sending data: timed out");
+        }
+
+        if (r <= 0)
+            disconnect();
+
+        MWR_REPORT_ON(r == 0, "error sending data: disconnected");
+        MWR_REPORT_ON(r < 0, "error sending data: %s", strerror(errno));
+
+        idx = iov_advance(vec, idx, r);
+        n += r;
+    }
+}
+
+void socket::recv_unbuffered(const iovec* iov, size_t iovcnt) {
+    m_mtx.lock();
+    socket_t conn = m_conn;
+    m_mtx.unlock();
+    MWR_REPORT_ON(conn < 0, "error receiving data: not connected");
+
+    vector<iovec> vec(iov, iov + iovcnt);
+    size_t idx = iov_advance(vec, 0, 0);
+    size_t n = 0;
+
+    u64 deadline = deadline_from(m_recv_timeout);
+    int flags = deadline ? MSG_DONTWAIT : 0;
+    size_t spins = m_busy_spins;
+
+    while (idx < vec.size()) {
+        msghdr msg{};
+        msg.msg_iov = vec.data() + idx;
+        msg.msg_iovlen = min<size_t>(vec.size() - idx, IOV_MAX);
+
+        ssize_t r = -1;
+        if (spins > 0) {
+            r = busy_poll(spins, m_busy, [&](int f) {
+                return ::recvmsg(conn, &msg, flags | f);
+            });
+        }
+
+        if (spins == 0 || (r < 0 && errno == EAGAIN && !deadline))
+            r = ::recvmsg(conn, &msg, flags);
+        if (r < 0 && errno == EINTR)
+            continue;
+
+        if (r < 0 && deadline && would_block(errno)) {
+            if (wait_deadline(conn, POLLIN, deadline))
+                continue;
+            if (n > 0)
+                disconnect();
+            MWR_REPORT("error receiving data: timed out");
+        }
 
-        int r = ::recv(conn, ptr + n, size - n, 0);
         if (r <= 0)
-            disconnect_locked();
+            disconnect();
 
         MWR_REPORT_ON(r == 0, "error receiving data: disconnected");
         MWR_REPORT_ON(r < 0, "error receiving data: %s", strerror(errno));
 
+        idx = iov_advance(vec, idx, r);
         n += r;
     }
 }
 
+server_socket::client_state::~client_state() {
+    close(conn);
+}
+
 server_socket::server_socket(size_t max_clients):
     m_mtx(),
     m_socket(-1),
     m_host(),
     m_port(),
+    m_unix(false),
+    m_epoll(-1),
     m_max_clients(max_clients),
     m_next_client_id(0),
+    m_clients_mtx(),
     m_clients(),
     m_nodelay(false),
     m_ipv6_only(g_no_ipv4 && !g_no_ipv6),
+    m_busy_spins(0),
+    m_busy_poll_us(0),
+    m_busy(),
     m_connect(),
-    m_disconnect() {
+    m_disconnect(),
+    m_readable(),
+    m_writable(),
+    m_hangup() {
+#ifdef MWR_LINUX
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll < 0)
+        MWR_ERROR("failed to create epoll instance: %s", strerror(errno));
+#endif
 }
 
 server_socket::~server_socket() {
     lock_guard guard(m_mtx);
-    close_socket(m_socket);
-    for (auto [client, socket] : m_clients)
-        close_socket(socket);
+    close_listener_locked();
+    for (auto& [client, state] : m_clients)
+        close_client(*state);
+    m_clients.clear();
+    if (m_epoll >= 0)
+        close(m_epoll);
 }
 
 void server_socket::listen(u16 port, const string& addr) {
     lock_guard<mutex> guard(m_mtx);
-    if ((m_socket >= 0) && (port == 0 || port == m_port) &&
+    if ((m_socket >= 0) && !m_unix && (port == 0 || port == m_port) &&
         (addr.empty() || addr == "localhost" || addr == m_host)) {
         return;
     }
 
-    close_socket(m_socket);
-    m_host.clear();
-    m_port = 0;
+    close_listener_locked();
 
     if (g_no_ipv4 && g_no_ipv6)
         MWR_REPORT("IPv4 and IPv6 both disabled via environment");
@@ -469,27 +1051,108 @@ void server_socket::listen(u16 port, const string& addr) {
     string host = addr;
     create_socket(family, m_max_clients, m_socket, port, host);
 
+    try {
+        set_nonblocking(m_socket);
+        watch_socket(m_epoll, m_socket, LISTEN_ID);
+    } catch (...) {
+        close_socket(m_socket);
+        throw;
+    }
+
     m_port = port;
     m_host = host;
 }
 
+void server_socket::listen_unix(const string& path) {
+    lock_guard<mutex> guard(m_mtx);
+    if (m_socket >= 0 && m_unix && m_host == path)
+        return;
+
+    close_listener_locked();
+
+    socket_addr addr(path);
+    m_socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_socket < 0)
+        MWR_REPORT("failed to create socket: %s", strerror(errno));
+
+    // remove stale socket files left behind by previous runs, but never
+    // anything that is not a socket
+    struct stat st;
+    if (!starts_with(path, "@") && stat(path.c_str(), &st) == 0 &&
+        S_ISSOCK(st.st_mode)) {
+        unlink(path.c_str());
+    }
+
+    m_unix = true;
+    if (::bind(m_socket, &addr.base, addr.size())) {
+        int err = errno;
+        close_listener_locked();
+        MWR_REPORT("binding socket to %s failed: %s", path.c_str(),
+                   strerror(err));
+    }
+
+    m_host = path;
+
+    try {
+        if (::listen(m_socket, m_max_clients))
+            MWR_REPORT("listen for connections failed: %s", strerror(errno));
+        set_nonblocking(m_socket);
+        watch_socket(m_epoll, m_socket, LISTEN_ID);
+    } catch (...) {
+        close_listener_locked();
+        throw;
+    }
+}
+
 void server_socket::unlisten() {
     lock_guard<mutex> guard(m_mtx);
-    close_socket(m_socket);
+    close_listener_locked();
+}
+
+void server_socket::close_listener_locked() {
+    if (m_socket >= 0 && m_unix) {
+        // unix sockets keep their name bound until the descriptor is closed
+        // and filesystem sockets leave their node behind
+        if (!m_host.empty() && !starts_with(m_host, "@"))
+            unlink(m_host.c_str());
+        unwatch_socket(m_epoll, m_socket);
+        shutdown(m_socket, SHUT_RDWR);
+        close(m_socket);
+        m_socket = -1;
+    } else {
+        unwatch_socket(m_epoll, m_socket);
+        close_socket(m_socket);
+    }
+
     m_host.clear();
     m_port = 0;
+    m_unix = false;
+}
+
+// wakes up all threads blocked on the client, its descriptor is closed once
+// the last one of them has let go of the client state
+void server_socket::close_client(client_state& state) {
+    unwatch_socket(m_epoll, state.conn);
+    shutdown(state.conn, SHUT_RDWR);
 }
 
 void server_socket::disconnect(int client) {
     disconnect_fn notify_disconnect;
     {
         lock_guard<mutex> guard(m_mtx);
-        auto it = m_clients.find(client);
-        if (it != m_clients.end()) {
-            notify_disconnect = m_disconnect;
-            close_socket(it->second);
+        client_ref state;
+        {
+            unique_lock<shared_mutex> lock(m_clients_mtx);
+            auto it = m_clients.find(client);
+            if (it == m_clients.end())
+                return;
+
+            state = std::move(it->second);
             m_clients.erase(it);
         }
+
+        notify_disconnect = m_disconnect;
+        close_client(*state);
     }
 
     if (notify_disconnect)
@@ -498,48 +1161,150 @@ void server_socket::disconnect(int client) {
 
 void server_socket::disconnect_all() {
     lock_guard<mutex> guard(m_mtx);
-    for (auto& [client, socket] : m_clients)
-        close_socket(socket);
-    m_clients.clear();
+    map<int, client_ref> clients;
+    {
+        unique_lock<shared_mutex> lock(m_clients_mtx);
+        clients.swap(m_clients);
+    }
+
+    for (auto& [client, state] : clients)
+        close_client(*state);
+}
+
+// reads everything the socket currently holds into the receive buffer; with
+// edge-triggered notifications the socket must be drained until it would
+// block, otherwise no further readiness event would be reported for it.
+// Once the buffer is full, the client stays throttled and must be refilled
+// by its reader, since no new edge is reported for data left in the socket.
+void server_socket::fill_locked(client_state& state) {
+    const size_t high_water = client_state::RX_HIGH_WATER;
+    if (state.throttled && state.available() > high_water / 2)
+        return;
+
+    u8 buffer[16 * KiB];
+    state.throttled = false;
+    while (!state.hangup) {
+        if (state.available() >= high_water) {
+            state.throttled = true;
+            break;
+        }
+
+        ssize_t r = ::recv(state.conn, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (r > 0) {
+            state.rxbuf.insert(state.rxbuf.end(), buffer, buffer + r);
+        } else if (r == 0) {
+            state.hangup = true;
+        } else if (errno != EINTR) {
+            if (!would_block(errno)) {
+                state.hangup = true;
+                state.error = errno;
+            }
+
+            break;
+        }
+    }
+}
+
+size_t server_socket::wait_events(size_t ms, vector<int>& writable) {
+    vector<pair<u64, u32>> events;
+
+#ifdef MWR_LINUX
+    epoll_event epevents[64];
+    int res = epoll_wait(m_epoll, epevents, 64, (int)ms);
+    if (res < 0 && errno != EINTR)
+        MWR_REPORT("failed to poll server socket: %s", strerror(errno));
+
+    for (int i = 0; i < res; i++) {
+        u64 id = epevents[i].data.u64;
+        u32 flags = epevents[i].events;
+        events.emplace_back(id, flags);
+    }
+
+    const u32 ev_in = EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR;
+    const u32 ev_out = EPOLLOUT;
+#else
+    // the client references keep descriptors open while polling them
+    vector<pollfd> pollfds;
+    vector<u64> ids;
+    vector<client_ref> refs;
+    {
+        lock_guard<mutex> guard(m_mtx);
+        if (m_socket >= 0) {
+            pollfds.push_back({ m_socket, POLLIN | POLLERR | POLLHUP, 0 });
+            ids.push_back(LISTEN_ID);
+        }
+
+        shared_lock<shared_mutex> lock(m_clients_mtx);
+        for (const auto& [client, state] : m_clients) {
+            short flags = POLLIN | POLLERR | POLLHUP;
+            if (state->on_writable || m_writable)
+                flags |= POLLOUT;
+            pollfds.push_back({ state->conn, flags, 0 });
+            ids.push_back(client);
+            refs.push_back(state);
+        }
+    }
+
+    int res = ::poll(pollfds.data(), pollfds.size(), ms);
+    if (res < 0 && errno != EINTR)
+        MWR_REPORT("failed to poll server socket: %s", strerror(errno));
+
+    for (size_t i = 0; i < pollfds.size(); i++) {
+        if (pollfds[i].revents)
+            events.emplace_back(ids[i], pollfds[i].revents);
+    }
+
+    const u32 ev_in = POLLIN | POLLERR | POLLHUP;
+    const u32 ev_out = POLLOUT;
+#endif
+
+    for (const auto& [id, flags] : events) {
+        if (id == LISTEN_ID) {
+            while (accept_new_client()) {
+                // keep accepting until the backlog is empty
+            }
+
+            continue;
+        }
+
+        int client = (int)id;
+        client_ref state = lookup_state(client);
+        if (!state)
+            continue;
+
+        // threads blocked in recv or peek read the socket themselves
+        lock_guard<std::mutex> guard(state->rxmtx);
+        if ((flags & ev_in) && state->waiters == 0)
+            fill_locked(*state);
+        if (flags & ev_out)
+            writable.push_back(client);
+
+        update_pending_locked(*state);
+    }
+
+    return events.size();
 }
 
 int server_socket::poll(size_t ms) {
     while (true) {
         u64 t = timestamp_ms();
-        int listen_socket = -1;
-        vector<pollfd> pollfds;
+        int client = first_pending();
+        if (client >= 0)
+            return client;
+
         {
             lock_guard<mutex> guard(m_mtx);
-            if (m_socket >= 0) {
-                listen_socket = m_socket;
-                pollfds.push_back({ m_socket, POLLIN | POLLERR | POLLHUP, 0 });
-            }
-
-            for (const auto& [client, socket] : m_clients)
-                pollfds.push_back({ socket, POLLIN | POLLERR | POLLHUP, 0 });
+            if (m_socket < 0 && num_clients() == 0)
+                MWR_REPORT("server socket disconnected");
         }
 
-        if (pollfds.empty())
-            MWR_REPORT("server socket disconnected");
-
-        int res = ::poll(pollfds.data(), pollfds.size(), ms);
-        if (res == 0)
+        vector<int> writable;
+        if (wait_events(ms, writable) == 0)
             return -1;
-        if (res < 0)
-            MWR_REPORT("failed to poll server socket: %s", strerror(errno));
-
-        for (const pollfd& poll : pollfds) {
-            if (poll.revents) {
-                if (poll.fd == listen_socket) {
-                    if (poll.revents & POLLIN)
-                        accept_new_client();
-                } else {
-                    int client = find_client(poll.fd);
-                    if (client >= 0)
-                        return client;
-                }
-            }
-        }
+
+        client = first_pending();
+        if (client >= 0)
+            return client;
 
         u64 delta = timestamp_ms() - t;
         if (delta > ms)
@@ -549,65 +1314,256 @@ int server_socket::poll(size_t ms) {
     }
 }
 
+size_t server_socket::dispatch(size_t ms) {
+    size_t n = dispatch_pending();
+    if (n > 0)
+        return n;
+
+    {
+        lock_guard<mutex> guard(m_mtx);
+        if (m_socket < 0 && num_clients() == 0)
+            MWR_REPORT("server socket disconnected");
+    }
+
+    vector<int> writable;
+    wait_events(ms, writable);
+
+    for (int client : writable) {
+        event_fn fn;
+        {
+            lock_guard<mutex> guard(m_mtx);
+            client_ref state = lookup_state(client);
+            if (!state)
+                continue;
+            fn = state->on_writable ? state->on_writable : m_writable;
+        }
+
+        if (fn) {
+            fn(client);
+            n++;
+        }
+    }
+
+    return n + dispatch_pending();
+}
+
+size_t server_socket::available(int client) {
+    client_ref state = find_state(client);
+    lock_guard<std::mutex> guard(state->rxmtx);
+    if (state->waiters == 0)
+        fill_locked(*state);
+    update_pending_locked(*state);
+    return state->available();
+}
+
 bool server_socket::peek(int client, size_t timeoutms) {
-    socket_t socket = find_socket(client);
+    client_ref state = find_state(client);
+    {
+        lock_guard<std::mutex> guard(state->rxmtx);
+        if (state->available() > 0 || state->hangup)
+            return true;
+        state->waiters++;
+    }
+
     pollfd pfd{};
-    pfd.fd = socket;
+    pfd.fd = state->conn;
     pfd.events = POLLIN | POLLERR | POLLHUP;
     int r = ::poll(&pfd, 1, timeoutms);
-    MWR_REPORT_ON(r < 0, "failed to poll server socket: %s", strerror(errno));
-    return r > 0;
+    int err = errno;
+
+    lock_guard<std::mutex> guard(state->rxmtx);
+    state->waiters--;
+    MWR_REPORT_ON(r < 0, "failed to poll server socket: %s", strerror(err));
+    if (r == 0)
+        return false;
+
+    // the event loop skipped this client while we were waiting, so drain
+    // the socket here, otherwise its data would never get dispatched
+    fill_locked(*state);
+    update_pending_locked(*state);
+    return state->available() > 0 || state->hangup;
 }
 
 void server_socket::send(int client, const void* buffer, size_t buflen) {
+    client_ref state = find_state(client);
     const u8* ptr = (const u8*)buffer;
     size_t n = 0;
+    ssize_t r = 0;
+    int err = 0;
 
-    while (n < buflen) {
-        socket_t conn = find_socket(client);
-        int r = ::send(conn, ptr + n, buflen - n, MSG_NOSIGNAL);
-        if (r <= 0)
-            disconnect(client);
+    {
+        lock_guard<std::mutex> guard(state->txmtx);
+        while (n < buflen) {
+            r = ::send(state->conn, ptr + n, buflen - n, MSG_NOSIGNAL);
+            if (r < 0 && would_block(errno)) {
+                wait_socket(state->conn, POLLOUT);
+                continue;
+            }
+
+            if (r <= 0) {
+                err = errno;
+                break;
+            }
+
+            n += r;
+        }
+    }
 
+    if (n < buflen) {
+        disconnect(client);
         MWR_REPORT_ON(r == 0, "error sending data: disconnected");
-        MWR_REPORT_ON(r < 0, "error sending data: %s", strerror(errno));
+        MWR_REPORT("error sending data: %s", strerror(err));
+    }
+}
 
-        n += r;
+void server_socket::send(int client, const iovec* iov, size_t iovcnt) {
+    client_ref state = find_state(client);
+    vector<iovec> vec(iov, iov + iovcnt);
+    size_t idx = iov_advance(vec, 0, 0);
+    ssize_t r = 0;
+    int err = 0;
+
+    {
+        lock_guard<std::mutex> guard(state->txmtx);
+        while (idx < vec.size()) {
+            msghdr msg{};
+            msg.msg_iov = vec.data() + idx;
+            msg.msg_iovlen = min<size_t>(vec.size() - idx, IOV_MAX);
+
+            r = ::sendmsg(state->conn, &msg, MSG_NOSIGNAL);
+            if (r < 0 && would_block(errno)) {
+                wait_socket(state->conn, POLLOUT);
+                continue;
+            }
+
+            if (r <= 0) {
+                err = errno;
+                break;
+            }
+
+            idx = iov_advance(vec, idx, r);
+        }
+    }
+
+    if (idx < vec.size()) {
+        disconnect(client);
+        MWR_REPORT_ON(r == 0, "error sending data: disconnected");
+        MWR_REPORT("error sending data: %s", strerror(err));
+    }
+}
+
+void server_socket::send_file(int client, int fd, u64 offset, size_t len) {
+    client_ref state = find_state(client);
+    check_file(fd);
+
+    int err = 0;
+    size_t n = 0;
+
+    {
+        lock_guard<std::mutex> guard(state->txmtx);
+        n = send_file_all(state->conn, fd, offset, len, err);
     }
+
+    if (n == len)
+        return;
+
+    // the stream is only intact if nothing has been sent yet
+    if (n > 0)
+        disconnect(client);
+
+    MWR_REPORT_ON(err == 0, "error sending file: unexpected end of file");
+    MWR_REPORT("error sending file: %s", strerror(err));
 }
 
 void server_socket::recv(int client, void* buffer, size_t buflen) {
+    client_ref state = find_state(client);
     u8* ptr = (u8*)buffer;
     size_t n = 0;
+    int err = 0;
 
-    while (n < buflen) {
-        socket_t conn = find_socket(client);
-        int r = ::recv(conn, ptr + n, buflen - n, 0);
-        if (r <= 0)
-            disconnect(client);
+    const size_t spins = m_busy_spins;
+    busy_poll_stats stats{};
 
-        MWR_REPORT_ON(r == 0, "error receiving data: disconnected");
-        MWR_REPORT_ON(r < 0, "error receiving data: %s", strerror(errno));
+    while (true) {
+        {
+            lock_guard<std::mutex> guard(state->rxmtx);
+            n += state->consume(ptr + n, buflen - n);
+            if (n < buflen || state->throttled) {
+                fill_locked(*state);
+                n += state->consume(ptr + n, buflen - n);
+            }
 
-        n += r;
+            update_pending_locked(*state);
+            if (n == buflen) {
+                if (stats.spins > 0 && stats.sleeps == 0)
+                    stats.hits++;
+                m_busy.add(stats);
+                return;
+            }
+
+            if (state->hangup) {
+                err = state->error;
+                break;
+            }
+
+            if (stats.spins < spins && stats.sleeps == 0) {
+                stats.spins++;
+                cpu_yield();
+                continue;
+            }
+
+            state->waiters++;
+        }
+
+        if (spins > 0)
+            stats.sleeps++;
+        wait_socket(state->conn, POLLIN);
+
+        lock_guard<std::mutex> guard(state->rxmtx);
+        state->waiters--;
     }
+
+    m_busy.add(stats);
+    disconnect(client);
+    MWR_REPORT_ON(err == 0, "error receiving data: disconnected");
+    MWR_REPORT("error receiving data: %s", strerror(err));
 }
 
-void server_socket::accept_new_client() {
+void server_socket::watch_writable_locked(int client, client_state& state) {
+    bool writable = state.on_writable || m_writable;
+    rewatch_socket(m_epoll, state.conn, client, writable);
+}
+
+void server_socket::set_busy_poll(size_t spins, unsigned int kernelus) {
     lock_guard<mutex> guard(m_mtx);
-    if (m_socket < 0)
+    m_busy_spins = spins;
+    m_busy_poll_us = kernelus;
+    if (m_unix)
         return;
 
+    shared_lock<shared_mutex> lock(m_clients_mtx);
+    for (const auto& [client, state] : m_clients)
+        set_kernel_busy_poll(state->conn, kernelus);
+}
+
+bool server_socket::accept_new_client() {
+    lock_guard<mutex> guard(m_mtx);
+    if (m_socket < 0)
+        return false;
+
     socket_addr addr;
     socklen_t len = sizeof(addr);
     socket_t conn = ::accept(m_socket, &addr.base, &len);
 
+    if (conn < 0 && would_block(errno))
+        return false;
+
     if (conn < 0)
         MWR_REPORT("failed to accept connection: %s", strerror(errno));
 
-    if (m_clients.size() >= m_max_clients) {
+    if (num_clients() >= m_max_clients) {
         close_socket(conn);
-        return;
+        return true;
     }
 
     connect_fn notify_connect = m_connect;
@@ -628,17 +1584,35 @@ void server_socket::accept_new_client() {
 
     if (!ok) {
         close_socket(conn);
-        return;
+        return true;
     }
 
     try {
-        SET_SOCKOPT(conn, IPPROTO_TCP, TCP_NODELAY, m_nodelay);
+        if (!m_unix)
+            SET_SOCKOPT(conn, IPPROTO_TCP, TCP_NODELAY, m_nodelay);
+        if (!m_unix && m_busy_poll_us)
+            set_kernel_busy_poll(conn, m_busy_poll_us);
     } catch (...) {
         close_socket(conn);
         throw;
     }
 
-    m_clients[client] = conn;
+    // the client must be known before the first readiness event arrives
+    client_ref state = std::make_shared<client_state>(client, conn);
+    {
+        unique_lock<shared_mutex> lock(m_clients_mtx);
+        m_clients.emplace(client, state);
+    }
+
+    try {
+        watch_socket(m_epoll, conn, client, m_writable != nullptr);
+    } catch (...) {
+        unique_lock<shared_mutex> lock(m_clients_mtx);
+        m_clients.erase(client);
+        throw;
+    }
+
+    return true;
 }
 
 } // namespace mwr
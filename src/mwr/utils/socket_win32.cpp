@@ -12,6 +12,7 @@
 
 #include <WinSock2.h>
 #include <WS2tcpip.h>
+#include <io.h>
 
 #define SET_SOCKOPT(s, lvl, opt, set)                                        \
     do {                                                                     \
@@ -31,6 +32,29 @@ static bool g_no_ipv6 = []() {
     return getenv_or_default("MWR_NO_IPv6", false);
 }();
 
+static vector<WSABUF> make_wsabufs(const iovec* iov, size_t iovcnt) {
+    vector<WSABUF> bufs;
+    bufs.reserve(iovcnt);
+    for (size_t i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len > 0)
+            bufs.push_back({ (ULONG)iov[i].iov_len, (CHAR*)iov[i].iov_base });
+    }
+
+    return bufs;
+}
+
+static size_t advance_wsabufs(vector<WSABUF>& bufs, size_t idx, DWORD n) {
+    while (idx < bufs.size() && n >= bufs[idx].len)
+        n -= bufs[idx++].len;
+
+    if (idx < bufs.size()) {
+        bufs[idx].buf += n;
+        bufs[idx].len -= n;
+    }
+
+    return idx;
+}
+
 static void socket_exit() {
     WSACleanup();
 }
@@ -63,6 +87,122 @@ static const char* socket_strerror(DWORD err = WSAGetLastError()) {
     return buffer;
 }
 
+// Polls the receive queue up to spins times and returns once data is
+// available. Windows offers no kernel busy polling for regular sockets.
+static void busy_poll(SOCKET socket, size_t spins,
+                      busy_poll_counters& counters) {
+    busy_poll_stats stats{};
+    u_long avail = 0;
+    while (ioctlsocket(socket, FIONREAD, &avail) == 0 && avail == 0) {
+        if (stats.spins == spins) {
+            stats.sleeps++;
+            break;
+        }
+
+        stats.spins++;
+        cpu_yield();
+    }
+
+    if (stats.spins > 0 && stats.sleeps == 0)
+        stats.hits++;
+
+    counters.add(stats);
+}
+
+// returns the absolute deadline for a timeout, zero if there is none
+static u64 deadline_from(time_t timeoutms) {
+    return timeoutms > 0 ? timestamp_ms() + timeoutms : 0;
+}
+
+// waits for events on a socket, returns false once the deadline has passed
+static bool wait_deadline(SOCKET socket, short events, u64 deadline) {
+    while (true) {
+        u64 now = timestamp_ms();
+        if (now >= deadline)
+            return false;
+
+        WSAPOLLFD pfd{};
+        pfd.fd = socket;
+        pfd.events = events;
+        int r = WSAPoll(&pfd, 1, (INT)min<u64>(deadline - now, INT_MAX));
+        if (r > 0)
+            return true;
+        if (r == SOCKET_ERROR)
+            MWR_REPORT("failed to poll socket: %s", socket_strerror());
+    }
+}
+
+// connects without blocking past the deadline, if there is one
+static bool connect_deadline(SOCKET socket, const sockaddr* addr, int len,
+                             u64 deadline, int& err) {
+    if (!deadline) {
+        if (::connect(socket, addr, len) == 0)
+            return true;
+        err = WSAGetLastError();
+        return false;
+    }
+
+    u_long mode = 1;
+    ioctlsocket(socket, FIONBIO, &mode);
+
+    int r = ::connect(socket, addr, len);
+    err = r == 0 ? 0 : WSAGetLastError();
+    if (err == WSAEWOULDBLOCK) {
+        err = WSAETIMEDOUT;
+        int errlen = sizeof(err);
+        if (wait_deadline(socket, POLLWRNORM, deadline))
+            getsockopt(socket, SOL_SOCKET, SO_ERROR, (char*)&err, &errlen);
+    }
+
+    mode = 0;
+    ioctlsocket(socket, FIONBIO, &mode);
+    return err == 0;
+}
+
+// There is no sendfile for CRT descriptors, so file data is copied through
+// a bounce buffer instead. Returns the number of bytes sent, err is zero if
+// the file ended early. The file position is restored afterwards. Only the
+// waits for buffer space are bounded by the deadline, like for send.
+static size_t send_file_all(SOCKET conn, int fd, u64 offset, size_t len,
+                            DWORD& err, u64 deadline = 0) {
+    vector<char> buf(min<size_t>(len, 64 * KiB));
+    size_t n = 0;
+    err = 0;
+
+    __int64 pos = _lseeki64(fd, 0, SEEK_CUR);
+    if (pos < 0 || _lseeki64(fd, (__int64)offset, SEEK_SET) < 0) {
+        err = ERROR_SEEK;
+        return 0;
+    }
+
+    while (n < len && err == 0) {
+        int r = _read(fd, buf.data(), (unsigned int)min(len - n, buf.size()));
+        if (r <= 0) {
+            err = r < 0 ? ERROR_READ_FAULT : 0;
+            break;
+        }
+
+        for (int sent = 0; sent < r;) {
+            if (deadline && !wait_deadline(conn, POLLWRNORM, deadline)) {
+                err = WSAETIMEDOUT;
+                break;
+            }
+
+            int s = ::send(conn, buf.data() + sent, r - sent, 0);
+            if (s <= 0) {
+                err = WSAGetLastError();
+                break;
+            }
+
+            sent += s;
+            n += s;
+        }
+    }
+
+    _lseeki64(fd, pos, SEEK_SET);
+    return n;
+}
+
 static int af_from_addr(const string& host) {
     sockaddr_in6 addr6;
     if (inet_pton(AF_INET6, host.c_str(), &addr6) == 1)
@@ -249,8 +389,12 @@ static void create_socket(int family, int n, SOCKET& socket, u16& port,
 }
 
 void socket::disconnect_locked() {
+    if (m_conn == INVALID_SOCKET)
+        return;
+
     close_socket(m_conn);
     m_peer.clear();
+    m_gen++;
 }
 
 bool socket::is_connected() const {
@@ -259,7 +403,36 @@ bool socket::is_connected() const {
 }
 
 socket::socket():
-    m_mtx(), m_conn(INVALID_SOCKET), m_host(), m_peer(), m_ipv6(), m_port(0) {
+    m_mtx(),
+    m_conn(INVALID_SOCKET),
+    m_host(),
+    m_peer(),
+    m_ipv6(),
+    m_unix(),
+    m_port(0),
+    m_gen(0),
+    m_rxmtx(),
+    m_rxbuf(),
+    m_rxhead(0),
+    m_rxlen(0),
+    m_rxgen(0),
+    m_txmtx(),
+    m_txbuf(),
+    m_txcap(0),
+    m_txgen(0),
+    m_autoflush(true),
+    m_connect_timeout(0),
+    m_send_timeout(0),
+    m_recv_timeout(0),
+    m_busy_spins(0),
+    m_busy_poll_us(0),
+    m_busy(),
+    m_remote(),
+    m_remote_port(0),
+    m_remote_unix(false),
+    m_retries(0),
+    m_backoff_initial(10),
+    m_backoff_max(1000) {
     socket_init();
 }
 
@@ -273,17 +446,66 @@ socket::socket(socket&& other) noexcept:
     m_host(std::move(other.m_host)),
     m_peer(std::move(other.m_peer)),
     m_ipv6(other.m_ipv6),
-    m_port(other.m_port) {
+    m_unix(other.m_unix),
+    m_port(other.m_port),
+    m_gen(other.m_gen),
+    m_rxmtx(),
+    m_rxbuf(std::move(other.m_rxbuf)),
+    m_rxhead(other.m_rxhead),
+    m_rxlen(other.m_rxlen),
+    m_rxgen(other.m_rxgen),
+    m_txmtx(),
+    m_txbuf(std::move(other.m_txbuf)),
+    m_txcap(other.m_txcap),
+    m_txgen(other.m_txgen),
+    m_autoflush(other.m_autoflush.load()),
+    m_connect_timeout(other.m_connect_timeout.load()),
+    m_send_timeout(other.m_send_timeout.load()),
+    m_recv_timeout(other.m_recv_timeout.load()),
+    m_busy_spins(other.m_busy_spins.load()),
+    m_busy_poll_us(other.m_busy_poll_us.load()),
+    m_busy(),
+    m_remote(std::move(other.m_remote)),
+    m_remote_port(other.m_remote_port),
+    m_remote_unix(other.m_remote_unix),
+    m_retries(other.m_retries),
+    m_backoff_initial(other.m_backoff_initial),
+    m_backoff_max(other.m_backoff_max) {
     other.m_conn = INVALID_SOCKET;
+    other.m_rxlen = 0;
+    other.m_txcap = 0;
 }
 
 socket& socket::operator=(socket&& other) noexcept {
     m_host = std::move(other.m_host);
     m_peer = std::move(other.m_peer);
     m_ipv6 = other.m_ipv6;
+    m_unix = other.m_unix;
     m_port = other.m_port;
     m_conn = other.m_conn;
+    m_gen = other.m_gen;
+    m_rxbuf = std::move(other.m_rxbuf);
+    m_rxhead = other.m_rxhead;
+    m_rxlen = other.m_rxlen;
+    m_rxgen = other.m_rxgen;
+    m_txbuf = std::move(other.m_txbuf);
+    m_txcap = other.m_txcap;
+    m_txgen = other.m_txgen;
+    m_autoflush = other.m_autoflush.load();
+    m_connect_timeout = other.m_connect_timeout.load();
+    m_send_timeout = other.m_send_timeout.load();
+    m_recv_timeout = other.m_recv_timeout.load();
+    m_busy_spins = other.m_busy_spins.load();
+    m_busy_poll_us = other.m_busy_poll_us.load();
+    m_remote = std::move(other.m_remote);
+    m_remote_port = other.m_remote_port;
+    m_remote_unix = other.m_remote_unix;
+    m_retries = other.m_retries;
+    m_backoff_initial = other.m_backoff_initial;
+    m_backoff_max = other.m_backoff_max;
     other.m_conn = INVALID_SOCKET;
+    other.m_rxlen = 0;
+    other.m_txcap = 0;
     return *this;
 }
 
@@ -292,7 +514,9 @@ socket::~socket() {
     close_socket(m_conn);
 }
 
-void socket::connect(const string& host, u16 port) {
+void socket::connect_once(const string& host, u16 port) {
+    u64 deadline = deadline_from(m_connect_timeout);
+
     lock_guard<mutex> guard(m_mtx);
     if (m_conn != INVALID_SOCKET)
         disconnect_locked();
@@ -317,8 +541,8 @@ void socket::connect(const string& host, u16 port) {
             MWR_REPORT("failed to create socket: %s", socket_strerror());
         }
 
-        if (::connect(m_conn, ai->ai_addr, (int)ai->ai_addrlen) < 0) {
-            err = WSAGetLastError();
+        int len = (int)ai->ai_addrlen;
+        if (!connect_deadline(m_conn, ai->ai_addr, len, deadline, err)) {
             closesocket(m_conn);
             m_conn = -1;
             continue;
@@ -337,12 +561,22 @@ void socket::connect(const string& host, u16 port) {
     SET_SOCKOPT(m_conn, IPPROTO_TCP, TCP_NODELAY, 1);
 }
 
+void socket::set_busy_poll(size_t spins, unsigned int kernelus) {
+    lock_guard<mutex> guard(m_mtx);
+    m_busy_spins = spins;
+    m_busy_poll_us = kernelus;
+}
+
 void socket::disconnect() {
     lock_guard<mutex> guard(m_mtx);
     disconnect_locked();
 }
 
-size_t socket::peek(time_t timeoutms) {
+void socket::connect_unix_once(const string& path) {
+    MWR_REPORT("unix domain sockets not supported: %s", path.c_str());
+}
+
+size_t socket::peek_unbuffered(time_t timeoutms) {
     lock_guard<mutex> guard(m_mtx);
     if (m_conn == INVALID_SOCKET)
         return 0;
@@ -354,22 +588,30 @@ size_t socket::peek(time_t timeoutms) {
     return avail;
 }
 
-void socket::send(const void* data, size_t size) {
-    lock_guard<mutex> guard(m_mtx);
-    if (m_conn == INVALID_SOCKET)
+void socket::send_unbuffered(const void* data, size_t size) {
+    m_mtx.lock();
+    socket_t conn = m_conn;
+    m_mtx.unlock();
+    if (conn == INVALID_SOCKET)
         MWR_REPORT("error sending data: not connected");
 
     const char* ptr = (const char*)data;
     size_t n = 0;
 
+    // there is no per-call non-blocking send on Windows, so only the wait
+    // for buffer space is bounded, not a send that fits partially
+    u64 deadline = deadline_from(m_send_timeout);
+
     while (n < size) {
-        socket_t conn = m_conn;
-        m_mtx.unlock();
-        int r = ::send(conn, ptr + n, (int)(size - n), 0);
-        m_mtx.lock();
+        if (deadline && !wait_deadline(conn, POLLWRNORM, deadline)) {
+            if (n > 0)
+                disconnect();
+            MWR_REPORT("error sending data: timed out");
+        }
 
+        int r = ::send(conn, ptr + n, (int)(size - n), 0);
         if (r <= 0)
-            disconnect_locked();
+            disconnect();
 
         MWR_REPORT_ON(r == 0, "error sending data: disconnected");
         MWR_REPORT_ON(r < 0, "error sending data: %s", socket_strerror());
@@ -378,28 +620,144 @@ void socket::send(const void* data, size_t size) {
     }
 }
 
-void socket::recv(void* data, size_t size) {
-    lock_guard<mutex> guard(m_mtx);
-    if (m_conn == INVALID_SOCKET)
+void socket::send_file_unbuffered(int fd, u64 offset, size_t len) {
+    m_mtx.lock();
+    socket_t conn = m_conn;
+    m_mtx.unlock();
+    if (conn == INVALID_SOCKET)
+        MWR_REPORT("error sending file: not connected");
+
+    DWORD err = 0;
+    u64 deadline = deadline_from(m_send_timeout);
+    size_t n = send_file_all(conn, fd, offset, len, err, deadline);
+    if (n == len)
+        return;
+
+    // the stream is only intact if nothing has been sent yet
+    if (n > 0)
+        disconnect();
+
+    MWR_REPORT_ON(err == 0, "error sending file: unexpected end of file");
+    MWR_REPORT("error sending file: %s", socket_strerror(err));
+}
+
+size_t socket::recv_unbuffered(void* data, size_t size, bool partial) {
+    m_mtx.lock();
+    socket_t conn = m_conn;
+    m_mtx.unlock();
+    if (conn == INVALID_SOCKET)
         MWR_REPORT("error receiving data: not connected");
 
     char* ptr = (char*)data;
     size_t n = 0;
 
+    u64 deadline = deadline_from(m_recv_timeout);
+    size_t spins = m_busy_spins;
+
     while (n < size) {
-        socket_t conn = m_conn;
-        m_mtx.unlock();
-        int r = ::recv(conn, ptr + n, (int)(size - n), 0);
-        m_mtx.lock();
+        if (spins > 0)
+            busy_poll(conn, spins, m_busy);
 
+        if (deadline && !wait_deadline(conn, POLLRDNORM, deadline)) {
+            if (n > 0)
+                disconnect();
+            MWR_REPORT("error receiving data: timed out");
+        }
+
+        int r = ::recv(conn, ptr + n, (int)(size - n), 0);
         if (r <= 0)
-            disconnect_locked();
+            disconnect();
 
         MWR_REPORT_ON(r == 0, "error receiving data: disconnected");
         MWR_REPORT_ON(r < 0, "error receiving data: %s", socket_strerror());
 
         n += r;
+        if (partial)
+            break;
     }
+
+    return n;
+}
+
+void socket::send_unbuffered(const iovec* iov, size_t iovcnt) {
+    m_mtx.lock();
+    socket_t conn = m_conn;
+    m_mtx.unlock();
+    if (conn == INVALID_SOCKET)
+        MWR_REPORT("error sending data: not connected");
+
+    vector<WSABUF> bufs = make_wsabufs(iov, iovcnt);
+    size_t idx = 0;
+
+    size_t sent = 0;
+
+    u64 deadline = deadline_from(m_send_timeout);
+
+    while (idx < bufs.size()) {
+        if (deadline && !wait_deadline(conn, POLLWRNORM, deadline)) {
+            if (sent > 0)
+                disconnect();
+            MWR_REPORT("error sending data: timed out");
+        }
+
+        DWORD n = 0;
+        DWORD count = (DWORD)(bufs.size() - idx);
+        int r = WSASend(conn, bufs.data() + idx, count, &n, 0, NULL, NULL);
+        if (r == SOCKET_ERROR || n == 0)
+            disconnect();
+
+        MWR_REPORT_ON(r == SOCKET_ERROR, "error sending data: %s",
+                      socket_strerror());
+        MWR_REPORT_ON(n == 0, "error sending data: disconnected");
+
+        idx = advance_wsabufs(bufs, idx, n);
+        sent += n;
+    }
+}
+
+void socket::recv_unbuffered(const iovec* iov, size_t iovcnt) {
+    m_mtx.lock();
+    socket_t conn = m_conn;
+    m_mtx.unlock();
+    if (conn == INVALID_SOCKET)
+        MWR_REPORT("error receiving data: not connected");
+
+    vector<WSABUF> bufs = make_wsabufs(iov, iovcnt);
+    size_t idx = 0;
+    size_t received = 0;
+
+    u64 deadline = deadline_from(m_recv_timeout);
+    size_t spins = m_busy_spins;
+
+    while (idx < bufs.size()) {
+        if (spins > 0)
+            busy_poll(conn, spins, m_busy);
+
+        if (deadline && !wait_deadline(conn, POLLRDNORM, deadline)) {
+            if (received > 0)
+                disconnect();
+            MWR_REPORT("error receiving data: timed out");
+        }
+
+        DWORD n = 0;
+        DWORD flags = 0;
+        DWORD count = (DWORD)(bufs.size() - idx);
+        int r = WSARecv(conn, bufs.data() + idx, count, &n, &flags, NULL,
+                        NULL);
+        if (r == SOCKET_ERROR || n == 0)
+            disconnect();
+
+        MWR_REPORT_ON(r == SOCKET_ERROR, "error receiving data: %s",
+                      socket_strerror());
+        MWR_REPORT_ON(n == 0, "error receiving data: disconnected");
+
+        idx = advance_wsabufs(bufs, idx, n);
+        received += n;
+    }
+}
+
+server_socket::client_state::~client_state() {
+    closesocket(conn);
 }
 
 server_socket::server_socket(size_t max_clients):
@@ -407,21 +765,31 @@ server_socket::server_socket(size_t max_clients):
     m_socket(-1),
     m_host(),
     m_port(),
+    m_unix(false),
+    m_epoll(-1),
     m_max_clients(max_clients),
     m_next_client_id(0),
+    m_clients_mtx(),
     m_clients(),
     m_nodelay(false),
     m_ipv6_only(g_no_ipv4 && !g_no_ipv6),
+    m_busy_spins(0),
+    m_busy_poll_us(0),
+    m_busy(),
     m_connect(),
-    m_disconnect() {
+    m_disconnect(),
+    m_readable(),
+    m_writable(),
+    m_hangup() {
     socket_init();
 }
 
 server_socket::~server_socket() {
     lock_guard guard(m_mtx);
     close_socket(m_socket);
-    for (auto [client, socket] : m_clients)
-        close_socket(socket);
+    for (auto& [client, state] : m_clients)
+        close_client(*state);
+    m_clients.clear();
 }
 
 void server_socket::listen(u16 port, const string& addr) {
@@ -455,23 +823,44 @@ void server_socket::listen(u16 port, const string& addr) {
     m_host = host;
 }
 
+void server_socket::listen_unix(const string& path) {
+    MWR_REPORT("unix domain sockets not supported: %s", path.c_str());
+}
+
 void server_socket::unlisten() {
     lock_guard<mutex> guard(m_mtx);
+    close_listener_locked();
+}
+
+void server_socket::close_listener_locked() {
     close_socket(m_socket);
     m_host.clear();
     m_port = 0;
 }
 
+// wakes up all threads blocked on the client, its socket is closed once the
+// last one of them has let go of the client state
+void server_socket::close_client(client_state& state) {
+    shutdown(state.conn, SD_BOTH);
+}
+
 void server_socket::disconnect(int client) {
     disconnect_fn notify_disconnect;
     {
         lock_guard<mutex> guard(m_mtx);
-        auto it = m_clients.find(client);
-        if (it != m_clients.end()) {
-            notify_disconnect = m_disconnect;
-            close_socket(it->second);
+        client_ref state;
+        {
+            unique_lock<shared_mutex> lock(m_clients_mtx);
+            auto it = m_clients.find(client);
+            if (it == m_clients.end())
+                return;
+
+            state = std::move(it->second);
             m_clients.erase(it);
         }
+
+        notify_disconnect = m_disconnect;
+        close_client(*state);
     }
 
     if (notify_disconnect)
@@ -480,56 +869,139 @@ void server_socket::disconnect(int client) {
 
 void server_socket::disconnect_all() {
     lock_guard<mutex> guard(m_mtx);
-    for (auto& [client, socket] : m_clients)
-        close_socket(socket);
-    m_clients.clear();
+    map<int, client_ref> clients;
+    {
+        unique_lock<shared_mutex> lock(m_clients_mtx);
+        clients.swap(m_clients);
+    }
+
+    for (auto& [client, state] : clients)
+        close_client(*state);
 }
 
-int server_socket::poll(size_t ms) {
-    while (true) {
-        u64 t = timestamp_ms();
-        SOCKET listen_socket = INVALID_SOCKET;
-        vector<WSAPOLLFD> pollfds;
-        {
-            lock_guard<mutex> guard(m_mtx);
-            if (m_socket != INVALID_SOCKET) {
-                listen_socket = m_socket;
-                pollfds.push_back({ listen_socket, POLLRDNORM, 0 });
-            }
+// WSAPoll has no edge-triggered mode, so readiness is level-triggered here;
+// readable sockets are drained into the receive buffer just like on POSIX,
+// data beyond the high water mark is left to the socket until it is read
+void server_socket::fill_locked(client_state& state) {
+    char buffer[16 * KiB];
+    while (!state.hangup) {
+        if (state.available() >= client_state::RX_HIGH_WATER)
+            break;
+
+        u_long avail = 0;
+        if (ioctlsocket(state.conn, FIONREAD, &avail) == SOCKET_ERROR) {
+            state.hangup = true;
+            state.error = WSAGetLastError();
+            break;
+        }
 
-            for (const auto& [client, socket] : m_clients)
-                pollfds.push_back({ socket, POLLRDNORM, 0 });
+        if (avail == 0)
+            break;
+
+        int len = (int)std::min<u_long>(avail, sizeof(buffer));
+        int r = ::recv(state.conn, buffer, len, 0);
+        if (r <= 0) {
+            state.hangup = true;
+            state.error = r < 0 ? WSAGetLastError() : 0;
+            break;
         }
 
-        if (pollfds.empty())
-            MWR_REPORT("server socket disconnected");
+        state.rxbuf.insert(state.rxbuf.end(), buffer, buffer + r);
+    }
+}
 
-        int res = WSAPoll(pollfds.data(), (ULONG)pollfds.size(), (INT)ms);
-        if (res == 0)
-            return -1;
+size_t server_socket::wait_events(size_t ms, vector<int>& writable) {
+    // the client references keep sockets open while polling them
+    SOCKET listen_socket = INVALID_SOCKET;
+    vector<WSAPOLLFD> pollfds;
+    vector<int> ids;
+    vector<client_ref> refs;
+    {
+        lock_guard<mutex> guard(m_mtx);
+        if (m_socket != INVALID_SOCKET) {
+            listen_socket = m_socket;
+            pollfds.push_back({ listen_socket, POLLRDNORM, 0 });
+            ids.push_back(-1);
+            refs.push_back(nullptr);
+        }
 
-        int err = WSAGetLastError();
-        if (err == WSANOTINITIALISED)
-            return -1;
+        shared_lock<shared_mutex> lock(m_clients_mtx);
+        for (const auto& [client, state] : m_clients) {
+            SHORT flags = POLLRDNORM;
+            if (state->on_writable || m_writable)
+                flags |= POLLWRNORM;
+            pollfds.push_back({ state->conn, flags, 0 });
+            ids.push_back(client);
+            refs.push_back(state);
+        }
+    }
+
+    int res = WSAPoll(pollfds.data(), (ULONG)pollfds.size(), (INT)ms);
+    if (res == 0)
+        return 0;
+
+    int err = WSAGetLastError();
+    if (err == WSANOTINITIALISED)
+        return 0;
+
+    if (res < 0)
+        MWR_REPORT("failed to poll server socket: %s", socket_strerror(err));
 
-        if (res < 0) {
-            MWR_REPORT("failed to poll server socket: %s",
-                       socket_strerror(err));
+    size_t n = 0;
+    for (size_t i = 0; i < pollfds.size(); i++) {
+        const WSAPOLLFD& poll = pollfds[i];
+        if (!poll.revents)
+            continue;
+
+        n++;
+        if (poll.fd == listen_socket) {
+            if (poll.revents & POLLRDNORM)
+                accept_new_client();
+            continue;
         }
 
-        for (const WSAPOLLFD& poll : pollfds) {
-            if (poll.revents) {
-                if (poll.fd == listen_socket) {
-                    if (poll.revents & POLLRDNORM)
-                        accept_new_client();
-                } else {
-                    int client = find_client(poll.fd);
-                    if (client >= 0)
-                        return client;
-                }
+        client_state& state = *refs[i];
+        lock_guard<std::mutex> guard(state.rxmtx);
+        if (state.waiters == 0) {
+            u_long avail = 0;
+            fill_locked(state);
+            if ((poll.revents & (POLLRDNORM | POLLHUP | POLLERR)) &&
+                state.available() == 0 &&
+                ioctlsocket(state.conn, FIONREAD, &avail) == 0 && !avail) {
+                state.hangup = true;
             }
         }
 
+        if (poll.revents & POLLWRNORM)
+            writable.push_back(ids[i]);
+
+        update_pending_locked(state);
+    }
+
+    return n;
+}
+
+int server_socket::poll(size_t ms) {
+    while (true) {
+        u64 t = timestamp_ms();
+        int client = first_pending();
+        if (client >= 0)
+            return client;
+
+        {
+            lock_guard<mutex> guard(m_mtx);
+            if (m_socket == INVALID_SOCKET && num_clients() == 0)
+                MWR_REPORT("server socket disconnected");
+        }
+
+        vector<int> writable;
+        if (wait_events(ms, writable) == 0)
+            return -1;
+
+        client = first_pending();
+        if (client >= 0)
+            return client;
+
         u64 delta = timestamp_ms() - t;
         if (delta > ms)
             return -1;
@@ -538,55 +1010,214 @@ int server_socket::poll(size_t ms) {
     }
 }
 
+size_t server_socket::dispatch(size_t ms) {
+    size_t n = dispatch_pending();
+    if (n > 0)
+        return n;
+
+    {
+        lock_guard<mutex> guard(m_mtx);
+        if (m_socket == INVALID_SOCKET && num_clients() == 0)
+            MWR_REPORT("server socket disconnected");
+    }
+
+    vector<int> writable;
+    wait_events(ms, writable);
+
+    for (int client : writable) {
+        event_fn fn;
+        {
+            lock_guard<mutex> guard(m_mtx);
+            client_ref state = lookup_state(client);
+            if (!state)
+                continue;
+            fn = state->on_writable ? state->on_writable : m_writable;
+        }
+
+        if (fn) {
+            fn(client);
+            n++;
+        }
+    }
+
+    return n + dispatch_pending();
+}
+
+size_t server_socket::available(int client) {
+    client_ref state = find_state(client);
+    lock_guard<std::mutex> guard(state->rxmtx);
+    if (state->waiters == 0)
+        fill_locked(*state);
+    update_pending_locked(*state);
+    return state->available();
+}
+
 bool server_socket::peek(int client, size_t timeoutms) {
-    socket_t socket = find_socket(client);
+    client_ref state = find_state(client);
+    {
+        lock_guard<std::mutex> guard(state->rxmtx);
+        if (state->available() > 0 || state->hangup)
+            return true;
+        state->waiters++;
+    }
+
     WSAPOLLFD pfd{};
-    pfd.fd = socket;
+    pfd.fd = state->conn;
     pfd.events = POLLRDNORM;
     int r = WSAPoll(&pfd, 1, (INT)timeoutms);
+    DWORD err = WSAGetLastError();
+
+    {
+        lock_guard<std::mutex> guard(state->rxmtx);
+        state->waiters--;
+    }
+
     MWR_REPORT_ON(r < 0, "failed to poll server socket: %s",
-                  socket_strerror());
+                  socket_strerror(err));
     return r > 0;
 }
 
 void server_socket::send(int client, const void* buffer, size_t buflen) {
+    client_ref state = find_state(client);
     const char* ptr = (const char*)buffer;
     size_t n = 0;
+    int r = 0;
+    DWORD err = 0;
 
-    while (n < buflen) {
-        socket_t conn = find_socket(client);
-        int r = ::send(conn, ptr + n, (int)(buflen - n), 0);
-        if (r <= 0)
-            disconnect(client);
+    {
+        lock_guard<std::mutex> guard(state->txmtx);
+        while (n < buflen) {
+            r = ::send(state->conn, ptr + n, (int)(buflen - n), 0);
+            if (r <= 0) {
+                err = WSAGetLastError();
+                break;
+            }
+
+            n += r;
+        }
+    }
 
+    if (n < buflen) {
+        disconnect(client);
         MWR_REPORT_ON(r == 0, "error sending data: disconnected");
-        MWR_REPORT_ON(r < 0, "error sending data: %s", socket_strerror());
+        MWR_REPORT("error sending data: %s", socket_strerror(err));
+    }
+}
 
-        n += r;
+void server_socket::send(int client, const iovec* iov, size_t iovcnt) {
+    client_ref state = find_state(client);
+    vector<WSABUF> bufs = make_wsabufs(iov, iovcnt);
+    size_t idx = 0;
+    int r = 0;
+    DWORD n = 0;
+    DWORD err = 0;
+
+    {
+        lock_guard<std::mutex> guard(state->txmtx);
+        while (idx < bufs.size()) {
+            DWORD count = (DWORD)(bufs.size() - idx);
+            n = 0;
+            r = WSASend(state->conn, bufs.data() + idx, count, &n, 0, NULL,
+                        NULL);
+            if (r == SOCKET_ERROR || n == 0) {
+                err = WSAGetLastError();
+                break;
+            }
+
+            idx = advance_wsabufs(bufs, idx, n);
+        }
+    }
+
+    if (idx < bufs.size()) {
+        disconnect(client);
+        MWR_REPORT_ON(r == SOCKET_ERROR, "error sending data: %s",
+                      socket_strerror(err));
+        MWR_REPORT("error sending data: disconnected");
     }
 }
 
+void server_socket::send_file(int client, int fd, u64 offset, size_t len) {
+    client_ref state = find_state(client);
+    DWORD err = 0;
+    size_t n = 0;
+
+    {
+        lock_guard<std::mutex> guard(state->txmtx);
+        n = send_file_all(state->conn, fd, offset, len, err);
+    }
+
+    if (n == len)
+        return;
+
+    // the stream is only intact if nothing has been sent yet
+    if (n > 0)
+        disconnect(client);
+
+    MWR_REPORT_ON(err == 0, "error sending file: unexpected end of file");
+    MWR_REPORT("error sending file: %s", socket_strerror(err));
+}
+
 void server_socket::recv(int client, void* buffer, size_t buflen) {
-    char* ptr = (char*)buffer;
+    client_ref state = find_state(client);
+    u8* ptr = (u8*)buffer;
     size_t n = 0;
+    int r = 0;
+    DWORD err = 0;
 
-    while (n < buflen) {
-        socket_t conn = find_socket(client);
-        int r = ::recv(conn, ptr + n, (int)(buflen - n), 0);
-        if (r <= 0)
-            disconnect(client);
+    while (true) {
+        {
+            lock_guard<std::mutex> guard(state->rxmtx);
+            n += state->consume(ptr + n, buflen - n);
+            update_pending_locked(*state);
+            if (n == buflen)
+                return;
+
+            if (state->hangup) {
+                err = state->error;
+                r = err ? SOCKET_ERROR : 0;
+                break;
+            }
 
-        MWR_REPORT_ON(r == 0, "error receiving data: disconnected");
-        MWR_REPORT_ON(r < 0, "error receiving data: %s", socket_strerror());
+            state->waiters++;
+        }
+
+        if (m_busy_spins > 0)
+            busy_poll(state->conn, m_busy_spins, m_busy);
+
+        r = ::recv(state->conn, (char*)ptr + n, (int)(buflen - n), 0);
+        err = r < 0 ? WSAGetLastError() : 0;
+
+        {
+            lock_guard<std::mutex> guard(state->rxmtx);
+            state->waiters--;
+        }
+
+        if (r <= 0)
+            break;
 
         n += r;
     }
+
+    disconnect(client);
+    MWR_REPORT_ON(r == 0, "error receiving data: disconnected");
+    MWR_REPORT("error receiving data: %s", socket_strerror(err));
+}
+
+// writability is decided each time the sockets are polled
+void server_socket::watch_writable_locked(int, client_state&) {
+    // nothing to do
+}
+
+void server_socket::set_busy_poll(size_t spins, unsigned int kernelus) {
+    lock_guard<mutex> guard(m_mtx);
+    m_busy_spins = spins;
+    m_busy_poll_us = kernelus;
 }
 
-void server_socket::accept_new_client() {
+bool server_socket::accept_new_client() {
     lock_guard<mutex> guard(m_mtx);
     if (m_socket == INVALID_SOCKET)
-        return;
+        return false;
 
     socket_addr addr;
     socklen_t len = sizeof(addr);
@@ -595,9 +1226,9 @@ void server_socket::accept_new_client() {
     if (conn < 0)
         MWR_REPORT("failed to accept connection: %s", socket_strerror());
 
-    if (m_clients.size() >= m_max_clients) {
+    if (num_clients() >= m_max_clients) {
         close_socket(conn);
-        return;
+        return true;
     }
 
     connect_fn notify_connect = m_connect;
@@ -618,7 +1249,7 @@ void server_socket::accept_new_client() {
 
     if (!ok) {
         close_socket(conn);
-        return;
+        return true;
     }
 
     try {
@@ -628,7 +1259,9 @@ void server_socket::accept_new_client() {
         throw;
     }
 
-    m_clients[client] = conn;
+    unique_lock<shared_mutex> lock(m_clients_mtx);
+    m_clients.emplace(client, std::make_shared<client_state>(client, conn));
+    return true;
 }
 
 } // namespace mwr
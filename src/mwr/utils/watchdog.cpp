@@ -0,0 +1,552 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#include "mwr/utils/watchdog.h"
+#include "mwr/core/bitops.h"
+#include "mwr/core/utils.h"
+#include "mwr/stl/strings.h"
+
+#ifdef MWR_LINUX
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#endif
+
+namespace mwr {
+
+using std::chrono::microseconds;
+using std::chrono::nanoseconds;
+
+// Sleeping strategies wake up this much before a deadline at least and spin
+// the rest of the way. Twice the average wakeup latency is used, starting
+// out with the default timer slack of Linux.
+static const u64 WATCHDOG_SLACK_INITIAL_NS = 50000;
+static const u64 WATCHDOG_TAIL_MIN_NS = 5000;
+static const u64 WATCHDOG_TAIL_MAX_NS = 2000000;
+
+// the legacy strategy spins for all deadlines closer than this
+static const std::chrono::milliseconds WATCHDOG_SPIN_THRESHOLD(10);
+
+u64 watchdog::current_tick() const {
+    auto delta = clock_t::now() - m_start;
+    return (u64)std::chrono::duration_cast<microseconds>(delta).count();
+}
+
+u64 watchdog::to_ticks(clock_t::time_point t) const {
+    if (t <= m_start)
+        return 0;
+    return (u64)std::chrono::ceil<microseconds>(t - m_start).count();
+}
+
+watchdog::clock_t::time_point watchdog::to_time(u64 tick) const {
+    return m_start + microseconds(tick);
+}
+
+watchdog::timer* watchdog::lookup(handle h) {
+    u32 idx = (u32)h;
+    u32 gen = (u32)(h >> 32);
+    if (idx >= m_timers.size() || m_timers[idx].generation != gen)
+        return nullptr;
+    timer& t = m_timers[idx];
+    return t.slot != NONE || t.running ? &t : nullptr;
+}
+
+const watchdog::timer* watchdog::lookup(handle h) const {
+    return const_cast<watchdog*>(this)->lookup(h);
+}
+
+watchdog::handle watchdog::alloc(u64 expires, u64 period,
+                                 std::function<void()>&& task) {
+    u32 idx;
+    if (m_free.empty()) {
+        idx = (u32)m_timers.size();
+        m_timers.push_back({});
+        m_timers[idx].generation = 1;
+    } else {
+        idx = m_free.back();
+        m_free.pop_back();
+    }
+
+    timer& t = m_timers[idx];
+    t.expires = expires;
+    t.period = period;
+    t.slot = NONE;
+    t.running = false;
+    t.func = std::move(task);
+
+    m_pending++;
+    link(idx);
+    return (u64)t.generation << 32 | idx;
+}
+
+void watchdog::release(u32 idx) {
+    timer& t = m_timers[idx];
+    if (++t.generation == 0)
+        t.generation = 1;
+    t.slot = NONE;
+    t.running = false;
+    t.func = nullptr;
+    m_free.push_back(idx);
+    m_pending--;
+}
+
+// Every slot of a level covers WHEEL_SLOTS slots of the level below. Timers
+// are kept at the lowest level that can hold them and are moved down once
+// the wheel reaches their slot, until they finally expire from level 0.
+void watchdog::link(u32 idx) {
+    timer& t = m_timers[idx];
+    u64 expires = max(t.expires, m_now);
+    u64 delta = expires - m_now;
+
+    size_t level = 0;
+    while (level + 1 < WHEEL_LEVELS && delta >> (level + 1) * WHEEL_BITS)
+        level++;
+
+    // timers beyond the range of the wheel wait in the last slot of the top
+    // level and get placed again once the wheel has turned far enough
+    u64 pos = expires >> level * WHEEL_BITS;
+    if (delta >> WHEEL_LEVELS * WHEEL_BITS)
+        pos = (m_now >> level * WHEEL_BITS) + WHEEL_SLOTS - 1;
+
+    u32 slot = (u32)(level * WHEEL_SLOTS + (pos & WHEEL_MASK));
+    t.slot = slot;
+    t.next = NONE;
+    t.prev = m_tail[slot];
+    if (t.prev == NONE)
+        m_head[slot] = idx;
+    else
+        m_timers[t.prev].next = idx;
+    m_tail[slot] = idx;
+    m_occupied[level] |= bit(pos & WHEEL_MASK);
+}
+
+void watchdog::unlink(u32 idx) {
+    timer& t = m_timers[idx];
+    u32 slot = t.slot;
+    if (t.prev == NONE)
+        m_head[slot] = t.next;
+    else
+        m_timers[t.prev].next = t.next;
+    if (t.next == NONE)
+        m_tail[slot] = t.prev;
+    else
+        m_timers[t.next].prev = t.prev;
+    if (m_head[slot] == NONE)
+        m_occupied[slot / WHEEL_SLOTS] &= ~bit(slot % WHEEL_SLOTS);
+    t.slot = NONE;
+}
+
+void watchdog::cascade(size_t level) {
+    u64 pos = (m_now >> level * WHEEL_BITS) & WHEEL_MASK;
+    u32 slot = (u32)(level * WHEEL_SLOTS + pos);
+
+    u32 idx = m_head[slot];
+    m_head[slot] = m_tail[slot] = NONE;
+    m_occupied[level] &= ~bit(pos);
+
+    while (idx != NONE) {
+        u32 next = m_timers[idx].next;
+        link(idx);
+        idx = next;
+    }
+
+    if (pos == 0 && level + 1 < WHEEL_LEVELS)
+        cascade(level + 1);
+}
+
+// Finds the next tick at which something needs to happen: either a timer in
+// level 0 expires or a slot in a higher level needs to be moved down.
+bool watchdog::next_expiry(u64& tick) const {
+    bool found = false;
+    for (size_t level = 0; level < WHEEL_LEVELS; level++) {
+        if (!m_occupied[level])
+            continue;
+
+        size_t shift = level * WHEEL_BITS;
+        u64 pos = m_now >> shift;
+        u64 next;
+        if (level == 0) {
+            next = m_now + ctz(ror(m_occupied[0], pos & WHEEL_MASK));
+        } else {
+            u64 rot = ror(m_occupied[level], (pos + 1) & WHEEL_MASK);
+            next = (pos + ctz(rot) + 1) << shift;
+        }
+
+        if (!found || next < tick)
+            tick = next;
+        found = true;
+    }
+
+    return found;
+}
+
+void watchdog::advance(u64 target, vector<expired>& batch) {
+    while (m_now <= target) {
+        u32 slot = (u32)(m_now & WHEEL_MASK);
+        u32 idx = m_head[slot];
+        m_head[slot] = m_tail[slot] = NONE;
+        m_occupied[0] &= ~bit(slot);
+
+        while (idx != NONE) {
+            timer& t = m_timers[idx];
+            u32 next = t.next;
+            u64 id = (u64)t.generation << 32 | idx;
+            batch.push_back({ id, t.period != 0, std::move(t.func) });
+            if (t.period) {
+                t.slot = NONE;
+                t.running = true;
+            } else {
+                release(idx);
+            }
+
+            idx = next;
+        }
+
+        // nothing happens until the next expiry, so skip right to it
+        u64 next = target + 1;
+        if (next_expiry(next))
+            next = min(max(next, m_now + 1), target + 1);
+
+        m_now = next;
+        if ((m_now & WHEEL_MASK) == 0)
+            cascade(1);
+    }
+}
+
+// periodic tasks are armed again unless they got cancelled meanwhile
+void watchdog::rearm(expired& task) {
+    timer* t = task.periodic ? lookup(task.id) : nullptr;
+    if (t == nullptr)
+        return;
+
+    t->running = false;
+    t->func = std::move(task.func);
+    t->expires = max(t->expires + t->period, m_now);
+    link((u32)task.id);
+    notify(t->expires);
+}
+
+void watchdog::run(vector<expired>& batch, unique_lock<mutex>& lock) {
+    if (!m_workers.empty()) {
+        lock_guard<mutex> guard(m_jobmtx);
+        for (expired& task : batch)
+            m_jobs.push_back(std::move(task));
+        m_jobcv.notify_all();
+        batch.clear();
+        return;
+    }
+
+    lock.unlock();
+    for (expired& task : batch)
+        task.func();
+    lock.lock();
+
+    for (expired& task : batch)
+        rearm(task);
+    batch.clear();
+}
+
+// Wakes up the worker if it waits past the given tick, m_mtx must be held.
+// The worker may already be spinning towards its deadline without the lock,
+// so it is also told to give up on that.
+void watchdog::notify(u64 expires) {
+    if (m_sleeping == 0 || expires >= m_sleeping)
+        return;
+
+    m_sleeping = 0;
+    m_earlier = true;
+#ifdef MWR_LINUX
+    if (m_eventfd >= 0) {
+        u64 one = 1;
+        ssize_t r = write(m_eventfd, &one, sizeof(one));
+        (void)r;
+        return;
+    }
+#endif
+    m_cv.notify_one();
+}
+
+// Sleeps until tick has been reached or notify was called, returns false
+// in the latter case. A tick of ~0 means waiting for notify only.
+bool watchdog::wait(u64 tick, unique_lock<mutex>& lock) {
+    bool expired = false;
+
+#ifdef MWR_LINUX
+    if (m_timerfd >= 0) {
+        itimerspec its{};
+        if (tick != ~0ull) {
+            auto delta = to_time(tick) - clock_t::now();
+            auto ns = std::chrono::duration_cast<nanoseconds>(delta).count();
+            ns = max<decltype(ns)>(ns, 1); // zero disarms the timer
+            its.it_value.tv_sec = ns / 1000000000;
+            its.it_value.tv_nsec = ns % 1000000000;
+        }
+
+        timerfd_settime(m_timerfd, 0, &its, nullptr);
+        lock.unlock();
+
+        pollfd fds[2] = { { m_timerfd, POLLIN, 0 }, { m_eventfd, POLLIN, 0 } };
+        if (poll(fds, 2, -1) > 0) {
+            u64 count = 0;
+            if (fds[1].revents & POLLIN) {
+                ssize_t r = read(m_eventfd, &count, sizeof(count));
+                (void)r;
+            }
+
+            if (fds[0].revents & POLLIN) {
+                ssize_t r = read(m_timerfd, &count, sizeof(count));
+                expired = r == sizeof(count);
+            }
+        }
+
+        lock.lock();
+        return expired && !m_earlier;
+    }
+#endif
+
+    if (tick == ~0ull)
+        m_cv.wait(lock);
+    else
+        expired = m_cv.wait_until(lock, to_time(tick)) ==
+                  std::cv_status::timeout;
+
+    return expired && !m_earlier;
+}
+
+// m_sleeping holds the actual deadline, even while waking up early, so that
+// tasks due before it are never delayed by the spin tail
+void watchdog::sleep_until(u64 tick, unique_lock<mutex>& lock) {
+    m_sleeping = tick;
+    m_earlier = false;
+
+    if (tick == ~0ull) {
+        wait(tick, lock);
+        m_sleeping = 0;
+        return;
+    }
+
+    auto deadline = to_time(tick);
+    if (m_wakeup == WATCHDOG_SPIN) {
+        // the condition variable takes quite some time to wakeup on
+        // timeout (measured between 1 and 2ms), so we just spin for
+        // shorter deltas
+        if (deadline - clock_t::now() > WATCHDOG_SPIN_THRESHOLD) {
+            wait(tick, lock);
+            m_sleeping = 0;
+            return;
+        }
+    } else {
+        u64 tail = (u64)(spin_tail().count() + 999) / 1000;
+        if (tick > tail && to_time(tick - tail) > clock_t::now()) {
+            if (!wait(tick - tail, lock)) {
+                m_sleeping = 0;
+                return;
+            }
+
+            // keep track of how late we actually woke up
+            auto late = clock_t::now() - to_time(tick - tail);
+            auto ns = std::chrono::duration_cast<nanoseconds>(late).count();
+            u64 slack = m_slack;
+            m_slack = (7 * slack + (u64)max<decltype(ns)>(ns, 0)) / 8;
+        }
+    }
+
+    lock.unlock();
+    while (clock_t::now() < deadline && !m_earlier)
+        cpu_yield();
+    lock.lock();
+    m_sleeping = 0;
+}
+
+watchdog::handle watchdog::schedule(clock_t::duration delta,
+                                    std::function<void()> task) {
+    lock_guard<mutex> lock(m_mtx);
+    u64 expires = to_ticks(clock_t::now() + delta);
+    handle h = alloc(expires, 0, std::move(task));
+    notify(expires);
+    return h;
+}
+
+watchdog::handle watchdog::schedule_periodic(clock_t::duration period,
+                                             std::function<void()> task) {
+    lock_guard<mutex> lock(m_mtx);
+    auto ticks = std::chrono::ceil<microseconds>(period).count();
+    u64 interval = max<u64>(ticks, 1);
+    u64 expires = current_tick() + interval;
+    handle h = alloc(expires, interval, std::move(task));
+    notify(expires);
+    return h;
+}
+
+bool watchdog::cancel(handle h) {
+    lock_guard<mutex> lock(m_mtx);
+    timer* t = lookup(h);
+    if (t == nullptr)
+        return false;
+
+    if (t->slot != NONE)
+        unlink((u32)h);
+    release((u32)h);
+    return true;
+}
+
+void watchdog::cancel_all() {
+    lock_guard<mutex> lock(m_mtx);
+    for (u32 idx = 0; idx < m_timers.size(); idx++) {
+        if (m_timers[idx].slot != NONE || m_timers[idx].running)
+            release(idx);
+    }
+
+    std::fill(std::begin(m_head), std::end(m_head), NONE);
+    std::fill(std::begin(m_tail), std::end(m_tail), NONE);
+    std::fill(std::begin(m_occupied), std::end(m_occupied), 0);
+}
+
+bool watchdog::is_pending(handle h) const {
+    lock_guard<mutex> lock(m_mtx);
+    return lookup(h) != nullptr;
+}
+
+size_t watchdog::num_pending() const {
+    lock_guard<mutex> lock(m_mtx);
+    return m_pending;
+}
+
+nanoseconds watchdog::spin_tail() const {
+    if (m_wakeup == WATCHDOG_SPIN)
+        return WATCHDOG_SPIN_THRESHOLD;
+
+    u64 tail = min(max(2 * m_slack, WATCHDOG_TAIL_MIN_NS),
+                   WATCHDOG_TAIL_MAX_NS);
+    return nanoseconds(tail);
+}
+
+watchdog::watchdog(const string& name, size_t workers,
+                   watchdog_wakeup wakeup):
+    m_start(clock_t::now()),
+    m_now(0),
+    m_timers(),
+    m_free(),
+    m_pending(0),
+    m_head(),
+    m_tail(),
+    m_occupied(),
+    m_worker(),
+    m_mtx(),
+    m_cv(),
+    m_terminate(false),
+    m_wakeup(wakeup),
+    m_sleeping(0),
+    m_earlier(false),
+    m_slack(WATCHDOG_SLACK_INITIAL_NS),
+    m_timerfd(-1),
+    m_eventfd(-1),
+    m_jobmtx(),
+    m_jobcv(),
+    m_jobs(),
+    m_workers(),
+    m_stopping(false) {
+    std::fill(std::begin(m_head), std::end(m_head), NONE);
+    std::fill(std::begin(m_tail), std::end(m_tail), NONE);
+
+#ifdef MWR_LINUX
+    if (m_wakeup == WATCHDOG_TIMERFD) {
+        m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        m_eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (m_timerfd < 0 || m_eventfd < 0) {
+            if (m_timerfd >= 0)
+                close(m_timerfd);
+            if (m_eventfd >= 0)
+                close(m_eventfd);
+            m_timerfd = m_eventfd = -1;
+        }
+    }
+#endif
+
+    if (m_wakeup == WATCHDOG_TIMERFD && m_timerfd < 0)
+        m_wakeup = WATCHDOG_SLEEP;
+
+    for (size_t i = 0; i < workers; i++) {
+        string worker = mkstr("%s_%zu", name.c_str(), i);
+        m_workers.emplace_back(&watchdog::worker_thread, this, worker);
+    }
+
+    m_worker = std::thread(&watchdog::work, this, name);
+}
+
+watchdog::~watchdog() {
+    m_mtx.lock();
+    m_terminate = true;
+    notify(0);
+    m_mtx.unlock();
+    m_worker.join();
+
+    // workers only stop once all expired tasks have been run
+    m_jobmtx.lock();
+    m_stopping = true;
+    m_jobcv.notify_all();
+    m_jobmtx.unlock();
+    for (std::thread& worker : m_workers)
+        worker.join();
+
+#ifdef MWR_LINUX
+    if (m_timerfd >= 0)
+        close(m_timerfd);
+    if (m_eventfd >= 0)
+        close(m_eventfd);
+#endif
+}
+
+void watchdog::work(const string& name) {
+    mwr::set_thread_name(name);
+    vector<expired> batch;
+    unique_lock<mutex> lock(m_mtx);
+    while (!m_terminate) {
+        // all tasks that expired since the last round run as one batch
+        advance(current_tick(), batch);
+        if (!batch.empty()) {
+            run(batch, lock);
+            continue;
+        }
+
+        u64 next = ~0ull;
+        next_expiry(next);
+        sleep_until(next, lock);
+    }
+
+    advance(current_tick(), batch);
+    run(batch, lock);
+}
+
+void watchdog::worker_thread(const string& name) {
+    mwr::set_thread_name(name);
+    while (true) {
+        expired job;
+        {
+            unique_lock<mutex> lock(m_jobmtx);
+            m_jobcv.wait(lock, [&] { return m_stopping || !m_jobs.empty(); });
+            if (m_jobs.empty())
+                return;
+
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+
+        job.func();
+
+        if (job.periodic) {
+            lock_guard<mutex> lock(m_mtx);
+            rearm(job);
+        }
+    }
+}
+
+} // namespace mwr
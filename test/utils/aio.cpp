@@ -12,6 +12,11 @@
 
 #include "mwr.h"
 
+#ifndef MWR_WINDOWS
+#include <poll.h>
+#include <sys/socket.h>
+#endif
+
 using namespace mwr;
 
 TEST(aio, callback) {
@@ -37,7 +42,8 @@ TEST(aio, callback) {
 
     EXPECT_EQ(fd_write(fds[1], &msg, 1), 1);
 
-    cv.wait(mtx);
+    // the handler may well run before we start waiting for it
+    cv.wait(mtx, [&] { return count > 0; });
     ASSERT_EQ(count, 1) << "handler called multiple times, should be once";
 
     aio_cancel(fds[0]);
@@ -76,3 +82,198 @@ TEST(aio, closing) {
     cv.wait_for(mtx, std::chrono::seconds(10), [&] { return close_detected; });
     EXPECT_TRUE(close_detected);
 }
+
+#ifndef MWR_WINDOWS
+TEST(aio, close_unregistered) {
+    // a registered descriptor must not keep its file open, otherwise the
+    // peer would never see the connection being closed
+    int sv[2]{ -1, -1 };
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    aio_notify(sv[0], [](int) -> void {});
+    close(sv[0]);
+
+    pollfd pfd{ sv[1], POLLIN, 0 };
+    ASSERT_EQ(poll(&pfd, 1, 1000), 1);
+
+    char buf;
+    EXPECT_EQ(read(sv[1], &buf, 1), 0);
+    aio_cancel(sv[0]);
+    close(sv[1]);
+}
+
+TEST(aio, regular_file) {
+    // regular files cannot be watched by epoll, but are always ready
+    std::string path = mkstr("%s/aio_regular_%d", temp_dir().c_str(),
+                             mwr::getpid());
+    int fd = fd_open(path, "w+");
+    ASSERT_GE(fd, 0);
+
+    // the handlers keep their counters alive, since aio_cancel does not
+    // wait for an invocation that is already running on the aio thread
+    auto count = std::make_shared<std::atomic<int>>(0);
+    aio_notify(fd, AIO_READ | AIO_WRITE,
+               [count](int, unsigned int events) -> void {
+                   EXPECT_EQ(events, AIO_READ | AIO_WRITE);
+                   (*count)++;
+               },
+               AIO_ONESHOT);
+
+    for (int i = 0; i < 1000 && *count == 0; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    EXPECT_EQ(*count, 1);
+
+    auto persistent = std::make_shared<std::atomic<int>>(0);
+    aio_notify(fd, [persistent](int) -> void { (*persistent)++; });
+    for (int i = 0; i < 1000 && *persistent < 2; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    EXPECT_GE(*persistent, 2);
+
+    aio_cancel(fd);
+    fd_close(fd);
+    std::remove(path.c_str());
+    EXPECT_EQ(*count, 1);
+}
+#endif
+
+TEST(aio, multiple) {
+    const int n = 16;
+    int fds[n][2];
+    std::atomic<int> count(0);
+
+    for (int i = 0; i < n; i++) {
+        ASSERT_EQ(fd_pipe(fds[i]), 0);
+        aio_notify(fds[i][0], [&count](int fd) -> void {
+            char buf;
+            EXPECT_EQ(fd_read(fd, &buf, 1), 1);
+            count++;
+        });
+    }
+
+    for (int i = 0; i < n; i++)
+        EXPECT_EQ(fd_write(fds[i][1], "x", 1), 1);
+
+    for (int i = 0; i < 1000 && count < n; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    EXPECT_EQ(count, n);
+
+    // replacing a handler takes effect immediately
+    std::atomic<int> replaced(0);
+    aio_notify(fds[0][0], [&replaced](int fd) -> void {
+        char buf;
+        EXPECT_EQ(fd_read(fd, &buf, 1), 1);
+        replaced++;
+    });
+
+    EXPECT_EQ(fd_write(fds[0][1], "y", 1), 1);
+    for (int i = 0; i < 1000 && replaced == 0; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    EXPECT_EQ(replaced, 1);
+    EXPECT_EQ(count, n);
+
+    for (int i = 0; i < n; i++) {
+        aio_cancel(fds[i][0]);
+        fd_close(fds[i][0]);
+        fd_close(fds[i][1]);
+    }
+}
+
+TEST(aio, oneshot) {
+    int fds[2]{ -1, -1 };
+    ASSERT_EQ(fd_pipe(fds), 0);
+
+    std::atomic<int> count(0);
+    std::atomic<unsigned int> events(0);
+    aio_notify(
+        fds[0], AIO_READ,
+        [&](int fd, unsigned int ev) -> void {
+            events = ev;
+            count++;
+        },
+        AIO_ONESHOT);
+
+    // data is never read, a persistent registration would keep firing
+    EXPECT_EQ(fd_write(fds[1], "x", 1), 1);
+    for (int i = 0; i < 1000 && count == 0; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    EXPECT_EQ(count, 1);
+    EXPECT_EQ(events, AIO_READ);
+
+    aio_cancel(fds[0]);
+    fd_close(fds[0]);
+    fd_close(fds[1]);
+}
+
+#ifndef MWR_WINDOWS
+TEST(aio, writable) {
+    int fds[2]{ -1, -1 };
+    ASSERT_EQ(fd_pipe(fds), 0);
+
+    std::atomic<int> count(0);
+    aio_notify(
+        fds[1], AIO_WRITE,
+        [&](int fd, unsigned int ev) -> void {
+            EXPECT_EQ(fd, fds[1]);
+            EXPECT_TRUE(ev & AIO_WRITE);
+            count++;
+        },
+        AIO_ONESHOT);
+
+    for (int i = 0; i < 1000 && count == 0; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    EXPECT_EQ(count, 1);
+
+    fd_close(fds[0]);
+    fd_close(fds[1]);
+}
+
+TEST(aio, workers) {
+    const int n = 4;
+    const int count = 50;
+
+    aio_set_workers(2);
+    EXPECT_EQ(aio_workers(), 2);
+
+    int fds[n][2];
+    std::atomic<int> running[n];
+    std::atomic<int> received(0);
+    std::atomic<bool> overlap(false);
+
+    for (int i = 0; i < n; i++) {
+        ASSERT_EQ(fd_pipe(fds[i]), 0);
+        running[i] = 0;
+        aio_notify(
+            fds[i][0], AIO_READ,
+            [&, i](int fd, unsigned int ev) -> void {
+                // handlers of the same descriptor must never overlap
+                if (running[i]++ > 0)
+                    overlap = true;
+
+                char buf;
+                EXPECT_EQ(fd_read(fd, &buf, 1), 1);
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                received++;
+                running[i]--;
+            },
+            AIO_WORKER);
+    }
+
+    for (int j = 0; j < count; j++) {
+        for (int i = 0; i < n; i++)
+            EXPECT_EQ(fd_write(fds[i][1], "x", 1), 1);
+    }
+
+    for (int i = 0; i < 5000 && received < n * count; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    EXPECT_EQ(received, n * count);
+    EXPECT_FALSE(overlap);
+
+    for (int i = 0; i < n; i++) {
+        aio_cancel(fds[i][0]);
+        fd_close(fds[i][0]);
+        fd_close(fds[i][1]);
+    }
+}
+#endif
@@ -0,0 +1,130 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#include "testing.h"
+
+#include "mwr/utils/concurrent_interval.h"
+#include <random>
+#include <type_traits>
+
+using namespace mwr;
+
+TEST(concurrent_interval, traits) {
+    using tree = concurrent_interval_tree<int>;
+    EXPECT_FALSE(std::is_copy_constructible<tree>::value);
+    EXPECT_FALSE(std::is_copy_assignable<tree>::value);
+}
+
+TEST(concurrent_interval, insert_remove) {
+    concurrent_interval_tree<int> tree;
+    EXPECT_TRUE(tree.empty());
+
+    tree.insert(10, 20, 1);
+    tree.insert(30, 40, 2);
+    tree.insert(30, 40, 3);
+    EXPECT_EQ(tree.size(), 3);
+
+    EXPECT_TRUE(tree.overlaps(15, 16));
+    EXPECT_TRUE(tree.overlaps(35, 36));
+    EXPECT_FALSE(tree.overlaps(21, 29));
+
+    EXPECT_EQ(tree.remove(30, 40), 2);
+    EXPECT_EQ(tree.remove(30, 40), 0);
+    EXPECT_EQ(tree.size(), 1);
+    EXPECT_FALSE(tree.overlaps(35, 36));
+
+    tree.clear();
+    EXPECT_TRUE(tree.empty());
+}
+
+TEST(concurrent_interval, for_each) {
+    concurrent_interval_tree<int> tree;
+    tree.insert(10, 20, 1);
+    tree.insert(15, 25, 2);
+    tree.insert(30, 40, 3);
+
+    std::vector<int> visited;
+    tree.for_each(12, 18, [&](u64 lo, u64 hi, const int& val) {
+        visited.push_back(val);
+    });
+
+    std::sort(visited.begin(), visited.end());
+    std::vector<int> expected = { 1, 2 };
+    EXPECT_EQ(visited, expected);
+}
+
+TEST(concurrent_interval, snapshot) {
+    concurrent_interval_tree<int> tree;
+    tree.insert(10, 20, 1);
+
+    auto snap = tree.read();
+    std::thread writer([&]() {
+        tree.update([](interval_tree<int>& t) {
+            t.clear();
+            t.insert(50, 60, 2);
+        });
+    });
+
+    // the writer must wait until we release our snapshot
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(snap->size(), 1);
+    EXPECT_TRUE(snap->overlaps(10, 20));
+    EXPECT_FALSE(snap->overlaps(50, 60));
+
+    {
+        auto released = std::move(snap);
+    }
+
+    writer.join();
+    EXPECT_FALSE(tree.overlaps(10, 20));
+    EXPECT_TRUE(tree.overlaps(50, 60));
+}
+
+TEST(concurrent_interval, threads) {
+    concurrent_interval_tree<u64> tree;
+    for (u64 i = 0; i < 16; i++)
+        tree.insert(i * 0x100, i * 0x100 + 0xff, i);
+
+    std::atomic<bool> stop(false);
+    std::atomic<size_t> lookups(0);
+
+    auto reader = [&](unsigned int seed) {
+        std::mt19937 rng(seed);
+        while (!stop) {
+            u64 addr = rng() % 0x1000;
+            size_t n = 0;
+            tree.for_each(addr, addr, [&](u64 lo, u64 hi, const u64& val) {
+                EXPECT_EQ(val, lo / 0x100);
+                n++;
+            });
+            EXPECT_LE(n, 1);
+            lookups++;
+        }
+    };
+
+    std::thread t1(reader, 1);
+    std::thread t2(reader, 2);
+
+    for (u64 round = 0; round < 200; round++) {
+        u64 i = round % 16;
+        EXPECT_EQ(tree.remove(i * 0x100, i * 0x100 + 0xff), 1);
+        tree.insert(i * 0x100, i * 0x100 + 0xff, i);
+    }
+
+    while (lookups == 0)
+        std::this_thread::yield();
+
+    stop = true;
+    t1.join();
+    t2.join();
+
+    EXPECT_EQ(tree.size(), 16);
+    EXPECT_GT(lookups, 0);
+}
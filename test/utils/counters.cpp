@@ -0,0 +1,156 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <thread>
+
+#include "testing.h"
+#include "mwr/utils/counters.h"
+
+using namespace mwr;
+
+TEST(counters, counter) {
+    sharded_counter c;
+    EXPECT_EQ(c.sum(), 0);
+
+    c.add();
+    ++c;
+    c += 40;
+    EXPECT_EQ(c.sum(), 42);
+
+    c.reset();
+    EXPECT_EQ(c.sum(), 0);
+    c.add(7);
+    EXPECT_EQ(c.sum(), 7);
+}
+
+TEST(counters, threads) {
+    sharded_counter c;
+    sharded_histogram h;
+
+    const size_t n = 8;
+    const size_t iters = 100000;
+    vector<std::thread> threads;
+    for (size_t t = 0; t < n; t++) {
+        threads.emplace_back([&]() {
+            for (size_t i = 0; i < iters; i++) {
+                c.add();
+                h.record(i % 4);
+            }
+        });
+    }
+
+    for (auto& t : threads)
+        t.join();
+
+    EXPECT_EQ(c.sum(), n * iters);
+
+    histogram_snapshot snap = h.snapshot();
+    EXPECT_EQ(snap.count, n * iters);
+    EXPECT_EQ(snap.sum, n * iters / 4 * (0 + 1 + 2 + 3));
+    EXPECT_EQ(snap.buckets[0], n * iters / 4); // 0
+    EXPECT_EQ(snap.buckets[1], n * iters / 4); // 1
+    EXPECT_EQ(snap.buckets[2], n * iters / 2); // 2 and 3
+}
+
+TEST(counters, retired) {
+    sharded_counter c;
+    c += 5;
+
+    for (int round = 0; round < 4; round++) {
+        std::thread t([&]() { c += 10; });
+        t.join();
+    }
+
+    EXPECT_EQ(c.sum(), 45);
+
+    c.reset();
+    EXPECT_EQ(c.sum(), 0);
+
+    std::thread t([&]() { c.add(); });
+    t.join();
+    EXPECT_EQ(c.sum(), 1);
+}
+
+TEST(counters, histogram) {
+    sharded_histogram h;
+    EXPECT_EQ(h.snapshot().percentile(0.5), 0);
+
+    for (u64 i = 1; i <= 100; i++)
+        h.record(i);
+
+    histogram_snapshot snap = h.snapshot();
+    EXPECT_EQ(h.count(), 100);
+    EXPECT_EQ(h.sum(), 5050);
+    EXPECT_DOUBLE_EQ(snap.mean(), 50.5);
+    EXPECT_EQ(snap.percentile(0.0), 1);
+    EXPECT_EQ(snap.percentile(0.5), 63);
+    EXPECT_EQ(snap.percentile(1.0), 127);
+
+    h.record(~0ull);
+    EXPECT_EQ(h.snapshot().buckets[64], 1);
+    EXPECT_EQ(h.snapshot().percentile(1.0), ~0ull);
+
+    h.reset();
+    EXPECT_EQ(h.count(), 0);
+    EXPECT_EQ(h.sum(), 0);
+}
+
+TEST(counters, registry) {
+    size_t count = stat_registry::count();
+
+    {
+        sharded_counter tx("test.tx");
+        sharded_histogram lat("test.latency");
+        EXPECT_THROW(sharded_counter("test.tx"), mwr::report);
+
+        EXPECT_EQ(stat_registry::count(), count + 2);
+        EXPECT_EQ(stat_registry::find("test.tx"), &tx);
+        EXPECT_EQ(stat_registry::find("test.latency"), &lat);
+        EXPECT_EQ(stat_registry::find("test.nothing"), nullptr);
+
+        tx += 3;
+        lat.record(10);
+
+        std::stringstream ss;
+        stat_registry::print(ss);
+        EXPECT_NE(ss.str().find("test.latency count=1 sum=10"), string::npos);
+        EXPECT_NE(ss.str().find("test.tx      3\n"), string::npos);
+
+        stat_registry::reset_all();
+        EXPECT_EQ(tx.sum(), 0);
+        EXPECT_EQ(lat.count(), 0);
+    }
+
+    EXPECT_EQ(stat_registry::count(), count);
+    EXPECT_EQ(stat_registry::find("test.tx"), nullptr);
+}
+
+TEST(counters, registry_concurrent) {
+    std::atomic<bool> done(false);
+    std::thread t([&]() {
+        while (!done) {
+            std::stringstream ss;
+            stat_registry::print(ss);
+            stat_registry::reset_all();
+        }
+    });
+
+    // statistics come and go while the registry is in use
+    for (int i = 0; i < 1000; i++) {
+        sharded_counter tx("test.churn.tx");
+        sharded_histogram lat("test.churn.latency");
+        tx += i;
+        lat.record(i);
+    }
+
+    done = true;
+    t.join();
+    EXPECT_EQ(stat_registry::find("test.churn.tx"), nullptr);
+}
@@ -264,3 +264,232 @@ TEST(interval, fuzzer) {
         tree.validate();
     }
 }
+
+struct weight_sum {
+    using value_type = u64;
+
+    static value_type identity() { return 0; }
+
+    static value_type map(u64 lo, u64 hi, const u64& weight) {
+        return weight;
+    }
+
+    static value_type combine(value_type a, value_type b) { return a + b; }
+};
+
+TEST(interval, count) {
+    interval_tree<int, ivt_count> tree;
+    tree.insert(10, 20, 1);
+    tree.insert(15, 25, 2);
+    tree.insert(30, 40, 3);
+    tree.insert(5, 12, 4);
+
+    EXPECT_EQ(tree.count(0, 4), 0);
+    EXPECT_EQ(tree.count(11, 11), 2);
+    EXPECT_EQ(tree.count(16, 16), 2);
+    EXPECT_EQ(tree.count(12, 18), 3);
+    EXPECT_EQ(tree.count(26, 29), 0);
+    EXPECT_EQ(tree.count(0, 100), 4);
+    EXPECT_EQ(tree.aggregate(12, 18), 3);
+
+    EXPECT_TRUE(tree.remove(tree.begin()));
+    EXPECT_EQ(tree.count(11, 11), 1);
+    tree.validate();
+}
+
+TEST(interval, aggregate) {
+    interval_tree<u64, weight_sum> tree;
+    tree.insert(10, 20, 1);
+    tree.insert(15, 25, 2);
+    auto it = tree.insert(30, 40, 4);
+
+    EXPECT_EQ(tree.aggregate(0, 9), 0);
+    EXPECT_EQ(tree.aggregate(10, 14), 1);
+    EXPECT_EQ(tree.aggregate(16, 16), 3);
+    EXPECT_EQ(tree.aggregate(0, 100), 7);
+    EXPECT_EQ(tree.count(0, 100), 3);
+
+    *it = 8;
+    tree.refresh(it);
+    EXPECT_EQ(tree.aggregate(0, 100), 11);
+}
+
+// same as weight_sum, but with an inverse to aggregate in O(log n)
+struct weight_group : weight_sum {
+    static value_type inverse(value_type a) { return 0 - a; }
+};
+
+template <typename AGG>
+static void fuzz_aggregates() {
+    interval_tree<u64, AGG> tree;
+    vector<typename interval_tree<u64, AGG>::iterator> elements;
+
+    for (size_t round = 0; round < 20000; round++) {
+        size_t fuzz = (size_t)rand() % 100;
+        if (fuzz < elements.size()) {
+            auto it = elements.begin() + fuzz;
+            EXPECT_TRUE(tree.remove(*it));
+            elements.erase(it);
+        } else {
+            u64 start = (u64)rand() % 100;
+            u64 length = (u64)rand() % 100;
+            elements.push_back(tree.insert(start, start + length, fuzz));
+        }
+
+        tree.validate();
+
+        u64 lo = (u64)rand() % 200;
+        u64 hi = lo + (u64)rand() % 10;
+        size_t count = 0;
+        u64 sum = 0;
+        tree.for_each(lo, hi, [&](u64, u64, const auto& it) {
+            count++;
+            sum += *it;
+        });
+
+        EXPECT_EQ(tree.count(lo, hi), count);
+        EXPECT_EQ(tree.aggregate(lo, hi), sum);
+    }
+}
+
+TEST(interval, aggregate_fuzzer) {
+    fuzz_aggregates<weight_sum>();
+    fuzz_aggregates<weight_group>();
+}
+
+TEST(interval, aggregate_nested) {
+    interval_tree<u64, weight_group> tree;
+    for (u64 i = 0; i < 1000; i++)
+        tree.insert(i, 2000 - i, i);
+
+    EXPECT_EQ(tree.count(1000, 1000), 1000);
+    EXPECT_EQ(tree.aggregate(1000, 1000), 999 * 1000 / 2);
+    EXPECT_EQ(tree.count(0, 0), 1);
+    EXPECT_EQ(tree.count(1999, 2005), 2);
+    EXPECT_EQ(tree.aggregate(1999, 2005), 1);
+
+    auto it = tree.begin();
+    *it = 7;
+    tree.refresh(it);
+    EXPECT_EQ(tree.aggregate(0, 0), 7);
+    tree.validate();
+}
+
+TEST(compact_interval, traits) {
+    using tree = compact_interval_tree<int>;
+    EXPECT_FALSE(std::is_copy_constructible<tree>::value);
+    EXPECT_FALSE(std::is_copy_assignable<tree>::value);
+    EXPECT_TRUE(std::is_move_constructible<tree>::value);
+    EXPECT_TRUE(std::is_move_assignable<tree>::value);
+}
+
+TEST(compact_interval, iterators) {
+    compact_interval_tree<int> tree;
+    tree.insert(3, 4, 3);
+    tree.insert(2, 3, 2);
+    tree.insert(1, 2, 1);
+    tree.insert(3, 6, 4);
+    tree.insert(6, 7, 6);
+    tree.insert(5, 6, 5);
+    tree.insert(7, 8, 7);
+
+    int i = 0;
+    for (auto it = tree.begin(); it != tree.end(); it++)
+        EXPECT_EQ(*it, ++i);
+
+    i = 0;
+    const auto& ctree = tree;
+    for (const auto& val : ctree)
+        EXPECT_EQ(val, ++i);
+
+    EXPECT_TRUE(tree.remove(tree.begin()));
+    EXPECT_TRUE(tree.remove(ctree.begin()));
+    EXPECT_EQ(tree.size(), 5);
+    EXPECT_EQ(*tree.begin(), 3);
+    EXPECT_FALSE(tree.remove(tree.end()));
+}
+
+TEST(compact_interval, lookup) {
+    compact_interval_tree<int> tree;
+    tree.insert(10, 20, 1);
+    tree.insert(30, 40, 2);
+    tree.insert(15, 35, 3);
+
+    EXPECT_EQ(tree.find_overlaps(5, 15).size(), 2);
+    EXPECT_TRUE(tree.find_overlaps(50, 60).empty());
+
+    auto res = tree.find_overlaps(21, 29);
+    ASSERT_EQ(res.size(), 1);
+    EXPECT_EQ(*res[0], 3);
+    EXPECT_EQ(res[0].start(), 15);
+    EXPECT_EQ(res[0].end(), 35);
+
+    EXPECT_TRUE(tree.overlaps(35, 45));
+    EXPECT_FALSE(tree.overlaps(0, 9));
+    EXPECT_FALSE(tree.overlaps(41, 50));
+
+    std::vector<int> visited;
+    tree.for_each(12, 18,
+                  [&](u64, u64, const compact_interval_tree<int>::iterator& it) {
+                      visited.push_back(*it);
+                      *it *= 100;
+                  });
+
+    std::sort(visited.begin(), visited.end());
+    std::vector<int> expected = { 1, 3 };
+    EXPECT_EQ(visited, expected);
+    EXPECT_EQ(*tree.find_overlaps(21, 29)[0], 300);
+}
+
+TEST(compact_interval, move) {
+    compact_interval_tree<std::string> tree;
+    tree.insert(10, 20, "a long string that does not fit into sso buffers");
+    tree.insert(30, 40, "b");
+
+    compact_interval_tree<std::string> moved(std::move(tree));
+    EXPECT_EQ(moved.size(), 2);
+    EXPECT_TRUE(tree.empty());
+    EXPECT_EQ(*moved.find_overlaps(35, 36)[0], "b");
+
+    compact_interval_tree<std::string> assign;
+    assign.insert(50, 60, "c");
+    assign = std::move(moved);
+    EXPECT_EQ(assign.size(), 2);
+    EXPECT_FALSE(assign.overlaps(50, 60));
+
+    assign.clear();
+    EXPECT_TRUE(assign.empty());
+    assign.insert(1, 2, "d");
+    EXPECT_EQ(*assign.begin(), "d");
+}
+
+TEST(compact_interval, fuzzer) {
+    compact_interval_tree<int> tree;
+    interval_tree<int> reference;
+    vector<compact_interval_tree<int>::iterator> elements;
+    vector<interval_tree<int>::iterator> references;
+
+    for (size_t round = 0; round < 100000; round++) {
+        size_t fuzz = (size_t)rand() % 100;
+        if (fuzz < elements.size()) {
+            EXPECT_TRUE(tree.remove(elements[fuzz]));
+            EXPECT_TRUE(reference.remove(references[fuzz]));
+            elements.erase(elements.begin() + fuzz);
+            references.erase(references.begin() + fuzz);
+        } else {
+            u64 start = (u64)rand() % 100;
+            u64 length = (u64)rand() % 100;
+            u64 end = start + length;
+            elements.push_back(tree.insert(start, end, (int)round));
+            references.push_back(reference.insert(start, end, (int)round));
+        }
+
+        tree.validate();
+
+        u64 lo = (u64)rand() % 200;
+        u64 hi = lo + (u64)rand() % 10;
+        EXPECT_EQ(tree.overlaps(lo, hi), reference.overlaps(lo, hi));
+        EXPECT_EQ(tree.find_overlaps(lo, hi).size(),
+                  reference.find_overlaps(lo, hi).size());
+    }
+}
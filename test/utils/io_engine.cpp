@@ -0,0 +1,245 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <thread>
+
+#ifndef MWR_WINDOWS
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include "testing.h"
+#include "mwr/utils/io_engine.h"
+
+using namespace mwr;
+
+class io_engine_test : public ::testing::TestWithParam<bool>
+{
+};
+
+static string temp_file(const string& name) {
+    return mkstr("%s/io_engine_%d_%s", temp_dir().c_str(), mwr::getpid(),
+                 name.c_str());
+}
+
+TEST_P(io_engine_test, file) {
+    io_engine io(8, GetParam());
+    EXPECT_GE(io.depth(), 8);
+
+    string path = temp_file("file");
+    int fd = fd_open(path, "w+");
+    ASSERT_GE(fd, 0);
+
+    const char hello[] = "hello ";
+    const char world[] = "world!";
+    long long r1 = -1, r2 = -1;
+    io.write(fd, hello, 6, 0, [&](long long res) { r1 = res; });
+    io.write(fd, world, 6, 6, [&](long long res) { r2 = res; });
+    EXPECT_EQ(io.pending(), 2);
+
+    io.drain();
+    EXPECT_EQ(io.pending(), 0);
+    EXPECT_EQ(r1, 6);
+    EXPECT_EQ(r2, 6);
+
+    char buf[16] = {};
+    io.read(fd, buf, sizeof(buf), 0, [&](long long res) { r1 = res; });
+    EXPECT_EQ(io.complete(1), 1);
+    EXPECT_EQ(r1, 12);
+    EXPECT_STREQ(buf, "hello world!");
+
+    io.read(-1, buf, sizeof(buf), 0, [&](long long res) { r1 = res; });
+    io.drain();
+    EXPECT_EQ(r1, -EBADF);
+
+    fd_close(fd);
+    std::remove(path.c_str());
+}
+
+TEST_P(io_engine_test, chained) {
+    io_engine io(2, GetParam());
+
+    string path = temp_file("chained");
+    int fd = fd_open(path, "w+");
+    ASSERT_GE(fd, 0);
+
+    // more operations than the ring is deep, each queued from a callback
+    const size_t n = 64;
+    size_t count = 0;
+    std::function<void(long long)> next = [&](long long res) {
+        EXPECT_EQ(res, 1);
+        if (++count < n)
+            io.write(fd, "x", 1, io_engine::CURRENT_POS, next);
+    };
+
+    io.write(fd, "x", 1, io_engine::CURRENT_POS, next);
+    io.drain();
+    EXPECT_EQ(count, n);
+
+    fd_close(fd);
+    std::remove(path.c_str());
+}
+
+TEST_P(io_engine_test, timeout) {
+    io_engine io(4, GetParam());
+
+    vector<int> order;
+    u64 start = timestamp_ms();
+    io.timeout(40 * 1000000ull, [&](long long res) {
+        EXPECT_EQ(res, 0);
+        order.push_back(2);
+    });
+    io.timeout(10 * 1000000ull, [&](long long res) {
+        EXPECT_EQ(res, 0);
+        order.push_back(1);
+    });
+
+    EXPECT_EQ(io.complete(0), 0);
+    EXPECT_EQ(io.complete(1), 1);
+    io.drain();
+
+    EXPECT_GE(timestamp_ms() - start, 40);
+    EXPECT_EQ(order, vector<int>({ 1, 2 }));
+}
+
+TEST_P(io_engine_test, fixed) {
+    io_engine io(4, GetParam());
+
+    string path = temp_file("fixed");
+    int fd = fd_open(path, "w+");
+    ASSERT_GE(fd, 0);
+
+    vector<u8> mem(8 * KiB);
+    io.register_buffers({ { mem.data(), mem.size() } });
+    io.register_files({ fd });
+    EXPECT_EQ(io.num_buffers(), 1);
+    EXPECT_EQ(io.num_files(), 1);
+    EXPECT_TRUE(io.is_registered(fd));
+
+    u8 other[4];
+    EXPECT_THROW(io.read_fixed(fd, 1, mem.data(), 4, 0, nullptr), report);
+    EXPECT_THROW(io.read_fixed(fd, 0, other, 4, 0, nullptr), report);
+    EXPECT_THROW(io.read_fixed(fd, 0, mem.data() + 1, mem.size(), 0, nullptr),
+                 report);
+
+    for (size_t i = 0; i < 4 * KiB; i++)
+        mem[i] = (u8)i;
+
+    long long res = -1;
+    io.write_fixed(fd, 0, mem.data(), 4 * KiB, 0,
+                   [&](long long r) { res = r; });
+    EXPECT_THROW(io.unregister_buffers(), report);
+    io.drain();
+    EXPECT_EQ(res, 4 * KiB);
+
+    io.read_fixed(fd, 0, mem.data() + 4 * KiB, 4 * KiB, 0,
+                  [&](long long r) { res = r; });
+    io.drain();
+    EXPECT_EQ(res, 4 * KiB);
+    EXPECT_EQ(memcmp(mem.data(), mem.data() + 4 * KiB, 4 * KiB), 0);
+
+    io.unregister_files();
+    io.unregister_buffers();
+    EXPECT_EQ(io.num_buffers(), 0);
+    EXPECT_EQ(io.num_files(), 0);
+
+    fd_close(fd);
+    std::remove(path.c_str());
+}
+
+#ifndef MWR_WINDOWS
+TEST_P(io_engine_test, accept) {
+    io_engine io(4, GetParam());
+
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_GE(fd, 0);
+
+    sockaddr_in addr = {};
+    socklen_t len = sizeof(addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(::bind(fd, (sockaddr*)&addr, sizeof(addr)), 0);
+    ASSERT_EQ(::listen(fd, 1), 0);
+    ASSERT_EQ(::getsockname(fd, (sockaddr*)&addr, &len), 0);
+
+    std::thread t([&]() {
+        mwr::socket sock("127.0.0.1", ntohs(addr.sin_port));
+        sock.send("ping", 4);
+    });
+
+    long long conn = -1;
+    io.accept(fd, [&](long long res) { conn = res; });
+    io.drain();
+    t.join();
+
+    ASSERT_GE(conn, 0);
+    char buf[4] = {};
+    io.read((int)conn, buf, 4, io_engine::CURRENT_POS, nullptr);
+    io.drain();
+    EXPECT_EQ(string(buf, 4), "ping");
+
+    close((int)conn);
+    close(fd);
+}
+#endif
+
+INSTANTIATE_TEST_SUITE_P(io_engine, io_engine_test,
+                         ::testing::Values(true, false),
+                         [](const ::testing::TestParamInfo<bool>& info) {
+                             return info.param ? "default" : "fallback";
+                         });
+
+#ifdef MWR_LINUX
+TEST(io_engine, cancel_on_destroy) {
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+
+    char buf[4] = { 'x', 'x', 'x', 'x' };
+    bool called = false;
+    {
+        io_engine io(4);
+        if (!io.is_uring()) {
+            close(fds[0]);
+            close(fds[1]);
+            GTEST_SKIP() << "io_uring not available";
+        }
+
+        io.read(fds[0], buf, sizeof(buf), io_engine::CURRENT_POS,
+                [&](long long) { called = true; });
+        io.timeout(1000000000000ull, [&](long long) { called = true; });
+        io.submit();
+    }
+
+    // the read must be gone, so that the data stays in the pipe
+    ASSERT_EQ(write(fds[1], "ping", 4), 4);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(string(buf, 4), "xxxx");
+    EXPECT_FALSE(called);
+
+    char data[4] = {};
+    EXPECT_EQ(read(fds[0], data, 4), 4);
+    EXPECT_EQ(string(data, 4), "ping");
+
+    close(fds[0]);
+    close(fds[1]);
+}
+#endif
+
+TEST(io_engine, detect) {
+#ifndef MWR_LINUX
+    io_engine io;
+    EXPECT_FALSE(io.is_uring());
+#endif
+
+    io_engine fallback(4, false);
+    EXPECT_FALSE(fallback.is_uring());
+    EXPECT_EQ(fallback.depth(), 4);
+}
@@ -0,0 +1,160 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <thread>
+
+#include "testing.h"
+#include "mwr/utils/msg_channel.h"
+
+using namespace mwr;
+
+TEST(msg_channel, pool) {
+    msg_pool pool(2);
+    EXPECT_EQ(pool.max_free(), 2);
+    EXPECT_EQ(pool.num_free(), 0);
+
+    message a = pool.alloc(16);
+    EXPECT_EQ(a.size(), 16);
+    const u8* data = a.data();
+
+    message b = a;
+    EXPECT_EQ(a.use_count(), 2);
+    EXPECT_EQ(b.data(), data);
+
+    a = message();
+    EXPECT_EQ(pool.num_free(), 0);
+    b = message();
+    EXPECT_EQ(pool.num_free(), 1);
+
+    message c = pool.alloc(8);
+    EXPECT_EQ(c.data(), data);
+    EXPECT_EQ(pool.num_free(), 0);
+
+    message d = pool.alloc(8);
+    message e = pool.alloc(8);
+    c = d = e = message();
+    EXPECT_EQ(pool.num_free(), 2);
+}
+
+TEST(msg_channel, pool_lifetime) {
+    message msg;
+    {
+        msg_pool pool;
+        msg = pool.alloc(4);
+        memcpy(msg.data(), "abcd", 4);
+    }
+
+    EXPECT_EQ(msg.str(), "abcd");
+}
+
+static void roundtrip(msg_framing framing) {
+    server_socket server(1, 0, "127.0.0.1");
+    socket sock(server.host(), server.port());
+    server.poll(1000);
+    ASSERT_EQ(server.num_clients(), 1);
+
+    msg_channel client(sock, framing);
+    msg_channel peer(server, server.clients()[0], framing);
+
+    vector<string> msgs;
+    for (size_t i = 0; i < 1000; i++)
+        msgs.push_back(string(i % 300, 'a' + i % 26));
+    msgs.push_back(string(100 * KiB, 'x'));
+    msgs.push_back("");
+
+    std::thread t([&]() {
+        for (const string& msg : msgs)
+            client.send(msg);
+        client.flush();
+    });
+
+    for (const string& msg : msgs)
+        EXPECT_EQ(peer.recv().str(), msg);
+
+    t.join();
+
+    peer.send("pong");
+    peer.flush();
+    EXPECT_TRUE(client.poll(1000));
+    EXPECT_EQ(client.recv().str(), "pong");
+}
+
+TEST(msg_channel, u32) {
+    roundtrip(MSG_FRAMING_U32);
+}
+
+TEST(msg_channel, varint) {
+    roundtrip(MSG_FRAMING_VARINT);
+}
+
+TEST(msg_channel, batching) {
+    server_socket server(1, 0, "127.0.0.1");
+    socket sock(server.host(), server.port());
+    server.poll(1000);
+
+    msg_channel client(sock, MSG_FRAMING_VARINT);
+    msg_channel peer(server, server.clients()[0], MSG_FRAMING_VARINT);
+
+    client.send("hello");
+    client.send("world");
+    EXPECT_FALSE(peer.poll(10));
+
+    client.flush();
+    EXPECT_TRUE(peer.poll(1000));
+    EXPECT_EQ(peer.recv().str(), "hello");
+    EXPECT_EQ(peer.recv().str(), "world");
+
+    client.set_batch_size(0);
+    EXPECT_EQ(client.batch_size(), 0);
+    client.send("direct");
+    EXPECT_TRUE(peer.poll(1000));
+    EXPECT_EQ(peer.recv().str(), "direct");
+}
+
+TEST(msg_channel, flush_on_destroy) {
+    server_socket server(1, 0, "127.0.0.1");
+    socket sock(server.host(), server.port());
+    server.poll(1000);
+
+    msg_channel peer(server, server.clients()[0]);
+    {
+        msg_channel client(sock);
+        client.send("batched");
+    }
+
+    EXPECT_TRUE(peer.poll(1000));
+    EXPECT_EQ(peer.recv().str(), "batched");
+
+    // a channel without a peer must not throw from its destructor
+    sock.disconnect();
+    {
+        msg_channel client(sock);
+        client.send("lost");
+    }
+}
+
+TEST(msg_channel, max_message) {
+    server_socket server(1, 0, "127.0.0.1");
+    socket sock(server.host(), server.port());
+    server.poll(1000);
+
+    msg_channel client(sock, MSG_FRAMING_U32, 16);
+    msg_channel peer(server, server.clients()[0], MSG_FRAMING_U32, 16);
+    EXPECT_EQ(client.max_message(), 16);
+
+    EXPECT_THROW(client.send(string(17, 'x')), mwr::report);
+
+    client.set_max_message(32);
+    client.send(string(17, 'x'));
+    client.flush();
+
+    EXPECT_THROW(peer.recv(), mwr::report);
+    EXPECT_FALSE(server.is_connected(0));
+}
@@ -63,3 +63,191 @@ TEST(per_thread, threads) {
     t1.join();
     t2.join();
 }
+
+TEST(per_thread_local, has_value) {
+    mwr::per_thread_local<int> data;
+    EXPECT_FALSE(data.has_value());
+    EXPECT_FALSE(data);
+    EXPECT_THROW((void)std::as_const(data).get(), std::out_of_range);
+
+    data = 42;
+    EXPECT_TRUE(data.has_value());
+    EXPECT_EQ(*data, 42);
+    EXPECT_EQ(data.size(), 1);
+
+    data.clear();
+    EXPECT_FALSE(data.has_value());
+    EXPECT_EQ(data.size(), 0);
+}
+
+TEST(per_thread_local, index) {
+    size_t index = mwr::per_thread_index();
+    EXPECT_EQ(mwr::per_thread_index(), index);
+
+    size_t other = index;
+    std::thread t([&]() { other = mwr::per_thread_index(); });
+    t.join();
+    EXPECT_NE(other, index);
+}
+
+TEST(per_thread_local, threads) {
+    std::atomic<long> sum(0);
+    mwr::per_thread_local<int> data(nullptr, [&sum](int& val) { sum += val; });
+    data = -1;
+
+    // enough live threads to need more than one chunk of slots
+    const int n = 40;
+    std::atomic<int> running(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < n; t++) {
+        threads.emplace_back([&data, &running, t]() {
+            EXPECT_FALSE(data.has_value());
+            data = 0;
+            for (int i = 0; i < 1000; i++)
+                (*data) += t;
+            running++;
+            while (running < n)
+                std::this_thread::yield();
+        });
+    }
+
+    for (auto& t : threads)
+        t.join();
+
+    EXPECT_EQ(*data, -1);
+    EXPECT_EQ(data.size(), 1);
+    EXPECT_EQ(sum, 1000l * n * (n - 1) / 2);
+}
+
+TEST(per_thread_local, hooks) {
+    std::atomic<int> inits(0), exits(0);
+    mwr::per_thread_local<int> data([&](int& val) { val = 7; inits++; },
+                                    [&](int& val) { exits += val; });
+
+    EXPECT_EQ(*data, 7);
+    EXPECT_EQ(inits, 1);
+
+    std::thread t([&]() { data = 3; });
+    t.join();
+    EXPECT_EQ(inits, 2);
+    EXPECT_EQ(exits, 3);
+    EXPECT_EQ(data.size(), 1);
+
+    data.clear();
+    EXPECT_EQ(exits, 10);
+    EXPECT_FALSE(data.has_value());
+}
+
+TEST(per_thread_local, exit_on_destroy) {
+    std::atomic<int> exits(0);
+    std::atomic<bool> stop(false);
+    std::thread t;
+    {
+        mwr::per_thread_local<int> data(nullptr,
+                                        [&](int& val) { exits += val; });
+        data = 1;
+        t = std::thread([&]() {
+            data = 2;
+            while (!stop)
+                std::this_thread::yield();
+        });
+
+        while (data.size() < 2)
+            std::this_thread::yield();
+    }
+
+    // values of threads that are still running get their exit hook, too
+    EXPECT_EQ(exits, 3);
+    stop = true;
+    t.join();
+    EXPECT_EQ(exits, 3);
+}
+
+TEST(per_thread_local, index_reuse) {
+    size_t first = 0, second = 0;
+    std::thread t1([&]() { first = mwr::per_thread_index(); });
+    t1.join();
+    std::thread t2([&]() { second = mwr::per_thread_index(); });
+    t2.join();
+    EXPECT_EQ(first, second);
+}
+
+TEST(per_thread_local, outlives_threads) {
+    std::atomic<bool> stop(false);
+    std::thread t;
+    {
+        mwr::per_thread_local<int> data;
+        t = std::thread([&]() {
+            data = 1;
+            while (!stop)
+                std::this_thread::yield();
+        });
+
+        while (data.size() == 0)
+            std::this_thread::yield();
+    }
+
+    // thread exits after data is gone, its exit hook must not run
+    stop = true;
+    t.join();
+}
+
+// destroyed at program exit, after the main thread ran its exit hooks
+static mwr::per_thread_local<int> g_data;
+
+TEST(per_thread_local, static_storage) {
+    g_data = 1;
+    std::thread t([]() { g_data = 2; });
+    t.join();
+    EXPECT_EQ(g_data.size(), 1);
+    EXPECT_EQ(*g_data, 1);
+}
+
+TEST(per_thread, cleanup) {
+    std::vector<int> exited;
+    mwr::per_thread<int> data([](int& val) { val = 5; },
+                              [&exited](int& val) { exited.push_back(val); });
+
+    EXPECT_EQ(*data, 5);
+
+    std::thread t([&]() { data = 9; });
+    t.join();
+    EXPECT_EQ(data.size(), 1);
+    ASSERT_EQ(exited.size(), 1);
+    EXPECT_EQ(exited[0], 9);
+
+    data.clear();
+    EXPECT_EQ(data.size(), 0);
+    EXPECT_EQ(exited.size(), 2);
+}
+
+TEST(per_thread, exit_on_destroy) {
+    std::vector<int> exited;
+    {
+        mwr::per_thread<int> data(nullptr, [&exited](int& val) {
+            exited.push_back(val);
+        });
+
+        data = 1;
+        data[std::thread::id()] = 2;
+    }
+
+    std::sort(exited.begin(), exited.end());
+    EXPECT_EQ(exited, std::vector<int>({ 1, 2 }));
+}
+
+TEST(per_thread, at_exit) {
+    std::vector<int> order;
+    std::thread t([&]() {
+        mwr::per_thread_at_exit([&]() { order.push_back(1); });
+        mwr::u64 id = mwr::per_thread_at_exit([&]() { order.push_back(2); });
+        mwr::per_thread_at_exit([&]() {
+            order.push_back(3);
+            mwr::per_thread_at_exit([&]() { order.push_back(4); });
+        });
+        mwr::per_thread_cancel_exit(id);
+    });
+
+    t.join();
+    EXPECT_EQ(order, std::vector<int>({ 3, 4, 1 }));
+}
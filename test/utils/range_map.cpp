@@ -0,0 +1,176 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#include "testing.h"
+
+#include "mwr/utils/range_map.h"
+
+using namespace mwr;
+
+static vector<std::tuple<u64, u64, int>> dump(const range_map<int>& map) {
+    vector<std::tuple<u64, u64, int>> result;
+    for (auto it = map.begin(); it != map.end(); ++it)
+        result.emplace_back(it.start(), it.end(), *it);
+    return result;
+}
+
+TEST(range_map, assign) {
+    range_map<int> map;
+    EXPECT_TRUE(map.empty());
+
+    auto it = map.assign(10, 19, 1);
+    EXPECT_EQ(it.start(), 10);
+    EXPECT_EQ(it.end(), 19);
+    EXPECT_EQ(*it, 1);
+
+    map.assign(30, 39, 2);
+    EXPECT_EQ(map.size(), 2);
+
+    EXPECT_EQ(map.find(9), map.end());
+    EXPECT_EQ(*map.find(10), 1);
+    EXPECT_EQ(*map.find(19), 1);
+    EXPECT_EQ(map.find(20), map.end());
+    EXPECT_EQ(*map.find(35), 2);
+    EXPECT_EQ(map.find(40), map.end());
+    EXPECT_TRUE(map.contains(15));
+    EXPECT_FALSE(map.contains(25));
+}
+
+TEST(range_map, split) {
+    range_map<int> map;
+    map.assign(0, 99, 1);
+    map.assign(40, 59, 2);
+
+    vector<std::tuple<u64, u64, int>> expect = {
+        { 0, 39, 1 },
+        { 40, 59, 2 },
+        { 60, 99, 1 },
+    };
+
+    EXPECT_EQ(dump(map), expect);
+}
+
+TEST(range_map, trim) {
+    range_map<int> map;
+    map.assign(0, 49, 1);
+    map.assign(50, 99, 2);
+    map.assign(40, 59, 3);
+
+    vector<std::tuple<u64, u64, int>> expect = {
+        { 0, 39, 1 },
+        { 40, 59, 3 },
+        { 60, 99, 2 },
+    };
+
+    EXPECT_EQ(dump(map), expect);
+
+    map.assign(0, 99, 4);
+    EXPECT_EQ(map.size(), 1);
+    EXPECT_EQ(map.begin().start(), 0);
+    EXPECT_EQ(map.begin().end(), 99);
+}
+
+TEST(range_map, coalesce) {
+    range_map<int> map;
+    map.assign(0, 9, 1);
+    map.assign(20, 29, 1);
+    map.assign(10, 19, 1);
+    EXPECT_EQ(map.size(), 1);
+    EXPECT_EQ(map.begin().start(), 0);
+    EXPECT_EQ(map.begin().end(), 29);
+
+    map.assign(10, 19, 2);
+    EXPECT_EQ(map.size(), 3);
+    map.assign(10, 19, 1);
+    EXPECT_EQ(map.size(), 1);
+
+    map.assign(31, 39, 1);
+    EXPECT_EQ(map.size(), 2) << "ranges with gaps must not be merged";
+}
+
+TEST(range_map, erase) {
+    range_map<int> map;
+    map.assign(0, 99, 1);
+    map.erase(40, 59);
+
+    vector<std::tuple<u64, u64, int>> expect = {
+        { 0, 39, 1 },
+        { 60, 99, 1 },
+    };
+
+    EXPECT_EQ(dump(map), expect);
+
+    map.erase(0, 200);
+    EXPECT_TRUE(map.empty());
+}
+
+TEST(range_map, limits) {
+    range_map<int> map;
+    map.assign(0, U64_MAX, 1);
+    map.assign(U64_MAX, U64_MAX, 2);
+    map.assign(0, 0, 3);
+
+    vector<std::tuple<u64, u64, int>> expect = {
+        { 0, 0, 3 },
+        { 1, U64_MAX - 1, 1 },
+        { U64_MAX, U64_MAX, 2 },
+    };
+
+    EXPECT_EQ(dump(map), expect);
+    EXPECT_EQ(*map.find(U64_MAX), 2);
+
+    map.erase(0, U64_MAX);
+    EXPECT_TRUE(map.empty());
+}
+
+TEST(range_map, for_each) {
+    range_map<int> map;
+    map.assign(0, 9, 1);
+    map.assign(10, 19, 2);
+    map.assign(30, 39, 3);
+
+    vector<int> visited;
+    map.for_each(5, 30, [&](u64 lo, u64 hi, const int& val) {
+        visited.push_back(val);
+    });
+
+    vector<int> expect = { 1, 2, 3 };
+    EXPECT_EQ(visited, expect);
+}
+
+TEST(range_map, fuzzer) {
+    const u64 size = 256;
+    range_map<int> map;
+    vector<int> shadow(size, 0);
+
+    for (size_t round = 0; round < 10000; round++) {
+        u64 start = (u64)rand() % size;
+        u64 end = start + (u64)rand() % (size - start);
+        int val = rand() % 4;
+
+        if (val == 0)
+            map.erase(start, end);
+        else
+            map.assign(start, end, val);
+
+        for (u64 i = start; i <= end; i++)
+            shadow[i] = val;
+
+        size_t runs = 0;
+        for (u64 i = 0; i < size; i++) {
+            auto it = map.find(i);
+            ASSERT_EQ(it == map.end() ? 0 : *it, shadow[i]);
+            if (shadow[i] && (i == 0 || shadow[i - 1] != shadow[i]))
+                runs++;
+        }
+
+        ASSERT_EQ(map.size(), runs);
+    }
+}
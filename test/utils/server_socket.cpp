@@ -197,3 +197,246 @@ TEST(server_socket, disconnect_all) {
     worker1.join();
     worker2.join();
 }
+
+static void chatter_thread(mwr::u16 port, size_t count) {
+    try {
+        mwr::socket client;
+        client.connect("localhost", port);
+        std::string data(count, 'a');
+        client.send(data);
+        for (size_t i = 0; i < count; i++)
+            EXPECT_EQ(client.recv_char(), 'a');
+    } catch (...) {
+        return;
+    }
+}
+
+TEST(server_socket, buffered_recv) {
+    mwr::server_socket server(1, 0, "localhost");
+    std::thread worker(chatter_thread, server.port(), 100);
+
+    int client = -1;
+    for (int i = 0; i < 100 && client < 0; i++)
+        client = server.poll(100);
+
+    ASSERT_EQ(client, 0);
+    while (server.available(client) < 100)
+        server.peek(client, 100);
+
+    EXPECT_EQ(server.available(client), 100);
+    for (int i = 0; i < 100; i++)
+        EXPECT_EQ(server.recv_char(client), 'a');
+    EXPECT_EQ(server.available(client), 0);
+
+    server.send(client, std::string(100, 'a'));
+    worker.join();
+
+    EXPECT_EQ(server.poll(1000), client);
+    EXPECT_THROW({ server.recv_char(client); }, std::exception);
+    EXPECT_FALSE(server.is_connected(client));
+}
+
+TEST(server_socket, backpressure) {
+    const size_t size = 8 * mwr::MiB;
+    mwr::server_socket server(1, 0, "localhost");
+    std::thread worker([&]() {
+        mwr::socket sock("localhost", server.port());
+        std::vector<mwr::u8> data(size);
+        for (size_t i = 0; i < size; i++)
+            data[i] = (mwr::u8)i;
+        sock.send(data.data(), data.size());
+    });
+
+    int client = -1;
+    for (int i = 0; i < 100 && client < 0; i++)
+        client = server.poll(100);
+    ASSERT_EQ(client, 0);
+
+    // the sender must be throttled instead of buffering everything
+    while (server.available(client) < mwr::MiB)
+        server.peek(client, 100);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_LT(server.available(client), 2 * mwr::MiB);
+
+    std::vector<mwr::u8> data(size);
+    server.recv(client, data.data(), data.size());
+    for (size_t i = 0; i < size; i++)
+        ASSERT_EQ(data[i], (mwr::u8)i) << "at offset " << i;
+
+    worker.join();
+}
+
+TEST(server_socket, peek_dispatch) {
+    mwr::server_socket server(1, 0, "localhost");
+    size_t received = 0;
+    server.on_readable([&](int client) {
+        std::string s(server.available(client), '\0');
+        server.recv(client, s.data(), s.length());
+        received += s.length();
+    });
+
+    mwr::socket sock("localhost", server.port());
+    int client = -1;
+    for (int i = 0; i < 100 && client < 0; i++) {
+        server.dispatch(10);
+        client = server.num_clients() ? server.clients().front() : -1;
+    }
+
+    ASSERT_GE(client, 0);
+    std::atomic<bool> peeked(false);
+    std::thread peeker([&]() {
+        EXPECT_TRUE(server.peek(client, 5000));
+        peeked = true;
+    });
+
+    // the event loop sees the data while the peeker is still waiting for
+    // it, so it leaves draining the socket to the peeker
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    sock.send("hello", 5);
+    while (!peeked)
+        server.dispatch(1);
+    peeker.join();
+
+    for (int i = 0; i < 100 && received < 5; i++)
+        server.dispatch(10);
+    EXPECT_EQ(received, 5);
+}
+
+TEST(server_socket, dispatch) {
+    const size_t num_clients = 32;
+    const size_t count = 1000;
+
+    mwr::server_socket server(num_clients, 0, "localhost");
+
+    size_t num_hangups = 0;
+    size_t num_writable = 0;
+    mwr::map<int, size_t> received;
+
+    server.on_readable([&](int client) {
+        char buffer[64];
+        size_t n = std::min(server.available(client), sizeof(buffer));
+        server.recv(client, buffer, n);
+        server.send(client, buffer, n);
+        received[client] += n;
+    });
+
+    server.on_writable([&](int client) { num_writable++; });
+    server.on_hangup([&](int client) { num_hangups++; });
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < num_clients; i++)
+        workers.emplace_back(chatter_thread, server.port(), count);
+
+    for (int i = 0; i < 10000 && num_hangups < num_clients; i++)
+        server.dispatch(100);
+
+    for (auto& worker : workers)
+        worker.join();
+
+    EXPECT_EQ(num_hangups, num_clients);
+    EXPECT_GE(num_writable, num_clients);
+    EXPECT_EQ(server.num_clients(), 0);
+    ASSERT_EQ(received.size(), num_clients);
+    for (const auto& [client, n] : received)
+        EXPECT_EQ(n, count);
+}
+
+TEST(server_socket, parallel_clients) {
+    const size_t num_clients = 8;
+    const size_t count = 500;
+
+    mwr::server_socket server(num_clients + 1, 0, "localhost");
+
+    std::vector<mwr::socket> sockets(num_clients + 1);
+    for (auto& sock : sockets)
+        sock.connect(server.host(), server.port());
+
+    for (int i = 0; i < 100 && server.num_clients() <= num_clients; i++)
+        server.poll(10);
+    ASSERT_EQ(server.num_clients(), num_clients + 1);
+
+    // every client is served by its own thread, without any coordination
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < num_clients; i++) {
+        workers.emplace_back([&server, i, count]() {
+            int client = server.clients()[i];
+            for (size_t j = 0; j < count; j++) {
+                mwr::u32 val = 0;
+                server.recv(client, val);
+                server.send(client, val + 1);
+            }
+        });
+
+        workers.emplace_back([&sockets, i, count]() {
+            for (size_t j = 0; j < count; j++) {
+                mwr::u32 val = (mwr::u32)(i * count + j);
+                sockets[i].send(val);
+                sockets[i].recv(val);
+                EXPECT_EQ(val, i * count + j + 1);
+            }
+        });
+    }
+
+    // disconnecting an unrelated client must not disturb the others
+    int victim = server.clients().back();
+    server.disconnect(victim);
+    EXPECT_FALSE(server.is_connected(victim));
+    EXPECT_THROW(server.send_char(victim, 'x'), mwr::report);
+
+    for (auto& worker : workers)
+        worker.join();
+
+    EXPECT_EQ(server.num_clients(), num_clients);
+}
+
+#ifndef MWR_WINDOWS
+static void unix_worker(std::string path) {
+    mwr::socket client;
+    client.connect_unix(path);
+    EXPECT_TRUE(client.is_unix());
+    EXPECT_FALSE(client.is_ipv4());
+    EXPECT_FALSE(client.is_ipv6());
+    EXPECT_EQ(client.peer(), path);
+    client.send_char('a');
+    EXPECT_EQ(client.recv_char(), 'b');
+}
+
+static void unix_server(const std::string& path) {
+    mwr::server_socket server(1);
+    server.listen_unix(path);
+    EXPECT_TRUE(server.is_listening());
+    EXPECT_TRUE(server.is_unix());
+    EXPECT_EQ(server.host(), path);
+    EXPECT_EQ(server.port(), 0);
+
+    std::thread worker(unix_worker, path);
+
+    int client = -1;
+    for (int i = 0; i < 100 && client < 0; i++)
+        client = server.poll(100);
+
+    ASSERT_EQ(client, 0);
+    EXPECT_EQ(server.recv_char(client), 'a');
+    server.send_char(client, 'b');
+    worker.join();
+
+    server.unlisten();
+    EXPECT_FALSE(server.is_listening());
+
+    // the name must be free for reuse after unlisten
+    server.listen_unix(path);
+    EXPECT_TRUE(server.is_listening());
+}
+
+TEST(server_socket, unix_path) {
+    std::string path = mwr::mkstr("/tmp/mwr-test-%d.sock", mwr::getpid());
+    unix_server(path);
+    EXPECT_FALSE(mwr::file_exists(path));
+}
+
+#ifdef MWR_LINUX
+TEST(server_socket, unix_abstract) {
+    unix_server(mwr::mkstr("@mwr-test-%d", mwr::getpid()));
+}
+#endif
+#endif
@@ -0,0 +1,101 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (C) 2026 MachineWare GmbH                                        *
+ * All Rights Reserved                                                        *
+ *                                                                            *
+ * This is work is licensed under the terms described in the LICENSE file     *
+ * found in the root directory of this source tree.                           *
+ *                                                                            *
+ ******************************************************************************/
+
+#include <thread>
+
+#include "testing.h"
+#include "mwr/utils/shm_socket.h"
+
+static void connect_pair(mwr::server_socket& server, mwr::shm_socket& a,
+                         mwr::shm_socket& b) {
+    std::thread t([&]() {
+        int id = server.poll(1000);
+        ASSERT_GE(id, 0);
+        b.accept(server, id);
+    });
+
+    a.connect(server.host(), server.port());
+    t.join();
+}
+
+static void transfer(mwr::shm_socket& a, mwr::shm_socket& b, size_t size) {
+    std::vector<mwr::u8> tx(size), rx(size);
+    for (size_t i = 0; i < size; i++)
+        tx[i] = (mwr::u8)(i * 7 + 3);
+
+    std::thread t([&]() { b.recv(rx.data(), rx.size()); });
+    a.send(tx.data(), tx.size());
+    t.join();
+
+    EXPECT_EQ(tx, rx);
+}
+
+TEST(shm_socket, shared) {
+    mwr::server_socket server(1, 0, "127.0.0.1");
+    mwr::shm_socket client(4 * mwr::KiB);
+    mwr::shm_socket peer;
+
+    connect_pair(server, client, peer);
+    EXPECT_TRUE(client.is_connected());
+    EXPECT_TRUE(peer.is_connected());
+
+#ifdef MWR_LINUX
+    EXPECT_TRUE(client.is_shared());
+    EXPECT_TRUE(peer.is_shared());
+    EXPECT_EQ(peer.ring_size(), client.ring_size());
+#endif
+
+    client.send_char('x');
+    EXPECT_EQ(peer.peek(1000), 1);
+    EXPECT_EQ(peer.recv_char(), 'x');
+
+    peer.send("hello");
+    char buf[6] = {};
+    client.recv(buf, 5);
+    EXPECT_STREQ(buf, "hello");
+
+    // larger than the ring, forces wraparound and blocking on a full ring
+    transfer(client, peer, 100 * mwr::KiB + 17);
+    transfer(peer, client, 100 * mwr::KiB + 17);
+}
+
+TEST(shm_socket, fallback) {
+    mwr::server_socket server(1, 0, "127.0.0.1");
+    mwr::shm_socket client(0);
+    mwr::shm_socket peer;
+
+    connect_pair(server, client, peer);
+    EXPECT_FALSE(client.is_shared());
+    EXPECT_FALSE(peer.is_shared());
+    EXPECT_TRUE(client.is_connected());
+
+    client.send_char('x');
+    EXPECT_EQ(peer.peek(1000), 1);
+    EXPECT_EQ(peer.recv_char(), 'x');
+
+    transfer(client, peer, 64 * mwr::KiB);
+    transfer(peer, client, 64 * mwr::KiB);
+}
+
+TEST(shm_socket, disconnect) {
+    mwr::server_socket server(1, 0, "127.0.0.1");
+    mwr::shm_socket client(4 * mwr::KiB);
+    mwr::shm_socket peer;
+
+    connect_pair(server, client, peer);
+    client.send_char('x');
+    client.disconnect();
+    EXPECT_FALSE(client.is_connected());
+
+    // pending data can still be read, afterwards the hangup is reported
+    EXPECT_EQ(peer.recv_char(), 'x');
+    EXPECT_THROW(peer.recv_char(), mwr::report);
+    EXPECT_FALSE(peer.is_connected());
+}
@@ -128,3 +128,378 @@ TEST(socket, move_assign) {
     moved.recv(buf, sizeof(buf) - 1);
     EXPECT_EQ(strcmp(str, buf), 0);
 }
+
+TEST(socket, buffered) {
+    mwr::server_socket server(1, 0);
+    mwr::socket client(server.host(), server.port());
+    client.set_buffered(16, 64);
+    EXPECT_TRUE(client.is_buffered());
+
+    server.poll(100);
+    EXPECT_EQ(server.num_clients(), 1);
+
+    server.send(0, "first line\r\nsecond line\nthird|");
+    EXPECT_EQ(client.read_line(), "first line");
+    EXPECT_EQ(client.read_line(), "second line");
+    EXPECT_EQ(client.read_until('|'), "third|");
+
+    server.send(0, "abc");
+    EXPECT_EQ(client.recv_char(), 'a');
+    EXPECT_EQ(client.peek(), 2);
+    EXPECT_EQ(client.recv_char(), 'b');
+    EXPECT_EQ(client.recv_char(), 'c');
+
+    std::string large(1000, 'x');
+    server.send(0, large);
+    std::string received(large.length(), 0);
+    client.recv(received.data(), received.length());
+    EXPECT_EQ(received, large);
+
+    client.set_autoflush(false);
+    client.send("hello");
+    client.send_char(' ');
+    EXPECT_FALSE(server.peek(0, 10));
+    client.flush();
+
+    char buf[7] = {};
+    server.recv(0, buf, 6);
+    EXPECT_STREQ(buf, "hello ");
+
+    client.set_autoflush(true);
+    client.send("ping");
+    server.send(0, "pong");
+    EXPECT_EQ(client.read_until('g'), "pong");
+    server.recv(0, buf, 4);
+    EXPECT_EQ(std::string(buf, 4), "ping");
+
+    client.set_unbuffered();
+    EXPECT_FALSE(client.is_buffered());
+    server.send(0, "unbuffered\n");
+    EXPECT_EQ(client.read_line(), "unbuffered");
+}
+
+TEST(socket, buffered_disconnect) {
+    mwr::server_socket server(1, 0);
+    mwr::socket client(server.host(), server.port());
+    client.set_buffered();
+
+    server.poll(100);
+    server.send(0, "abc");
+    EXPECT_EQ(client.recv_char(), 'a');
+
+    client.disconnect();
+    EXPECT_THROW(client.recv_char(), mwr::report);
+    EXPECT_EQ(client.peek(), 0);
+}
+
+TEST(socket, buffered_reconnect) {
+    mwr::server_socket server(2, 0);
+    mwr::socket client(server.host(), server.port());
+    client.set_buffered();
+    client.set_autoflush(false);
+    client.send("stale");
+
+    client.disconnect();
+    client.reconnect();
+    while (!server.is_connected(1))
+        server.poll(100);
+
+    // shrinking the buffer must not flush data of the old connection
+    client.set_unbuffered();
+    client.send("new");
+
+    char buf[4] = {};
+    server.recv(1, buf, 3);
+    EXPECT_STREQ(buf, "new");
+}
+
+TEST(socket, vectored) {
+    mwr::server_socket server(1, 0);
+    mwr::socket client(server.host(), server.port());
+    server.poll(100);
+    EXPECT_EQ(server.num_clients(), 1);
+
+    char hdr[] = "$";
+    char payload[] = "payload";
+    char csum[] = "#2a";
+
+    mwr::iovec iov[] = {
+        { hdr, 1 },
+        { nullptr, 0 },
+        { payload, 7 },
+        { csum, 3 },
+    };
+
+    client.send(iov, 4);
+
+    char a[4] = {}, b[8] = {};
+    mwr::iovec riov[] = { { a, 3 }, { b, 8 } };
+    server.recv(0, riov, 2);
+    EXPECT_EQ(std::string(a, 3), "$pa");
+    EXPECT_EQ(std::string(b, 8), "yload#2a");
+
+    server.send(0, iov, 4);
+    memset(a, 0, sizeof(a));
+    memset(b, 0, sizeof(b));
+    client.recv(riov, 2);
+    EXPECT_EQ(std::string(a, 3), "$pa");
+    EXPECT_EQ(std::string(b, 8), "yload#2a");
+
+    client.set_buffered(4, 4);
+    client.send(iov, 4);
+    server.send(0, iov, 4);
+    client.recv(riov, 2);
+    EXPECT_EQ(std::string(b, 8), "yload#2a");
+    server.recv(0, riov, 2);
+    EXPECT_EQ(std::string(a, 3), "$pa");
+    EXPECT_EQ(std::string(b, 8), "yload#2a");
+}
+
+TEST(socket, send_file) {
+    mwr::server_socket server(1, 0);
+    mwr::socket client(server.host(), server.port());
+    server.poll(100);
+    EXPECT_EQ(server.num_clients(), 1);
+
+    std::string path = mwr::mkstr("%s/send_file_%d", mwr::temp_dir().c_str(),
+                                  mwr::getpid());
+    std::vector<mwr::u8> data(1 * mwr::MiB + 123);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (mwr::u8)(i * 7);
+
+    int fd = mwr::fd_open(path, "w+");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(mwr::fd_write(fd, data.data(), data.size()), data.size());
+    mwr::fd_seek(fd, 0);
+
+    // buffered data must go out before the file contents
+    client.set_buffered();
+    client.send("$");
+
+    std::vector<mwr::u8> buf(data.size());
+    std::thread t([&]() { client.send_file(fd, 100, data.size() - 100); });
+    EXPECT_EQ(server.recv_char(0), '$');
+    server.recv(0, buf.data(), data.size() - 100);
+    t.join();
+    EXPECT_EQ(memcmp(buf.data(), data.data() + 100, data.size() - 100), 0);
+    EXPECT_EQ(mwr::fd_seek_cur(fd, 0), 0);
+
+    t = std::thread([&]() { server.send_file(0, fd, 0, data.size()); });
+    client.recv(buf.data(), data.size());
+    t.join();
+    EXPECT_EQ(buf, data);
+
+    // a file that is too short is detected before anything is sent
+    EXPECT_THROW(client.send_file(fd, data.size(), 1), mwr::report);
+    EXPECT_TRUE(client.is_connected());
+
+    mwr::fd_close(fd);
+    std::remove(path.c_str());
+
+#ifndef MWR_WINDOWS
+    int fds[2];
+    ASSERT_EQ(mwr::fd_pipe(fds), 0);
+    ASSERT_EQ(mwr::fd_write(fds[1], "pipe", 4), 4);
+    client.send_file(fds[0], 0, 4);
+    server.recv(0, buf.data(), 4);
+    EXPECT_EQ(std::string((char*)buf.data(), 4), "pipe");
+
+    // the file cannot be read, but the stream is still intact
+    EXPECT_THROW(client.send_file(fds[1], 0, 4), mwr::report);
+    EXPECT_TRUE(client.is_connected());
+    EXPECT_THROW(server.send_file(0, fds[1], 0, 4), mwr::report);
+    EXPECT_EQ(server.num_clients(), 1);
+
+    mwr::fd_close(fds[0]);
+    mwr::fd_close(fds[1]);
+#endif
+}
+
+TEST(socket, timeouts) {
+    mwr::server_socket server(1, 0);
+    mwr::socket client(server.host(), server.port());
+    server.poll(100);
+    EXPECT_EQ(server.num_clients(), 1);
+
+    EXPECT_EQ(client.recv_timeout(), 0);
+    client.set_recv_timeout(50);
+    EXPECT_EQ(client.recv_timeout(), 50);
+
+    // nothing received yet, so the connection stays usable
+    mwr::u64 start = mwr::timestamp_ms();
+    EXPECT_THROW(client.recv_char(), mwr::report);
+    EXPECT_GE(mwr::timestamp_ms() - start, 50);
+    EXPECT_TRUE(client.is_connected());
+
+    server.send_char(0, 'x');
+    EXPECT_EQ(client.recv_char(), 'x');
+
+    client.set_buffered();
+    EXPECT_THROW(client.recv_char(), mwr::report);
+    EXPECT_TRUE(client.is_connected());
+    server.send_char(0, 'y');
+    EXPECT_EQ(client.recv_char(), 'y');
+
+    // a message that only arrives partially cannot be recovered
+    char buf[4];
+    server.send(0, "ab", 2);
+    EXPECT_THROW(client.recv(buf, sizeof(buf)), mwr::report);
+    EXPECT_FALSE(client.is_connected());
+
+    client.reconnect();
+    EXPECT_TRUE(client.is_connected());
+    server.poll(100);
+    EXPECT_EQ(server.num_clients(), 1);
+
+    // the peer never reads, so the send buffers fill up eventually
+    client.set_unbuffered();
+    client.set_send_timeout(50);
+    std::vector<char> big(64 * mwr::MiB);
+    EXPECT_THROW(client.send(big.data(), big.size()), mwr::report);
+    EXPECT_FALSE(client.is_connected());
+
+    client.reconnect();
+    server.poll(100);
+    EXPECT_EQ(server.num_clients(), 1);
+
+    // sending files is bounded by the same timeout
+    std::string path = mwr::mkstr("%s/send_timeout_%d",
+                                  mwr::temp_dir().c_str(), mwr::getpid());
+    int fd = mwr::fd_open(path, "w+");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(mwr::fd_write(fd, big.data(), big.size()), big.size());
+
+    start = mwr::timestamp_ms();
+    EXPECT_THROW(client.send_file(fd, 0, big.size()), mwr::report);
+    EXPECT_LT(mwr::timestamp_ms() - start, 5000);
+    EXPECT_FALSE(client.is_connected());
+
+    mwr::fd_close(fd);
+    std::remove(path.c_str());
+}
+
+TEST(socket, connect_retry) {
+    mwr::u16 port;
+    {
+        mwr::server_socket server(1, 0, "127.0.0.1");
+        port = server.port();
+    }
+
+    mwr::socket client;
+    EXPECT_THROW(client.reconnect(), mwr::report);
+
+    client.set_retry(3, 10, 20);
+    mwr::u64 start = mwr::timestamp_ms();
+    EXPECT_THROW(client.connect("127.0.0.1", port), mwr::report);
+    EXPECT_GE(mwr::timestamp_ms() - start, 10 + 20 + 20);
+    EXPECT_FALSE(client.is_connected());
+
+    // unroutable addresses either fail right away or time out
+    client.set_retry(0);
+    client.set_connect_timeout(100);
+    start = mwr::timestamp_ms();
+    EXPECT_THROW(client.connect("10.255.255.1", 9), mwr::report);
+    EXPECT_LT(mwr::timestamp_ms() - start, 1000);
+}
+
+#ifdef MWR_LINUX
+TEST(socket, connect_unix_retry) {
+    const std::string path = "@mwr_test_connect_unix_retry";
+    mwr::socket client;
+    client.set_retry(3, 10, 20);
+    mwr::u64 start = mwr::timestamp_ms();
+    EXPECT_THROW(client.connect_unix(path), mwr::report);
+    EXPECT_GE(mwr::timestamp_ms() - start, 10 + 20 + 20);
+
+    mwr::server_socket server(1);
+    server.listen_unix(path);
+    client.set_retry(0);
+    client.reconnect();
+    EXPECT_TRUE(client.is_unix());
+}
+
+TEST(socket, buffered_flush_timeout) {
+    const std::string path = "@mwr_test_buffered_flush_timeout";
+    for (int i = 0; i < 2; i++) {
+        mwr::server_socket server(1);
+        server.listen_unix(path);
+        mwr::socket client;
+        client.connect_unix(path);
+        client.set_send_timeout(10);
+        while (!server.is_connected(0))
+            server.poll(100);
+
+        // the peer never reads, so single bytes fill up its buffers without
+        // ever leaving a message half sent
+        while (true) {
+            try {
+                client.send_char('.');
+            } catch (mwr::report&) {
+                break;
+            }
+        }
+
+        ASSERT_TRUE(client.is_connected());
+        client.set_buffered();
+        server.send(0, "abc");
+        EXPECT_EQ(client.recv_char(), 'a');
+
+        // waiting for the rest flushes first, which times out and loses the
+        // bytes that were already consumed
+        client.send_char('x');
+        char buf[4];
+        mwr::iovec iov[] = { { buf, 2 }, { buf + 2, 2 } };
+        if (i == 0)
+            EXPECT_THROW(client.recv(buf, sizeof(buf)), mwr::report);
+        else
+            EXPECT_THROW(client.recv(iov, 2), mwr::report);
+        EXPECT_FALSE(client.is_connected());
+    }
+}
+#endif
+
+TEST(socket, busy_poll) {
+    mwr::server_socket server(1, 0);
+    mwr::socket client(server.host(), server.port());
+    server.poll(100);
+    EXPECT_EQ(server.num_clients(), 1);
+
+    EXPECT_EQ(client.get_busy_poll(), 0);
+    client.set_busy_poll(16, 50);
+    server.set_busy_poll(16);
+    EXPECT_EQ(client.get_busy_poll(), 16);
+    EXPECT_EQ(server.get_busy_poll(), 16);
+
+    // nothing arrives during the spin budget, so both sides must sleep
+    std::thread t([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        server.send_char(0, 'x');
+        EXPECT_EQ(server.recv_char(0), 'y');
+    });
+
+    EXPECT_EQ(client.recv_char(), 'x');
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    client.send_char('y');
+    t.join();
+
+    mwr::busy_poll_stats stats = client.get_busy_poll_stats();
+    EXPECT_EQ(stats.spins, 16);
+    EXPECT_EQ(stats.sleeps, 1);
+    EXPECT_EQ(stats.hits, 0);
+
+    stats = server.get_busy_poll_stats();
+    EXPECT_EQ(stats.spins, 16);
+    EXPECT_EQ(stats.sleeps, 1);
+
+    // data that is already there does not spin at all
+    client.reset_busy_poll_stats();
+    server.send_char(0, 'z');
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(client.recv_char(), 'z');
+    EXPECT_EQ(client.get_busy_poll_stats().spins, 0);
+
+    // timeouts still apply after the spin budget is used up
+    client.set_recv_timeout(50);
+    EXPECT_THROW(client.recv_char(), mwr::report);
+    EXPECT_TRUE(client.is_connected());
+}
@@ -78,3 +78,176 @@ TEST(watchdog, extra) {
 
     EXPECT_EQ(counter, 2);
 }
+
+TEST(watchdog, cancel_one) {
+    mwr::watchdog wd("cancel_one");
+    std::atomic<int> a = 0;
+    std::atomic<int> b = 0;
+
+    auto ha = wd.schedule(50ms, [&a] { a++; });
+    auto hb = wd.schedule(50ms, [&b] { b++; });
+    EXPECT_NE(ha, mwr::watchdog::INVALID_HANDLE);
+    EXPECT_NE(ha, hb);
+    EXPECT_EQ(wd.num_pending(), 2);
+    EXPECT_TRUE(wd.is_pending(ha));
+
+    EXPECT_TRUE(wd.cancel(ha));
+    EXPECT_FALSE(wd.cancel(ha));
+    EXPECT_FALSE(wd.is_pending(ha));
+    EXPECT_EQ(wd.num_pending(), 1);
+
+    std::this_thread::sleep_for(100ms);
+    EXPECT_EQ(a, 0);
+    EXPECT_EQ(b, 1);
+    EXPECT_FALSE(wd.is_pending(hb));
+    EXPECT_FALSE(wd.cancel(hb));
+    EXPECT_EQ(wd.num_pending(), 0);
+}
+
+TEST(watchdog, periodic) {
+    mwr::watchdog wd("periodic");
+    std::atomic<int> counter = 0;
+
+    auto h = wd.schedule_periodic(10ms, [&counter] { counter++; });
+    std::this_thread::sleep_for(105ms);
+    EXPECT_TRUE(wd.is_pending(h));
+    EXPECT_TRUE(wd.cancel(h));
+
+    int n = counter;
+    EXPECT_GE(n, 5);
+    EXPECT_LE(n, 11);
+
+    std::this_thread::sleep_for(30ms);
+    EXPECT_EQ(counter, n);
+}
+
+TEST(watchdog, periodic_cancel_self) {
+    mwr::watchdog wd("cancel_self");
+    std::atomic<int> counter = 0;
+    mwr::watchdog::handle h = mwr::watchdog::INVALID_HANDLE;
+
+    h = wd.schedule_periodic(1ms, [&] {
+        if (++counter == 3) {
+            EXPECT_TRUE(wd.cancel(h));
+        }
+    });
+
+    std::this_thread::sleep_for(50ms);
+    EXPECT_EQ(counter, 3);
+    EXPECT_EQ(wd.num_pending(), 0);
+}
+
+TEST(watchdog, many) {
+    mwr::watchdog wd("many");
+    const int n = 10000;
+    std::atomic<int> counter = 0;
+    std::atomic<int> early = 0;
+
+    // spread across all levels of the wheel, cancel every other one
+    std::vector<mwr::watchdog::handle> handles;
+    for (int i = 0; i < n; i++) {
+        auto delta = std::chrono::microseconds((i * 7919) % 200000);
+        auto deadline = mwr::watchdog::clock_t::now() + delta;
+        handles.push_back(wd.schedule(delta, [&, deadline] {
+            if (mwr::watchdog::clock_t::now() < deadline)
+                early++;
+            counter++;
+        }));
+    }
+
+    // tasks that already ran cannot be cancelled anymore
+    int cancelled = 0;
+    for (int i = 0; i < n; i += 2)
+        cancelled += wd.cancel(handles[i]) ? 1 : 0;
+    EXPECT_GT(cancelled, 0);
+
+    auto far = wd.schedule(24h, [&counter] { counter += n; });
+    std::this_thread::sleep_for(300ms);
+    EXPECT_EQ(counter, n - cancelled);
+    EXPECT_EQ(early, 0);
+    EXPECT_EQ(wd.num_pending(), 1);
+    EXPECT_TRUE(wd.cancel(far));
+}
+
+TEST(watchdog, wakeup) {
+    for (auto wakeup : { mwr::WATCHDOG_SLEEP, mwr::WATCHDOG_TIMERFD,
+                         mwr::WATCHDOG_SPIN }) {
+        mwr::watchdog wd("wakeup", 0, wakeup);
+#ifndef MWR_LINUX
+        if (wakeup == mwr::WATCHDOG_TIMERFD)
+            EXPECT_EQ(wd.wakeup(), mwr::WATCHDOG_SLEEP);
+#else
+        EXPECT_EQ(wd.wakeup(), wakeup);
+#endif
+        EXPECT_GT(wd.spin_tail().count(), 0);
+
+        for (int i = 0; i < 5; i++) {
+            std::atomic<bool> done = false;
+            auto start = mwr::watchdog::clock_t::now();
+            mwr::watchdog::clock_t::time_point end;
+            wd.schedule(20ms, [&] {
+                end = mwr::watchdog::clock_t::now();
+                done = true;
+            });
+
+            while (!done)
+                std::this_thread::sleep_for(1ms);
+            EXPECT_GE(end - start, 20ms);
+            EXPECT_LT(end - start, 100ms);
+        }
+    }
+}
+
+TEST(watchdog, wakeup_earlier) {
+    // a spinning worker would keep the test from scheduling anything
+    if (std::thread::hardware_concurrency() < 2)
+        GTEST_SKIP() << "needs more than one cpu";
+
+    for (auto wakeup : { mwr::WATCHDOG_SLEEP, mwr::WATCHDOG_TIMERFD,
+                         mwr::WATCHDOG_SPIN }) {
+        mwr::watchdog wd("wakeup_earlier", 0, wakeup);
+        for (int i = 0; i < 5; i++) {
+            // the worker is already spinning towards the first deadline
+            // when the second task arrives, yet that must not delay it
+            std::atomic<bool> done = false;
+            auto start = mwr::watchdog::clock_t::now();
+            mwr::watchdog::clock_t::time_point end;
+            wd.schedule(9ms, [] {});
+            std::this_thread::sleep_for(200us);
+            wd.schedule(1ms, [&] {
+                end = mwr::watchdog::clock_t::now();
+                done = true;
+            });
+
+            while (!done)
+                std::this_thread::sleep_for(1ms);
+            EXPECT_LT(end - start, 5ms);
+            std::this_thread::sleep_for(10ms);
+        }
+    }
+}
+
+TEST(watchdog, workers) {
+    mwr::watchdog wd("workers", 4);
+    EXPECT_EQ(wd.num_workers(), 4);
+
+    // all tasks must be running at the same time to finish
+    std::atomic<int> started = 0;
+    std::atomic<int> finished = 0;
+    for (int i = 0; i < 4; i++) {
+        wd.schedule(10ms, [&] {
+            started++;
+            while (started < 4)
+                std::this_thread::yield();
+            finished++;
+        });
+    }
+
+    std::atomic<int> ticks = 0;
+    auto h = wd.schedule_periodic(5ms, [&ticks] { ticks++; });
+
+    std::this_thread::sleep_for(100ms);
+    EXPECT_EQ(finished, 4);
+    EXPECT_TRUE(wd.cancel(h));
+    EXPECT_GE(ticks, 5);
+}